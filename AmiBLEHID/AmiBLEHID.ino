@@ -55,6 +55,45 @@ const int k_mouseRates[NUM_MOUSE_RATES] = {48, 64, 96, 160, 224};
 const int k_defaultMouseRateIdx = 1;
 
 const int k_hardResetHoldTime   = 140 * 3;      // works out at approx 3 secs. 
+const int k_tickMs              = 3;            // Housekeeping period (and loop period when not connected)
+
+// Keyboard joystick mapping. A key can drive several outputs (e.g. the keypad diagonals), and any number of keys can
+// drive the same output. Edit this table to remap the keyboard
+#define KEYJOY_UP      0x01
+#define KEYJOY_DOWN    0x02
+#define KEYJOY_LEFT    0x04
+#define KEYJOY_RIGHT   0x08
+#define KEYJOY_FIRE_A  0x10
+#define KEYJOY_FIRE_B  0x20
+
+struct KeyJoystickMapping
+{
+    uint8_t key;        // hid::USAGE_KEYBOARD_* / USAGE_KEYPAD_*
+    uint8_t outputs;    // KEYJOY_*
+};
+
+const KeyJoystickMapping k_keyJoystickMap[] =
+{
+    { hid::USAGE_KEYBOARD_UPARROW,       KEYJOY_UP                  },
+    { hid::USAGE_KEYBOARD_DOWNARROW,     KEYJOY_DOWN                },
+    { hid::USAGE_KEYBOARD_LEFTARROW,     KEYJOY_LEFT                },
+    { hid::USAGE_KEYBOARD_RIGHTARROW,    KEYJOY_RIGHT               },
+    { hid::USAGE_KEYPAD_8,               KEYJOY_UP                  },
+    { hid::USAGE_KEYPAD_2,               KEYJOY_DOWN                },
+    { hid::USAGE_KEYPAD_4,               KEYJOY_LEFT                },
+    { hid::USAGE_KEYPAD_6,               KEYJOY_RIGHT               },
+    { hid::USAGE_KEYPAD_7,               KEYJOY_UP   | KEYJOY_LEFT  },
+    { hid::USAGE_KEYPAD_9,               KEYJOY_UP   | KEYJOY_RIGHT },
+    { hid::USAGE_KEYPAD_1,               KEYJOY_DOWN | KEYJOY_LEFT  },
+    { hid::USAGE_KEYPAD_3,               KEYJOY_DOWN | KEYJOY_RIGHT },
+    { hid::USAGE_KEYBOARD_SPACEBAR,      KEYJOY_FIRE_A              },
+    { hid::USAGE_KEYBOARD_LEFT_CONTROL,  KEYJOY_FIRE_A              },
+    { hid::USAGE_KEYBOARD_Z,             KEYJOY_FIRE_A              },
+    { hid::USAGE_KEYPAD_0,               KEYJOY_FIRE_A              },
+    { hid::USAGE_KEYBOARD_LEFT_ALT,      KEYJOY_FIRE_B              },
+    { hid::USAGE_KEYBOARD_RIGHT_CONTROL, KEYJOY_FIRE_B              },
+    { hid::USAGE_KEYBOARD_X,             KEYJOY_FIRE_B              },
+};
 
 // ------------------------------------------------------------------------------------------------------------------------
 // States
@@ -96,6 +135,11 @@ GamepadMode     _currGamepadMode         = GamepadMode::Default;
 LEDs            _statusLeds;
 int             _resetHeldTimer          = 0;
 
+// The connected loop wakes for every report, but the things that count time (CD32 polling detection, the reset
+// button, mouse rates) only run on ticks, every k_tickMs as before
+bool            _tick                    = true;
+uint32_t        _lastTickMs              = 0;
+
 volatile bool   _cd32Polling             = false;
 volatile int    _cd32ButtonShiftRegister = 0;
 volatile int    _cd32buttonState         = 0;
@@ -111,10 +155,17 @@ int             _mouseQuadX              = 0;
 int             _mouseQuadY              = 0;
 int             _numQuadratureTicks      = 0;
 
+bool            _outputsDirty            = true;    // Forces the next gamepad/mouse update to rewrite all outputs
+bool            _prevCd32Mode            = false;
+bool            _rightStickMouseActive   = false;   // Gamepad right stick is driving the mouse outputs
+bool            _touchpadMouseActive     = false;   // Mouse part of a composite device is driving the mouse outputs
+
 const uint8_t   _quad0[4]                = {0,1,1,0};
 const uint8_t   _quad1[4]                = {0,0,1,1};
 const int       _quadCounterShiftDown    = 12;
 
+uint8_t         _keyJoystickOutputs[hid::KeyboardConfig::NUM_KEYS];     // KEYJOY_* per key, built from k_keyJoystickMap
+
 // ------------------------------------------------------------------------------------------------------------------------
 // Main setup function
 // ------------------------------------------------------------------------------------------------------------------------
@@ -150,6 +201,8 @@ void setup ()
     
     zeroOutputs();
 
+    initKeyJoystickOutputs();
+
     Serial.begin(115200);
     
     delay(500);
@@ -174,6 +227,7 @@ void setup ()
     _btScan->start(_scanDuration);
 
     _btHIDConn = new BTHIDConn();
+    _btHIDConn->setReportTask( xTaskGetCurrentTaskHandle() );    // setup() and loop() share the Arduino loop task
 
     _state = State_Scanning;
 }
@@ -209,6 +263,27 @@ void delayWithLEDUpdates( int millis )
 }
 
 
+// ------------------------------------------------------------------------------------------------------------------------
+// Wait until a report arrives (notified by BTHIDConn::notifyCB) or the next tick is due, with LED updates every 16ms
+// ------------------------------------------------------------------------------------------------------------------------
+
+uint32_t _lastLEDUpdateMs = 0;
+
+void waitForReportOrTick()
+{
+    int32_t waitMs = k_tickMs - (int32_t)(millis() - _lastTickMs);
+    ulTaskNotifyTake( pdTRUE, waitMs>0 ? pdMS_TO_TICKS( waitMs ) : 0 );
+
+    uint32_t now = millis();
+    if ( now - _lastLEDUpdateMs>=16 )
+    {
+        _lastLEDUpdateMs = now;
+        _statusLeds.process();
+        FastLED.show();
+    }
+}
+
+
 
 // ------------------------------------------------------------------------------------------------------------------------
 // Load settings from prefs store
@@ -254,6 +329,13 @@ void saveSettings()
 
 void loop ()
 {        
+    uint32_t nowMs = millis();
+    _tick = (nowMs - _lastTickMs)>=(uint32_t)k_tickMs;
+    if ( _tick )
+    {
+        _lastTickMs = nowMs;
+    }
+
     switch( _state )
     {
         case State_Scanning:
@@ -317,15 +399,35 @@ void loop ()
                 }
                 else
                 {
+                    // The reports that arrived since the last iteration, so the state below is up to date. The
+                    // updates call outputsUpdated() when they write outputs, for the latency histogram
+                    _btHIDConn->processReports();
+
+                    // A composite gamepad+mouse device is handled by update_gamepad, with the mouse part
+                    // driving the quadrature outputs like the right stick does. Digitizers (touchpads, pen tablets)
+                    // come out of BTHIDConn as mouse deltas
                     if ( _btHIDConn->isGamepad() )
                     {
                         update_gamepad();               
                     }
-
-                    if ( _btHIDConn->isMouse() )
+                    else if ( _btHIDConn->isMouse() || _btHIDConn->isDigitizer() )
                     {
                         update_mouse();
                     }
+                    else if ( _btHIDConn->isKeyboard() )
+                    {
+                        update_keyboard();
+                    }
+
+                    // Any character received over serial prints the report to output latency
+                    if ( Serial.available()>0 )
+                    {
+                        while ( Serial.available()>0 )
+                        {
+                            Serial.read();
+                        }
+                        _btHIDConn->printLatencyHistogram();
+                    }
                 }
             }
 
@@ -337,8 +439,21 @@ void loop ()
             break;
     }        
 
-    // 3ms delay, refresh approx 4x per 60hz frame. Bluetooth will be the limiting factor
-    delayWithLEDUpdates(3);
+    // Connected, wake as soon as a report arrives so the outputs follow it straight away. Otherwise a 3ms delay,
+    // refresh approx 4x per 60hz frame
+    if ( _state==State_Connected )
+    {
+        waitForReportOrTick();
+    }
+    else
+    {
+        delayWithLEDUpdates(k_tickMs);
+    }
+
+    if ( !_tick )
+    {
+        return;
+    }
 
     if ( digitalRead(PIN_BTN_RESET)==0 )
     {
@@ -388,25 +503,30 @@ void loop ()
 // Check for held input used to change modes
 // ------------------------------------------------------------------------------------------------------------------------
 
-bool _prevModeDecButton = false;
-bool _prevModeIncButton = false;
+bool _prevModeButton = false;
 
-int modeCycleCheck( bool decButton, bool incButton )
+// The controller's mode buttons come from the parser's event queue, so a press shorter than a loop iteration
+// still counts. idx0/idx1 are gamepad (or mouse) button indexes, -1 for none. The board's mode button is
+// polled. Events of other buttons are discarded
+int modeCycleCheck( int idx0, int idx1, bool modeButton )
 {
     int dir = 0;
 
-    if ( incButton && !_prevModeIncButton )    
+    hid::InputEventQueue::Event event;
+    while ( _btHIDConn->popInputEvent( event ) )
     {
-        dir = 1;
+        if ( event.type==hid::InputEventQueue::EVENT_BUTTON_DOWN && ( event.index==idx0 || event.index==idx1 ) )
+        {
+            dir = 1;
+        }
     }
 
-    if ( decButton && !_prevModeDecButton )
+    if ( modeButton && !_prevModeButton )
     {
         dir = 1;
     }
 
-    _prevModeDecButton = decButton;
-    _prevModeIncButton = incButton;
+    _prevModeButton = modeButton;
 
     return dir;
 }
@@ -504,12 +624,45 @@ void setupInterrupts()
 }
 
 
+// The gamepad axes and buttons read by update_gamepad/update_gamepad_outputs in the current mode. The parser
+// skips the fields of everything else (triggers, extra axes, unused buttons). A field that becomes needed after
+// a mode switch catches up with the next report. The mouse of a composite device shares the indexes: its X/Y
+// deltas are int32s 0/1 and its buttons bools 0-2, so it's always included
+hid::SelectiveInputReportParser::ChangeMask gamepadInterest( bool cd32mode )
+{
+    hid::SelectiveInputReportParser::ChangeMask interest = {};
+
+    interest.int32s = (1u<<hid::GamepadConfig::X) | (1u<<hid::GamepadConfig::Y) | (1u<<hid::GamepadConfig::HAT_SWITCH) |
+                      (1u<<hid::GamepadConfig::Z) | (1u<<hid::GamepadConfig::RZ);     // Right stick: CD32 buttons or mouse
+
+    interest.bools  = (1ull<<0) | (1ull<<1) | (1ull<<6) | (1ull<<7) |                  // Fire buttons / bumpers
+                      (1ull<<2) |                                                      // Composite middle mouse button
+                      (1ull<<10) | (1ull<<11);                                         // Mode cycle, CD32 play
+
+    if ( cd32mode || _currGamepadMode == GamepadMode::UpToJump )
+    {
+        interest.bools |= (1ull<<3);
+    }
+
+    if ( cd32mode )
+    {
+        interest.bools |= (1ull<<4);
+    }
+
+    return interest;
+}
+
 void update_gamepad()
 {
     // Is controller being polled as a CD32 controller?
-    _cd32ticksSincePolled++;
+    if ( _tick )
+    {
+        _cd32ticksSincePolled++;
+    }
     bool cd32mode = (_cd32ticksSincePolled<250);
 
+    _btHIDConn->setGamepadInterest( gamepadInterest( cd32mode ) );
+
     // Stop the timer in CD32 mode to try and help keep interrupts responsive
     // (Mouse emulation is disabled if CD32 pad polling is occuring)
     if (cd32mode == _quadratureTimerStarted)
@@ -526,29 +679,82 @@ void update_gamepad()
         }
     }
     
+    if ( _btHIDConn->isComposite() )
+    {
+        update_touchpad_mouse( cd32mode );
+    }
+
+    // Only recompute the outputs if a report changed something, or the output mode changed
+    bool refresh = _btHIDConn->takeChanges().Any() || _outputsDirty || (cd32mode != _prevCd32Mode);
+    _prevCd32Mode = cd32mode;
+    _outputsDirty = false;
+
+    if ( refresh )
+    {
+        update_gamepad_outputs( cd32mode );
+        _btHIDConn->outputsUpdated();
+    }
+
+    _statusLeds.setState(LED_STATUS, cd32mode ? LEDMODE_CD32CONTROLLER_ACTIVE : LEDMODE_CONTROLLER_ACTIVE);        
+
+    // Check for mode switch (up-to-jumps)
+    int inc = modeCycleCheck( 10, cd32mode ? -1 : 11, digitalRead(PIN_BTN_MODE)==0 );
+
+    if ( inc!=0 )
+    {        
+        _currGamepadMode=(GamepadMode)(_currGamepadMode+inc);
+
+        if ( _currGamepadMode>=GamepadMode::Invalid )
+        {
+            _currGamepadMode = GamepadMode::Default;             
+        }
+        else if (_currGamepadMode<(GamepadMode)0)
+        {
+            _currGamepadMode = (GamepadMode)(GamepadMode::Invalid-1);
+        }
+        
+        _outputsDirty = true;
+        saveSettings();
+    }    
+
+    _statusLeds.setState(LED_MODE, (LEDState)(LED_GAMEPADMODE_0+_currGamepadMode) );
+}
+
+
+void update_gamepad_outputs( bool cd32mode )
+{
+    // One consistent copy of the pad's state for all the outputs
+    InputSnapshot pad = _btHIDConn->getInputSnapshot();
+
     int deadzone = ANALOG_STICK_DEADZONE;
-    int x = _btHIDConn->getGamepadLeftStickXAxis();
-    int y = _btHIDConn->getGamepadLeftStickYAxis();    
+    int x = pad.leftX;
+    int y = pad.leftY;
 
-    //Serial.printf("%d, %d, %d\n",  _btHIDConn->getGamepadLeftStickXAxis(),  _btHIDConn->getGamepadLeftStickYAxis(),  _btHIDConn->getGamepadHatSwitchDir() ); 
+    //Serial.printf("%d, %d, %d\n", pad.leftX, pad.leftY, pad.hatDir ); 
     
-    bool joyr = (x> deadzone) || (_btHIDConn->getGamepadDigitalXAxis()>0);
-    bool joyl = (x<-deadzone) || (_btHIDConn->getGamepadDigitalXAxis()<0);
-    bool joyu = (y<-deadzone) || (_btHIDConn->getGamepadDigitalYAxis()<0);
-    bool joyd = (y> deadzone) || (_btHIDConn->getGamepadDigitalYAxis()>0);
+    bool joyr = (x> deadzone) || (pad.digitalX>0);
+    bool joyl = (x<-deadzone) || (pad.digitalX<0);
+    bool joyu = (y<-deadzone) || (pad.digitalY<0);
+    bool joyd = (y> deadzone) || (pad.digitalY>0);
 
     if ( joyr && joyl ) joyr=joyl=false;
     if ( joyu && joyd ) joyu=joyd=false;
 
-    bool btna = _btHIDConn->getGamePadButton(0); // A on Xbox pad
-    bool btnb = _btHIDConn->getGamePadButton(1); // B on Xbox pad
+    bool btna = pad.button(0); // A on Xbox pad
+    bool btnb = pad.button(1); // B on Xbox pad
+
+    if ( _btHIDConn->isComposite() )
+    {
+        btna |= pad.mouseButton(0);
+        btnb |= pad.mouseButton(1);
+    }
 
     // If in up-to-jump mode, the B button is jump, and up is disabled so it's not accidentally triggered
     // For some games, e.g. with up to climb ladders, we may want to allow up too?
     if ( _currGamepadMode == GamepadMode::UpToJump && (!cd32mode) )
     {
         joyu = btnb;
-        btnb = _btHIDConn->getGamePadButton(3);  // X on Xbox pad
+        btnb = pad.button(3);  // X on Xbox pad
     }
 
     if ( cd32mode )
@@ -556,8 +762,8 @@ void update_gamepad()
         int _buttonState = 0;
 
         // Right analog mapped to CD32 buttons, basically for Cecconoid
-        int  rx = _btHIDConn->getGamepadRightStickXAxis();
-        int  ry = _btHIDConn->getGamepadRightStickYAxis();    
+        int  rx = pad.rightX;
+        int  ry = pad.rightY;
         bool rjoyr = (rx> deadzone);
         bool rjoyl = (rx<-deadzone);
         bool rjoyu = (ry<-deadzone);
@@ -568,11 +774,11 @@ void update_gamepad()
 
         if ( btna ) _buttonState |= 2;
         if ( btnb ) _buttonState |= 1;
-        if ( _btHIDConn->getGamePadButton(4) || rjoyu )  _buttonState |= 4;
-        if ( _btHIDConn->getGamePadButton(3) || rjoyl )  _buttonState |= 8;
-        if ( _btHIDConn->getGamePadButton(7) )  _buttonState |= 16;
-        if ( _btHIDConn->getGamePadButton(6) )  _buttonState |= 32;
-        if ( _btHIDConn->getGamePadButton(11))  _buttonState |= 64;
+        if ( pad.button(4) || rjoyu )  _buttonState |= 4;
+        if ( pad.button(3) || rjoyl )  _buttonState |= 8;
+        if ( pad.button(7) )  _buttonState |= 16;
+        if ( pad.button(6) )  _buttonState |= 32;
+        if ( pad.button(11))  _buttonState |= 64;
 
         noInterrupts();
         _cd32buttonState = _buttonState;    
@@ -595,12 +801,12 @@ void update_gamepad()
     {   
         // Right analog acts as mouse. All we need to do is set the mouse speed, as the timer for the quadrature output
         // is still running even in gamepad mode. Just don't set the UDLR pins is mouse is active
-        int mx = _btHIDConn->getGamepadRightStickXAxis();
-        int my = _btHIDConn->getGamepadRightStickYAxis();
+        int mx = pad.rightX;
+        int my = pad.rightY;
 
         // More comfortable buttons when using right stick for mouse emulation
-        btna |= _btHIDConn->getGamePadButton(6);     // L Bumper on Xbox pad
-        btnb |= _btHIDConn->getGamePadButton(7);     // R Bumper on Xbox pad        
+        btna |= pad.button(6);     // L Bumper on Xbox pad
+        btnb |= pad.button(7);     // R Bumper on Xbox pad        
 
         if ( mx>MOUSE_STICK_DEADZONE || mx<-MOUSE_STICK_DEADZONE ||
             my>MOUSE_STICK_DEADZONE || my<-MOUSE_STICK_DEADZONE )
@@ -625,9 +831,18 @@ void update_gamepad()
             _clampedMouseRateX  = smx;
             _clampedMouseRateY  = smy;
             interrupts();
+
+            _rightStickMouseActive = true;
+        }
+        else if ( _touchpadMouseActive )
+        {
+            // Composite device mouse is moving. update_touchpad_mouse sets the rates, leave the UDLR pins to the timer
+            _rightStickMouseActive = false;
         }
         else
         {
+            _rightStickMouseActive = false;
+
             _clampedMouseRateX  = 0;
             _clampedMouseRateY  = 0;
 
@@ -646,28 +861,6 @@ void update_gamepad()
     }
         
     _statusLeds.setButtonIndicator( btna | btnb );
-    _statusLeds.setState(LED_STATUS, cd32mode ? LEDMODE_CD32CONTROLLER_ACTIVE : LEDMODE_CONTROLLER_ACTIVE);        
-
-    // Check for mode switch (up-to-jumps)
-    int inc = modeCycleCheck( _btHIDConn->getGamePadButton(10), (_btHIDConn->getGamePadButton(11) && !cd32mode) || digitalRead(PIN_BTN_MODE)==0 );
-
-    if ( inc!=0 )
-    {        
-        _currGamepadMode=(GamepadMode)(_currGamepadMode+inc);
-
-        if ( _currGamepadMode>=GamepadMode::Invalid )
-        {
-            _currGamepadMode = GamepadMode::Default;             
-        }
-        else if (_currGamepadMode<(GamepadMode)0)
-        {
-            _currGamepadMode = (GamepadMode)(GamepadMode::Invalid-1);
-        }
-        
-        saveSettings();
-    }    
-
-    _statusLeds.setState(LED_MODE, (LEDState)(LED_GAMEPADMODE_0+_currGamepadMode) );
 }
 
 
@@ -696,23 +889,15 @@ void IRAM_ATTR onQuadratureTimer()
     _numQuadratureTicks++;
 }
 
-void update_mouse()
+// Turns the mouse deltas received since the last call into quadrature rates for the timer
+void update_mouse_rate()
 {
-    if (!_quadratureTimerStarted)
-    {
-        _quadratureTimerStarted = true;
-        timerStart(_quadratureTimer);
-    }
-
     int maxMouseRate = (1<<_quadCounterShiftDown);
 
     int mx  = _btHIDConn->getMouseDeltaX();
     int my  = _btHIDConn->getMouseDeltaY();
     _btHIDConn->resetMouseDeltas();
 
-    int lmb = _btHIDConn->getMouseButton(0);
-    int rmb = _btHIDConn->getMouseButton(1);
-
     // Apply rate scaling here
     int rate = k_mouseRates[_currMouseRateIdx];    
 
@@ -744,15 +929,70 @@ void update_mouse()
     _numQuadratureTicks = 0;
     interrupts();
 
-    digitalWrite(PIN_A, lmb); 
-    digitalWrite(PIN_B, rmb); 
+    _btHIDConn->outputsUpdated();
+}
+
+// Mouse part of a composite gamepad+mouse device. Outside CD32 mode it drives the quadrature outputs, unless the
+// right stick is already doing that
+void update_touchpad_mouse( bool cd32mode )
+{
+    bool active = false;
+
+    if ( cd32mode || _rightStickMouseActive )
+    {
+        _btHIDConn->resetMouseDeltas();
+    }
+    else if ( !_tick )
+    {
+        // Rates are averaged over the timer ticks since the last update, so they're only updated on ticks
+        return;
+    }
+    else
+    {
+        update_mouse_rate();
+        active = (_mouseRateX!=0 || _mouseRateY!=0);
+    }
+
+    // Joystick outputs take the UDLR pins back when it stops
+    if ( active != _touchpadMouseActive )
+    {
+        _touchpadMouseActive = active;
+        _outputsDirty        = true;
+    }
+}
+
+void update_mouse()
+{
+    if (!_quadratureTimerStarted)
+    {
+        _quadratureTimerStarted = true;
+        timerStart(_quadratureTimer);
+    }
+
+    // Averaged over the timer ticks since the last update, so only on ticks. The deltas keep accumulating
+    if ( _tick )
+    {
+        update_mouse_rate();
+    }
+
+    int lmb = _btHIDConn->getMouseButton(0);
+    int rmb = _btHIDConn->getMouseButton(1);
+
+    // Buttons only need writing when a report changed them
+    if ( _btHIDConn->takeChanges().bools || _outputsDirty )
+    {
+        _outputsDirty = false;
+        digitalWrite(PIN_A, lmb); 
+        digitalWrite(PIN_B, rmb); 
+        _statusLeds.setButtonIndicator( lmb | rmb );
+        _btHIDConn->outputsUpdated();
+    }
 
     // White LED for active mouse
-    _statusLeds.setButtonIndicator( lmb | rmb );
     _statusLeds.setState(LED_STATUS, LEDMODE_MOUSE_ACTIVE);    
 
     // Check for mode switch (cycle mouse speeds)
-    int inc = modeCycleCheck( false, _btHIDConn->getMouseButton(2) || digitalRead(PIN_BTN_MODE)==0 );
+    int inc = modeCycleCheck( 2, -1, digitalRead(PIN_BTN_MODE)==0 );
 
     if ( inc!=0 )
     {        
@@ -768,6 +1008,56 @@ void update_mouse()
 }
 
 
+// ------------------------------------------------------------------------------------------------------------------------
+// Keyboard Update
+// ------------------------------------------------------------------------------------------------------------------------
+
+void initKeyJoystickOutputs()
+{
+    memset( _keyJoystickOutputs, 0, sizeof(_keyJoystickOutputs) );
+
+    for ( const KeyJoystickMapping& mapping : k_keyJoystickMap )
+    {
+        _keyJoystickOutputs[mapping.key] |= mapping.outputs;
+    }
+}
+
+void update_keyboard()
+{
+    // Only the held keys are visited, so a full NKRO bitmap costs a handful of word tests per update
+    if ( _btHIDConn->takeChanges().bools || _outputsDirty )
+    {
+        _outputsDirty = false;
+
+        uint8_t outputs = 0;
+        _btHIDConn->getKeyboardKeys().ForEachSet( [&]( size_t key ) { outputs |= _keyJoystickOutputs[key]; } );
+
+        bool joyu = (outputs & KEYJOY_UP);
+        bool joyd = (outputs & KEYJOY_DOWN);
+        bool joyl = (outputs & KEYJOY_LEFT);
+        bool joyr = (outputs & KEYJOY_RIGHT);
+        bool btna = (outputs & KEYJOY_FIRE_A);
+        bool btnb = (outputs & KEYJOY_FIRE_B);
+
+        if ( joyr && joyl ) joyr=joyl=false;
+        if ( joyu && joyd ) joyu=joyd=false;
+
+        digitalWrite(PIN_U, joyu); 
+        digitalWrite(PIN_D, joyd); 
+        digitalWrite(PIN_L, joyl); 
+        digitalWrite(PIN_R, joyr); 
+        digitalWrite(PIN_A, btna); 
+        digitalWrite(PIN_B, btnb); 
+
+        _statusLeds.setButtonIndicator( btna | btnb );
+        _btHIDConn->outputsUpdated();
+    }
+
+    _statusLeds.setState(LED_STATUS, LEDMODE_CONTROLLER_ACTIVE);
+    _statusLeds.setState(LED_MODE,   LEDMODE_OFF);
+}
+
+
 // ------------------------------------------------------------------------------------------------------------------------
 // Zero all outputs
 // ------------------------------------------------------------------------------------------------------------------------
@@ -787,5 +1077,7 @@ void zeroOutputs()
     digitalWrite(PIN_R, 0); 
     digitalWrite(PIN_A, 0); 
     digitalWrite(PIN_B, 0); 
+
+    _outputsDirty = true;
 }
 
@@ -7,10 +7,25 @@
 
 #include <Arduino.h>
 #include <NimBLEDevice.h>
+#include <Preferences.h>
 #include <BTHIDConn.h>
 
 //#define FULL_LOGGING
 
+// Logs the CPU cycles spent in m_parser.Parse() every 256 reports
+//#define PARSER_TIMING
+
+// Logs the report queue counters and the longest time a report waited to be parsed every 5 seconds
+//#define REPORT_QUEUE_STATS
+
+#ifdef PARSER_TIMING
+#include <esp_cpu.h>
+#endif
+
+// Hat direction (0 = centred, 1-8 = up, clockwise) -> digital axes
+const int hatSwitchXAxis[9] = { 0, 0, 1, 1, 1, 0,-1,-1,-1};
+const int hatSwitchYAxis[9] = { 0,-1,-1, 0, 1, 1, 1, 0,-1};
+
 // Main scanner class
 // ========================================================================================================================
 
@@ -94,8 +109,29 @@ public:
 // ------------------------------------------------------------------------------------------------------------------------
 
 BTHIDConn::BTHIDConn()
+    : m_parserArena( m_parserArenaBuffer, sizeof(m_parserArenaBuffer) ),
+      m_descriptorStream( &m_parserArena ),
+      m_reports( m_reportBuffer, REPORT_QUEUE_SIZE ),
+      m_events( m_eventBuffer, EVENT_QUEUE_SIZE )
 {
     m_clientCallbacks = new BTClientCallbacks();
+    m_changes         = {};
+    m_connectStartMs  = 0;
+    m_pointerFlags    = 0;
+    m_pnpId           = {};
+    m_numQuirks       = 0;
+
+    m_gamepadInterest = { ~0u, ~0ull };
+
+    m_reportsLost        = 0;
+    m_maxReportLatencyUs = 0;
+
+    m_snapshot = {};
+
+    m_reportTask     = nullptr;
+    m_pendingSinceUs = 0;
+    m_outputsPending = false;
+    memset( m_latencyHistogram, 0, sizeof(m_latencyHistogram) );
 }
 
 
@@ -115,22 +151,236 @@ BTHIDConn::~BTHIDConn()
 
 // ------------------------------------------------------------------------------------------------------------------------
 // Notification handler callback
+// Runs on the NimBLE host task, so it only queues the report. Everything the parser writes is then only touched by
+// the loop task (in processReports and the accessors), so nothing has to be locked
 // ------------------------------------------------------------------------------------------------------------------------
 
 void BTHIDConn::notifyCB(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, uint8_t reportId, bool isNotify)
 {        
-    int res = m_parser.Parse(pData, length, reportId);
+    if ( m_reports.Push( micros(), reportId, pData, length ) && m_reportTask!=nullptr )
+    {
+        xTaskNotifyGive( m_reportTask );
+    }
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// processReports
+// Parses the queued reports, oldest first. Called by the loop before it reads the state
+// ------------------------------------------------------------------------------------------------------------------------
+
+int BTHIDConn::processReports()
+{
+    int count = 0;
+
+    while ( const HIDReportQueue::Report* report = m_reports.Peek() )
+    {
+        uint32_t latencyUs = micros() - report->timeUs;
+        if ( latencyUs>m_maxReportLatencyUs )
+        {
+            m_maxReportLatencyUs = latencyUs;
+        }
+
+        bool changed = parseReport( report->data, report->length, report->reportId );
+        m_reports.Release();
+
+        // A report that changes nothing (e.g. a repeated gamepad report) has no outputs to wait for
+        if ( changed && !m_outputsPending )
+        {
+            m_pendingSinceUs = report->timeUs;
+            m_outputsPending = true;
+        }
+        count++;
+    }
+
+    if ( count>0 )
+    {
+        publishSnapshot();
+    }
+
+    // Logged on the 1st, 2nd, 4th, 8th... lost report, like short reports below
+    uint32_t lost = m_reports.Dropped() + m_reports.TooLong();
+    if ( lost!=m_reportsLost )
+    {
+        m_reportsLost = lost;
+        if ( (lost & (lost-1))==0 )
+        {
+            Serial.printf( "Reports lost: %u (queue full: %u, too long: %u), max queue depth %u of %u\n", (unsigned)lost, (unsigned)m_reports.Dropped(), (unsigned)m_reports.TooLong(), (unsigned)m_reports.MaxDepth(), (unsigned)m_reports.Capacity() );
+        }
+    }
+
+#ifdef REPORT_QUEUE_STATS
+    static uint32_t s_nextStatsMs = 0;
+    if ( (int32_t)(millis() - s_nextStatsMs)>=0 )
+    {
+        s_nextStatsMs = millis() + 5000;
+        Serial.printf( "Reports: %u received, %u lost, max queue depth %u of %u, max latency %u us\n", (unsigned)m_reports.Received(), (unsigned)m_reportsLost, (unsigned)m_reports.MaxDepth(), (unsigned)m_reports.Capacity(), (unsigned)m_maxReportLatencyUs );
+        m_maxReportLatencyUs = 0;
+    }
+#endif
+
+    return count;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Report to output latency
+// ------------------------------------------------------------------------------------------------------------------------
+
+void BTHIDConn::outputsUpdated()
+{
+    if ( m_outputsPending )
+    {
+        m_outputsPending = false;
+        recordLatency( micros() - m_pendingSinceUs );
+    }
+}
+
+void BTHIDConn::recordLatency( uint32_t latencyUs )
+{
+    int bucket = 0;
+    for ( uint32_t t = latencyUs>>6; t!=0 && bucket<LATENCY_BUCKETS-1; t>>=1 )
+    {
+        bucket++;
+    }
+    m_latencyHistogram[bucket]++;
+}
+
+void BTHIDConn::printLatencyHistogram()
+{
+    Serial.println("Report to output latency:");
+    for ( int i=0; i<LATENCY_BUCKETS; i++ )
+    {
+        if ( i<LATENCY_BUCKETS-1 )
+        {
+            Serial.printf("  <%5u us: %u\n", 64u<<i, (unsigned)m_latencyHistogram[i] );
+        }
+        else
+        {
+            Serial.printf("  longer:   %u\n", (unsigned)m_latencyHistogram[i] );
+        }
+    }
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Input snapshot
+// ------------------------------------------------------------------------------------------------------------------------
+
+void BTHIDConn::publishSnapshot()
+{
+    // Centred with nothing pressed until the first report (and after a disconnect)
+    InputSnapshot snapshot = {};
+
+    // The axes are scaled here, once per batch, and the gamepad accessors read them back
+    if ( m_stateValid )
+    {
+        int hat = m_axisScalerHat.HatDirection( m_gamepadAxes[hid::GamepadConfig::HAT_SWITCH] );
+
+        snapshot.leftX    = m_axisScalerX0.ScaleValue( m_gamepadAxes[hid::GamepadConfig::X] );
+        snapshot.leftY    = m_axisScalerY0.ScaleValue( m_gamepadAxes[hid::GamepadConfig::Y] );
+        snapshot.rightX   = m_axisScalerX1.ScaleValue( m_gamepadAxes[hid::GamepadConfig::Z] );
+        snapshot.rightY   = m_axisScalerY1.ScaleValue( m_gamepadAxes[hid::GamepadConfig::RZ] );
+        snapshot.hatDir   = hat;
+        snapshot.digitalX = hatSwitchXAxis[hat];
+        snapshot.digitalY = hatSwitchYAxis[hat];
+
+        for ( int i=0; i<hid::GamepadConfig::NUM_BUTTONS; i++ )
+        {
+            snapshot.buttons |= (uint32_t)m_gamepadButtons[i] << i;
+        }
+
+        for ( int i=0; i<hid::MouseConfig::NUM_BUTTONS; i++ )
+        {
+            snapshot.mouseButtons |= (uint8_t)( getMouseButton( i ) << i );
+        }
+    }
+
+    snapshot.sequence = m_snapshot.sequence + 1;
+    m_snapshot = snapshot;
+}
+
+InputSnapshot BTHIDConn::getInputSnapshot()
+{
+    return m_snapshot;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// parseReport
+// Returns true if the report changed any of the values the sketch reads, including the accumulated mouse deltas
+// ------------------------------------------------------------------------------------------------------------------------
+
+bool BTHIDConn::parseReport( const uint8_t* pData, size_t length, uint8_t reportId )
+{
+#ifdef PARSER_TIMING
+    uint32_t parseStart = esp_cpu_get_cycle_count();
+#endif
+    hid::SelectiveInputReportParser::ChangeMask changed;
+    int res = m_parser.Parse(pData, length, reportId, &changed);
+#ifdef PARSER_TIMING
+    static uint32_t s_parseCycles = 0;
+    static uint32_t s_parseCount = 0;
+    s_parseCycles += esp_cpu_get_cycle_count() - parseStart;
+    if ( ++s_parseCount == 256 )
+    {
+        Serial.printf( "Parse: %u cycles/report (avg of 256)\n", (unsigned)(s_parseCycles / 256) );
+        s_parseCycles = 0;
+        s_parseCount = 0;
+    }
+#endif
+
+    // The accessors return centred/zero values until the first report, so treat everything as changed then
+    if ( !m_stateValid )
+    {
+        changed.int32s = ~0u;
+        changed.bools  = ~0ull;
+
+        if ( res==0 )
+        {
+            uint32_t now = millis();
+            Serial.printf( "First report at %u ms after boot (%u ms after connect started)\n", (unsigned)now, (unsigned)(now - m_connectStartMs) );
+        }
+    }
 
     m_stateValid = true;
 
-    if ( isMouse() )
+    // Too short for the mapped fields of its report ID. Logged on the 1st, 2nd, 4th, 8th... one so a device that
+    // keeps losing reports shows up without flooding the log
+    if ( res==hid::ERR_INVALID_REPORT_SIZE )
+    {
+        uint32_t count = m_parser.ShortReports( reportId );
+        if ( (count & (count-1))==0 )
+        {
+            Serial.printf( "Report ID %d too short: %u bytes, needs %u (%u rejected)\n", reportId, (unsigned)length, (unsigned)m_parser.MinReportSize( reportId ), (unsigned)count );
+        }
+    }
+
+    m_changes.Merge( changed );
+
+    // Only accumulate deltas from a report that was actually parsed. A rejected report (unknown
+    // report ID, wrong size) leaves the previous deltas in m_mouseAxes. (Reports with relative
+    // fields are never skipped as ERR_REPORT_UNCHANGED, so identical mouse reports still move)
+    bool moved = false;
+    if ( res==0 && isMouse() )
     {
         m_mouseDeltaX += m_mouseAxes[hid::MouseConfig::X];
         m_mouseDeltaY += m_mouseAxes[hid::MouseConfig::Y];
+        moved = ( m_mouseAxes[hid::MouseConfig::X]!=0 || m_mouseAxes[hid::MouseConfig::Y]!=0 );
+    }
+    else if ( res==0 && isDigitizer() )
+    {
+        // Identical reports are skipped as ERR_REPORT_UNCHANGED, which is right for absolute positions
+        bool contact = m_digitizerButtons[ (m_pointerFlags & POINTER_HOVERS) ? hid::DigitizerConfig::IN_RANGE : hid::DigitizerConfig::TIP_SWITCH ];
+        int  deltaX, deltaY;
+        m_pointerTracker.Update( contact, m_digitizerAxes[hid::DigitizerConfig::CONTACT_ID], m_digitizerAxes[hid::DigitizerConfig::X], m_digitizerAxes[hid::DigitizerConfig::Y], deltaX, deltaY );
+        m_mouseDeltaX += deltaX;
+        m_mouseDeltaY += deltaY;
+        moved = ( deltaX!=0 || deltaY!=0 );
     }
       
 #ifdef FULL_LOGGING      
-    Serial.printf( "HID reportId %d, parseResult %d, Data: ", reportId,res );
+    Serial.printf( "HID reportId %d, parseResult %d (unknown IDs: %u, unchanged: %u), Data: ", reportId, res, (unsigned)m_parser.UnknownReportIDs(), (unsigned)m_parser.UnchangedReports() );
     for (size_t i = 0; i < length; i++) 
     {
         Serial.print(pData[i], HEX);
@@ -138,6 +388,8 @@ void BTHIDConn::notifyCB(NimBLERemoteCharacteristic* pRemoteCharacteristic, uint
     }
     Serial.println();     
 #endif    
+
+    return changed.Any() || moved;
 }
 
 
@@ -165,6 +417,9 @@ void BTHIDConn::deleteAllBonds()
     
     NimBLEDevice::deleteAllBonds();
 
+    // Forget the cached parser mappings too, they're only useful for bonded devices
+    clearMappingCache();
+
     int numBonds = NimBLEDevice::getNumBonds();
 
     if (numBonds>0)
@@ -207,7 +462,8 @@ bool BTHIDConn::connect( const NimBLEAdvertisedDevice* device )
     int  numBonds = NimBLEDevice::getNumBonds();
     bool isBonded = false;
 
-    m_stateValid = false;
+    m_stateValid     = false;
+    m_connectStartMs = millis();
 
     // Show bond info
     if ( numBonds>0 )
@@ -305,6 +561,9 @@ bool BTHIDConn::connect( const NimBLEAdvertisedDevice* device )
 
     Serial.printf("Connected to: %s RSSI: %d\n", pClient->getPeerAddress().toString().c_str(), pClient->getRssi());
 
+    // Before the report map, the quirks affect how it's parsed (and the cached mapping's axis scalers)
+    readPnPId( pClient );
+
     // Now we can read/write/subscribe the charateristics of the services we are interested in
     NimBLERemoteService*        pSvc = nullptr;
     NimBLERemoteCharacteristic* pChr = nullptr;
@@ -326,7 +585,14 @@ bool BTHIDConn::connect( const NimBLEAdvertisedDevice* device )
         {
             if(pChr->canRead()) 
             {
-                std::string value = pChr->readValue();
+                // Any previous mapping goes first, the streamed descriptor events are recorded in the parser arena
+                resetParser();
+
+                std::string value;
+                if ( !readReportMap( pClient, pChr, value ) )
+                {
+                    value = pChr->readValue();
+                }
 
                 if ( value.empty() )
                 {
@@ -335,6 +601,9 @@ bool BTHIDConn::connect( const NimBLEAdvertisedDevice* device )
                     return false;
                 }
 
+                // Patched before anything else looks at it, so the cached mapping is keyed by the patched descriptor
+                bool     descriptorPatched = applyDescriptorPatches( value );
+
                 uint8_t *descriptorData   = (uint8_t *)value.data();
                 int      descriptorLength = value.length();
 
@@ -351,45 +620,150 @@ bool BTHIDConn::connect( const NimBLEAdvertisedDevice* device )
                 Serial.println();                
 #endif
 
-                m_deviceTypes =  hid::detect_common_input_device_type( descriptorData, descriptorLength );
-                bool parserOk = false;
+                uint32_t parserStartUs = micros();
+                bool     parserOk      = false;
+                bool     fromCache     = loadCachedMapping( pClient->getPeerAddress(), descriptorData, descriptorLength );
 
-                
+                if ( fromCache )
+                {
+                    parserOk = true;
+                }
+                else
+                {
+                    // Normally the descriptor has already been fed chunk by chunk during the read. Not if the
+                    // read fell back to readValue(), a stale cached mapping made us drop the recorded events,
+                    // or a quirk patched it after the read
+                    if ( descriptorPatched || m_descriptorStream.DescriptorSize()!=(size_t)descriptorLength )
+                    {
+                        m_descriptorStream.Begin( descriptorLength );
+                        m_descriptorStream.Feed( descriptorData, descriptorLength );
+                    }
 
-                if (m_deviceTypes & hid::FLAG_GAMEPAD)
-                {                                 
-                    hid::GamepadConfig cfg;
-                    auto buttons_ref = m_gamepadButtons.Ref();
-                    auto axes_ref = m_gamepadAxes.Ref();  
-                    auto cfg_root = cfg.Init( &buttons_ref, &axes_ref, true );
-                    int res = m_parser.Init(cfg_root, descriptorData, descriptorLength );
+                    // Detect the device type and map both configs it may need in a single descriptor pass. The
+                    // mouse mapping goes into a temporary parser as a gamepad takes priority if a device is one
+                    // or the other. A device with both collections gets them mapped together into m_parser. Digitizers
+                    // (as a mouse) and then keyboards (as a joystick) are only mapped if there's neither
+                    auto gamepadButtonsRef = m_gamepadButtons.Ref();
+                    auto gamepadAxesRef    = m_gamepadAxes.Ref();
+                    auto mouseButtonsRef   = m_mouseButtons.Ref();
+                    auto mouseAxesRef      = m_mouseAxes.Ref();
+                    auto keyboardKeysRef   = m_keyboardKeys.Ref();
+                    auto digitizerButtonsRef = m_digitizerButtons.Ref();
+                    auto digitizerAxesRef    = m_digitizerAxes.Ref();
+                    hid::SelectiveInputReportParser mouseParser;
+
+                    applyAxisRemaps();
+
+                    hid::SelectiveInputReportParser::InitRequest requests[2];
+                    size_t numRequests;
+
+                    uint8_t streamTypes = m_descriptorStream.DeviceTypes();
+                    if ( (streamTypes & hid::FLAG_GAMEPAD) && (streamTypes & hid::FLAG_MOUSE) )
+                    {
+                        requests[0]  = { &m_parser, m_gamepadMouseCfg.Init( &m_gamepadCfg, &gamepadButtonsRef, &gamepadAxesRef, &m_mouseCfg, &mouseButtonsRef, &mouseAxesRef ), hid::FLAG_GAMEPAD, 0 };
+                        numRequests  = 1;
+                    }
+                    else if ( (streamTypes & hid::FLAG_DIGITIZER) && !(streamTypes & (hid::FLAG_GAMEPAD | hid::FLAG_MOUSE)) )
+                    {
+                        requests[0]  = { &m_parser, m_digitizerCfg.Init( &digitizerButtonsRef, &digitizerAxesRef ), hid::FLAG_DIGITIZER, 0 };
+                        numRequests  = 1;
+                    }
+                    else if ( (streamTypes & hid::FLAG_KEYBOARD) && !(streamTypes & (hid::FLAG_GAMEPAD | hid::FLAG_MOUSE)) )
+                    {
+                        requests[0]  = { &m_parser, m_keyboardCfg.Init( &keyboardKeysRef ), hid::FLAG_KEYBOARD, 0 };
+                        numRequests  = 1;
+                    }
+                    else
+                    {
+                        requests[0]  = { &m_parser,    m_gamepadCfg.Init( &gamepadButtonsRef, &gamepadAxesRef, true ), hid::FLAG_GAMEPAD, 0 };
+                        requests[1]  = { &mouseParser, m_mouseCfg.Init( &mouseButtonsRef, &mouseAxesRef, true ),       hid::FLAG_MOUSE,   0 };
+                        numRequests  = 2;
+                    }
 
-                    // Init axis scalers
-                    m_axisScalerX0.Init(  &cfg.axes.properties[hid::GamepadConfig::X],  -256, 256, false );
-                    m_axisScalerY0.Init(  &cfg.axes.properties[hid::GamepadConfig::Y],  -256, 256, false );
-                    m_axisScalerX1.Init(  &cfg.axes.properties[hid::GamepadConfig::Z],  -256, 256, false );
-                    m_axisScalerY1.Init(  &cfg.axes.properties[hid::GamepadConfig::RZ], -256, 256, false );
-                    m_axisScalerHat.Init( &cfg.axes.properties[hid::GamepadConfig::HAT_SWITCH], 1, 8, true );
+                    m_descriptorStream.Finish( requests, numRequests, &m_deviceTypes );
 
-                    Serial.printf("Device is Gamepad (reportId Mappings: %d)\n", m_parser.NumMappings());
-                    parserOk = (res==0);                    
-                }
-                else if (m_deviceTypes & hid::FLAG_MOUSE)
-                {                    
-                    hid::MouseConfig cfg;
-                    auto buttons_ref = m_mouseButtons.Ref();
-                    auto axes_ref = m_mouseAxes.Ref();  
-                    auto cfg_root = cfg.Init( &buttons_ref, &axes_ref, true );
-                    int res = m_parser.Init(cfg_root, descriptorData, descriptorLength );
-                    Serial.printf("Device is mouse (reportId Mappings: %d)\n", m_parser.NumMappings());
-                    parserOk = (res==0);                    
+                    if ( m_parserArena.Exhausted() )
+                    {
+                        Serial.printf("Parser arena too small (%u bytes)\n", (unsigned)m_parserArena.Size() );
+                    }
+
+                    // Before the mapping is cached. The mouse parser is only used if there's no gamepad
+                    bool mouseOnly = (m_deviceTypes & hid::FLAG_MOUSE) && !(m_deviceTypes & hid::FLAG_GAMEPAD);
+                    applyReportLengths( mouseOnly ? mouseParser : m_parser );
+
+                    if (m_deviceTypes & hid::FLAG_GAMEPAD)
+                    {                                 
+                        parserOk = (requests[0].result==0);
+
+                        if ( parserOk )
+                        {
+                            initGamepadScalers( m_gamepadCfg.axes.properties.data() );
+                            saveCachedMapping( pClient->getPeerAddress(), descriptorData, descriptorLength, m_gamepadCfg.axes.properties.data() );
+                        }
+                    }
+                    else if (m_deviceTypes & hid::FLAG_MOUSE)
+                    {                    
+                        m_parser = std::move( mouseParser );
+                        parserOk = (requests[1].result==0);
+
+                        if ( parserOk )
+                        {
+                            saveCachedMapping( pClient->getPeerAddress(), descriptorData, descriptorLength, nullptr );
+                        }
+                    }
+                    else if ( isDigitizer() )
+                    {
+                        parserOk = (requests[0].result==0);
+
+                        if ( parserOk )
+                        {
+                            const std::vector<bool>& mapped = m_digitizerCfg.buttons.mapped;
+                            uint8_t pointerFlags = 0;
+                            if ( mapped[hid::DigitizerConfig::IN_RANGE] )     pointerFlags |= POINTER_HOVERS;
+                            if ( !mapped[hid::DigitizerConfig::BTN_PRIMARY] ) pointerFlags |= POINTER_TIP_CLICKS;
+
+                            initPointerTracker( m_digitizerCfg.axes.properties.data(), pointerFlags );
+                            saveCachedMapping( pClient->getPeerAddress(), descriptorData, descriptorLength, m_digitizerCfg.axes.properties.data() );
+                        }
+                    }
+                    else if ( isKeyboard() )
+                    {
+                        parserOk = (requests[0].result==0);
+
+                        if ( parserOk )
+                        {
+                            saveCachedMapping( pClient->getPeerAddress(), descriptorData, descriptorLength, nullptr );
+                        }
+                    }
+                    else
+                    {
+                        Serial.printf("Unexpected device type. Can't init parser. Disconnecting");
+                        pClient->disconnect();
+                        return false;                    
+                    }                
                 }
-                else
-                {
-                    Serial.printf("Unexpected device type. Can't init parser. Disconnecting");
-                    pClient->disconnect();
-                    return false;                    
-                }                
+
+                Serial.printf("Parser mapping %s in %u us\n", fromCache ? "loaded from NVS" : "built from descriptor", (unsigned)(micros() - parserStartUs) );
+                Serial.printf("Device is %s (reportId Mappings: %d)\n", isComposite() ? "Gamepad+mouse" : isGamepad() ? "Gamepad" : isMouse() ? "mouse" : isDigitizer() ? "digitizer" : "keyboard", m_parser.NumMappings());
+                Serial.printf("Parser arena: %u bytes in use, high water mark %u of %u\n", (unsigned)m_parserArena.Used(), (unsigned)m_parserArena.HighWaterMark(), (unsigned)m_parserArena.Size() );
+
+                // The interest outlives the mapping, and the parser may have been used for a mouse last time
+                m_parser.SetInterest( isGamepad() ? m_gamepadInterest : hid::SelectiveInputReportParser::ChangeMask{ ~0u, ~0ull } );
+
+                // m_parser may have been replaced by the mouse parser above. Events and reports left from the last
+                // connection are dropped. No reports arrive before we subscribe, so the queue can be cleared here.
+                // Only the gamepad and mouse updates drain the events (modeCycleCheck), so a keyboard gets no queue
+                // rather than one that fills up and counts drops
+                m_events.Clear();
+                m_parser.SetEventQueue( ( isGamepad() || isMouse() || isDigitizer() ) ? &m_events : nullptr );
+                m_reports.Clear();
+                m_reportsLost        = 0;
+                m_maxReportLatencyUs = 0;
+                m_outputsPending     = false;
+                memset( m_latencyHistogram, 0, sizeof(m_latencyHistogram) );
+
+                // Centred until the first report
+                publishSnapshot();
 
                 if (!parserOk)            
                 {
@@ -466,13 +840,469 @@ bool BTHIDConn::connect( const NimBLEAdvertisedDevice* device )
 }
 
 
+// ------------------------------------------------------------------------------------------------------------------------
+// readReportMap
+// Reads the HID report map with a GATT long read and feeds each chunk to m_descriptorStream as it arrives, so device
+// type detection and most of the descriptor parsing overlap the ATT round trips. Returns false if the read failed,
+// in which case the caller falls back to readValue()
+// ------------------------------------------------------------------------------------------------------------------------
+
+struct ReportMapRead
+{
+    std::string*             value;
+    hid::InitMultipleStream* stream;
+    SemaphoreHandle_t        done;
+    int                      status;
+};
+
+// Called on the NimBLE host task for each chunk, then once more with the final status
+static int onReportMapChunk( uint16_t connHandle, const ble_gatt_error* error, ble_gatt_attr* attr, void* arg )
+{
+    ReportMapRead* read = (ReportMapRead*)arg;
+
+    if ( error->status==0 && attr!=nullptr )
+    {
+        uint16_t length = OS_MBUF_PKTLEN( attr->om );
+        size_t   offset = read->value->size();
+
+        read->value->resize( offset + length );
+        os_mbuf_copydata( attr->om, 0, length, &(*read->value)[offset] );
+        read->stream->Feed( read->value->data() + offset, length );
+        return 0;
+    }
+
+    // A value that fits in the first read response ends with 'attribute not long' rather than EDONE
+    bool complete = error->status==BLE_HS_EDONE || ( error->status==BLE_HS_ATT_ERR( BLE_ATT_ERR_ATTR_NOT_LONG ) && !read->value->empty() );
+
+    read->status = complete ? 0 : error->status;
+    xSemaphoreGive( read->done );
+    return 0;
+}
+
+bool BTHIDConn::readReportMap( NimBLEClient* pClient, NimBLERemoteCharacteristic* pChr, std::string& value )
+{
+    StaticSemaphore_t semaphoreBuffer;
+    ReportMapRead     read = { &value, &m_descriptorStream, xSemaphoreCreateBinaryStatic( &semaphoreBuffer ), 0 };
+
+    // The length isn't known until the read is complete. Most report maps are smaller than this
+    value.clear();
+    m_descriptorStream.Begin( 256 );
+
+    int rc = ble_gattc_read_long( pClient->getConnHandle(), pChr->getHandle(), 0, onReportMapChunk, &read );
+    if ( rc==0 )
+    {
+        // The host always finishes with a final callback (done, error, ATT timeout or disconnect)
+        xSemaphoreTake( read.done, portMAX_DELAY );
+        rc = read.status;
+    }
+    vSemaphoreDelete( read.done );
+
+    if ( rc!=0 || value.empty() )
+    {
+        Serial.printf("Streamed HID REPORT MAP read failed (%d)\n", rc );
+        m_descriptorStream.Reset();
+        value.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// resetParser
+// Drops the current mapping and frees the whole parser arena for the next one
+// ------------------------------------------------------------------------------------------------------------------------
+
+void BTHIDConn::resetParser()
+{
+    m_parser.Reset();
+    m_parserArena.Clear();
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Device quirks
+// Looked up once per connection by the PnP ID of the Device Information service, and applied to the descriptor, the
+// mapping config and the compiled mapping. Nothing is left for parseReport to check
+// ------------------------------------------------------------------------------------------------------------------------
+
+void BTHIDConn::readPnPId( NimBLEClient* pClient )
+{
+    const char DEVICE_INFORMATION[] = "180A";
+    const char PNP_ID[]             = "2A50";
+
+    m_pnpId     = {};
+    m_numQuirks = 0;
+
+    NimBLERemoteService* pSvc = pClient->getService(DEVICE_INFORMATION);
+    if ( pSvc==nullptr )
+    {
+        return;
+    }
+
+    NimBLERemoteCharacteristic* pChr = pSvc->getCharacteristic(PNP_ID);
+    if ( pChr==nullptr || !pChr->canRead() )
+    {
+        return;
+    }
+
+    // Vendor ID source, then little endian vendor ID, product ID and product version
+    std::string value = pChr->readValue();
+    if ( value.length()<7 )
+    {
+        return;
+    }
+
+    const uint8_t* data = (const uint8_t*)value.data();
+    m_pnpId.vendorIdSource = data[0];
+    m_pnpId.vendorId       = data[1] | (data[2]<<8);
+    m_pnpId.productId      = data[3] | (data[4]<<8);
+    m_pnpId.productVersion = data[5] | (data[6]<<8);
+
+    m_numQuirks = findDeviceQuirks( m_pnpId, m_quirks, MAX_DEVICE_QUIRKS );
+
+    Serial.printf("PnP ID: source %d, VID %04x, PID %04x, version %04x (%d quirks)\n", m_pnpId.vendorIdSource, m_pnpId.vendorId, m_pnpId.productId, m_pnpId.productVersion, m_numQuirks );
+}
+
+bool BTHIDConn::applyDescriptorPatches( std::string& descriptor )
+{
+    bool patched = false;
+
+    for ( int i=0; i<m_numQuirks; i++ )
+    {
+        const DeviceQuirk* quirk = m_quirks[i];
+        if ( quirk->type!=QUIRK_DESCRIPTOR_PATCH )
+        {
+            continue;
+        }
+
+        // Only if the bytes are what we expect, a firmware update may have fixed the descriptor
+        size_t offset = quirk->value;
+        size_t length = quirk->index;
+        if ( offset + length<=descriptor.length() && memcmp( &descriptor[offset], quirk->data, length )==0 )
+        {
+            memcpy( &descriptor[offset], quirk->data + length, length );
+            patched = true;
+        }
+        else
+        {
+            Serial.printf("Descriptor patch at %u doesn't match, skipped\n", (unsigned)offset );
+        }
+    }
+
+    return patched;
+}
+
+void BTHIDConn::applyAxisRemaps()
+{
+    // Set every time, the config is kept between connections
+    std::vector<hid::UsageRange>& usages = m_gamepadCfg.axes.usages;
+    usages.assign( 1, { hid::PAGE_GENERIC_DESKTOP, hid::USAGE_X, hid::USAGE_HAT_SWITCH } );
+
+    for ( int i=0; i<m_numQuirks; i++ )
+    {
+        const DeviceQuirk* quirk = m_quirks[i];
+        if ( quirk->type!=QUIRK_AXIS_REMAP || quirk->index>=hid::GamepadConfig::NUM_AXES )
+        {
+            continue;
+        }
+
+        // The axis index is the position in the usage list, so it's split into one usage per axis
+        if ( usages.size()==1 )
+        {
+            usages.clear();
+            for ( uint16_t usage=hid::USAGE_X; usage<=hid::USAGE_HAT_SWITCH; usage++ )
+            {
+                usages.push_back( { hid::PAGE_GENERIC_DESKTOP, usage, 0 } );
+            }
+        }
+        usages[quirk->index].usage_min = quirk->value;
+    }
+}
+
+void BTHIDConn::applyReportLengths( hid::SelectiveInputReportParser& parser )
+{
+    for ( int i=0; i<m_numQuirks; i++ )
+    {
+        const DeviceQuirk* quirk = m_quirks[i];
+        if ( quirk->type!=QUIRK_REPORT_LENGTH )
+        {
+            continue;
+        }
+
+        int res = parser.TruncateReport( quirk->index, quirk->value );
+        if ( res!=0 )
+        {
+            Serial.printf("Report %d length quirk failed: %s\n", quirk->index, hid::str_error( res, "?" ) );
+        }
+    }
+}
+
+// The hat switch value that means centred, if a quirk says it's inside the logical range. -1 if there isn't one
+int BTHIDConn::getHatNullValue()
+{
+    for ( int i=0; i<m_numQuirks; i++ )
+    {
+        if ( m_quirks[i]->type==QUIRK_HAT_NULL )
+        {
+            return m_quirks[i]->value;
+        }
+    }
+    return -1;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Mapping cache
+//
+// Parsing the report descriptor and building the parser mapping is by far the slowest part of connect(), and it
+// gives the same result every time for a given device. So the compiled mapping is stored in NVS (one key per peer
+// address) along with a hash of the descriptor it was built from, and loaded back on reconnect if the hash matches
+// ------------------------------------------------------------------------------------------------------------------------
+
+static const char MAPPING_CACHE_NAMESPACE[] = "AmiBLEHIDmap";
+
+// Bump this if anything changes that affects the mapping (GamepadConfig/MouseConfig usages etc.)
+static const uint32_t MAPPING_CACHE_MAGIC   = 0x414d4303;
+
+struct MappingCacheHeader
+{
+    uint32_t magic;
+    uint32_t descriptorHash;
+    uint32_t descriptorLength;
+    uint8_t  deviceTypes;
+    uint8_t  pointerFlags;
+    uint8_t  reserved[2];
+
+    // Gamepad stick/hat properties, for the axis scalers. Digitizers only use the first two (X/Y)
+    hid::Int32Fields::FieldProperties axisProps[5];
+};
+
+// Gamepad buttons/axes plus mouse buttons/axes for composite devices
+static const int MAX_MAPPING_TARGETS = 4;
+
+// The gamepad axes that have scalers, in the order they're stored in MappingCacheHeader::axisProps
+static const int k_scaledAxes[5] = { hid::GamepadConfig::X, hid::GamepadConfig::Y, hid::GamepadConfig::Z, hid::GamepadConfig::RZ, hid::GamepadConfig::HAT_SWITCH };
+
+// NVS keys are limited to 15 chars: 'm' + 12 hex digits of the address
+static void getMappingCacheKey( const NimBLEAddress& address, char* key )
+{
+    const uint8_t* addr = address.getVal();
+    snprintf( key, 16, "m%02x%02x%02x%02x%02x%02x", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0] );
+}
+
+// FNV-1a
+static uint32_t hashDescriptor( const uint8_t* data, size_t length )
+{
+    uint32_t hash = 2166136261u;
+    for ( size_t i=0; i<length; i++ )
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Fills in up to MAX_MAPPING_TARGETS targets
+int BTHIDConn::getMappingTargets( hid::SelectiveInputReportParser::BlobTarget* targets )
+{
+    if ( isComposite() )
+    {
+        targets[0] = { m_gamepadButtons.bytes, sizeof(m_gamepadButtons.bytes) };
+        targets[1] = { m_gamepadAxes.items,    sizeof(m_gamepadAxes.items)    };
+        targets[2] = { m_mouseButtons.bytes,   sizeof(m_mouseButtons.bytes)   };
+        targets[3] = { m_mouseAxes.items,      sizeof(m_mouseAxes.items)      };
+        return 4;
+    }
+    else if ( isGamepad() )
+    {
+        targets[0] = { m_gamepadButtons.bytes, sizeof(m_gamepadButtons.bytes) };
+        targets[1] = { m_gamepadAxes.items,    sizeof(m_gamepadAxes.items)    };
+    }
+    else if ( isMouse() )
+    {
+        targets[0] = { m_mouseButtons.bytes, sizeof(m_mouseButtons.bytes) };
+        targets[1] = { m_mouseAxes.items,    sizeof(m_mouseAxes.items)    };
+    }
+    else if ( isDigitizer() )
+    {
+        targets[0] = { m_digitizerButtons.bytes, sizeof(m_digitizerButtons.bytes) };
+        targets[1] = { m_digitizerAxes.items,    sizeof(m_digitizerAxes.items)    };
+    }
+    else
+    {
+        targets[0] = { m_keyboardKeys.bytes, sizeof(m_keyboardKeys.bytes) };
+        return 1;
+    }
+    return 2;
+}
+
+void BTHIDConn::initGamepadScalers( hid::Int32Fields::FieldProperties* axisProps )
+{
+    m_axisScalerX0.Init(  &axisProps[hid::GamepadConfig::X],  -256, 256 );
+    m_axisScalerY0.Init(  &axisProps[hid::GamepadConfig::Y],  -256, 256 );
+    m_axisScalerX1.Init(  &axisProps[hid::GamepadConfig::Z],  -256, 256 );
+    m_axisScalerY1.Init(  &axisProps[hid::GamepadConfig::RZ], -256, 256 );
+
+    // Dropping the centred value from the range leaves the 4 or 8 directions, and the scaler decodes it as centred
+    hid::Int32Fields::FieldProperties hatProps = axisProps[hid::GamepadConfig::HAT_SWITCH];
+    int                               hatNull  = getHatNullValue();
+    if ( hatNull==hatProps.logical_max )
+    {
+        hatProps.logical_max--;
+    }
+    else if ( hatNull==hatProps.logical_min )
+    {
+        hatProps.logical_min++;
+    }
+    m_axisScalerHat.InitHatSwitch( &hatProps );
+}
+
+void BTHIDConn::initPointerTracker( hid::Int32Fields::FieldProperties* axisProps, uint8_t pointerFlags )
+{
+    m_pointerTracker.Init( &axisProps[hid::DigitizerConfig::X], &axisProps[hid::DigitizerConfig::Y], DIGITIZER_MOUSE_COUNTS );
+    m_pointerFlags = pointerFlags;
+}
+
+bool BTHIDConn::loadCachedMapping( const NimBLEAddress& address, const uint8_t* descriptorData, size_t descriptorLength )
+{
+    char key[16];
+    getMappingCacheKey( address, key );
+
+    Preferences prefs;
+    if ( !prefs.begin( MAPPING_CACHE_NAMESPACE, true ) )
+    {
+        // Namespace doesn't exist until the first save
+        return false;
+    }
+
+    size_t size = prefs.getBytesLength( key );
+    std::vector<uint8_t> data( size );
+
+    bool ok = size>sizeof(MappingCacheHeader) && prefs.getBytes( key, data.data(), size )==size;
+    prefs.end();
+
+    if ( !ok )
+    {
+        return false;
+    }
+
+    MappingCacheHeader header;
+    memcpy( &header, data.data(), sizeof(header) );
+
+    if ( header.magic!=MAPPING_CACHE_MAGIC || header.descriptorLength!=descriptorLength || header.descriptorHash!=hashDescriptor( descriptorData, descriptorLength ) )
+    {
+        Serial.println("Cached parser mapping is stale (descriptor changed)");
+        return false;
+    }
+
+    m_deviceTypes = header.deviceTypes;
+
+    hid::SelectiveInputReportParser::BlobTarget targets[MAX_MAPPING_TARGETS];
+    int numTargets = getMappingTargets( targets );
+
+    // The events recorded while reading the descriptor live in the arena too
+    m_descriptorStream.Reset();
+    resetParser();
+    int res = m_parser.LoadBlob( data.data() + sizeof(header), size - sizeof(header), targets, numTargets, &m_parserArena );
+    if ( res!=0 )
+    {
+        Serial.printf("Cached parser mapping rejected: %s\n", hid::str_error( res, "?" ) );
+        return false;
+    }
+
+    // Parser::Init zeroes the targets, LoadBlob doesn't
+    for ( int i=0; i<numTargets; i++ )
+    {
+        memset( targets[i].data, 0, targets[i].size );
+    }
+
+    if ( isGamepad() )
+    {
+        hid::Int32Fields::FieldProperties axisProps[hid::GamepadConfig::NUM_AXES] = {};
+        for ( int i=0; i<5; i++ )
+        {
+            axisProps[k_scaledAxes[i]] = header.axisProps[i];
+        }
+        initGamepadScalers( axisProps );
+    }
+    else if ( isDigitizer() )
+    {
+        initPointerTracker( header.axisProps, header.pointerFlags );
+    }
+
+    return true;
+}
+
+void BTHIDConn::saveCachedMapping( const NimBLEAddress& address, const uint8_t* descriptorData, size_t descriptorLength, const hid::Int32Fields::FieldProperties* axisProps )
+{
+    hid::SelectiveInputReportParser::BlobTarget targets[MAX_MAPPING_TARGETS];
+    int numTargets = getMappingTargets( targets );
+
+    int blobSize = m_parser.SaveBlob( nullptr, 0, targets, numTargets );
+    if ( blobSize<0 )
+    {
+        return;
+    }
+
+    std::vector<uint8_t> data( sizeof(MappingCacheHeader) + blobSize );
+
+    MappingCacheHeader header = {};
+    header.magic            = MAPPING_CACHE_MAGIC;
+    header.descriptorHash   = hashDescriptor( descriptorData, descriptorLength );
+    header.descriptorLength = descriptorLength;
+    header.deviceTypes      = m_deviceTypes;
+
+    if ( axisProps && isDigitizer() )
+    {
+        header.pointerFlags = m_pointerFlags;
+        header.axisProps[0] = axisProps[hid::DigitizerConfig::X];
+        header.axisProps[1] = axisProps[hid::DigitizerConfig::Y];
+    }
+    else if ( axisProps )
+    {
+        for ( int i=0; i<5; i++ )
+        {
+            header.axisProps[i] = axisProps[k_scaledAxes[i]];
+        }
+    }
+
+    memcpy( data.data(), &header, sizeof(header) );
+
+    if ( m_parser.SaveBlob( data.data() + sizeof(header), blobSize, targets, numTargets )!=blobSize )
+    {
+        return;
+    }
+
+    char key[16];
+    getMappingCacheKey( address, key );
+
+    Preferences prefs;
+    prefs.begin( MAPPING_CACHE_NAMESPACE, false );
+    size_t written = prefs.putBytes( key, data.data(), data.size() );
+    prefs.end();
+
+    Serial.printf("Saved parser mapping to NVS (%u bytes)%s\n", (unsigned)data.size(), written==data.size() ? "" : " - FAILED" );
+}
+
+void BTHIDConn::clearMappingCache()
+{
+    Preferences prefs;
+    prefs.begin( MAPPING_CACHE_NAMESPACE, false );
+    prefs.clear();
+    prefs.end();
+}
+
+
 // ------------------------------------------------------------------------------------------------------------------------
 // disconnect
 // ------------------------------------------------------------------------------------------------------------------------
 
 void BTHIDConn::disconnect()
 {
+    // Centred until the next connection's first report
     m_stateValid = false;
+    publishSnapshot();
     
     for (auto &it:NimBLEDevice::getConnectedClients()) 
     {   
@@ -486,51 +1316,40 @@ void BTHIDConn::disconnect()
 // Accessors
 // --------------------------------------------------------------------------------------------------------------------
 
-const int hatSwitchXAxis[9] = { 0, 0, 1, 1, 1, 0,-1,-1,-1};
-const int hatSwitchYAxis[9] = { 0,-1,-1, 0, 1, 1, 1, 0,-1};
-
+// The gamepad axes are read from the last published snapshot
 int BTHIDConn::getGamepadDigitalXAxis()
 {
-    int hat = getGamepadHatSwitchDir();
-    if ( hat<0 || hat>8 ) hat = 0;
-    return hatSwitchXAxis[hat];
+    return m_snapshot.digitalX;
 }
 
 int BTHIDConn::getGamepadDigitalYAxis()
 {
-    int hat = getGamepadHatSwitchDir();
-    if ( hat<0 || hat>8 ) hat = 0;
-    return hatSwitchYAxis[hat];
+    return m_snapshot.digitalY;
 }
 
 int BTHIDConn::getGamepadHatSwitchDir()
 {
-    if (!m_stateValid) return 0;
-    return m_axisScalerHat.ScaleValue( m_gamepadAxes[hid::GamepadConfig::HAT_SWITCH] ); 
+    return m_snapshot.hatDir;
 }
 
 int BTHIDConn::getGamepadLeftStickXAxis()
 {
-    if (!m_stateValid) return 0;
-    return m_axisScalerX0.ScaleValue( m_gamepadAxes[hid::GamepadConfig::X] ); 
+    return m_snapshot.leftX;
 }
 
 int BTHIDConn::getGamepadLeftStickYAxis()
 {
-    if (!m_stateValid) return 0;
-    return m_axisScalerY0.ScaleValue( m_gamepadAxes[hid::GamepadConfig::Y] ); 
+    return m_snapshot.leftY;
 }
 
 int BTHIDConn::getGamepadRightStickXAxis()
 {    
-    if (!m_stateValid) return 0;
-    return m_axisScalerX1.ScaleValue( m_gamepadAxes[hid::GamepadConfig::Z] ); 
+    return m_snapshot.rightX;
 }
 
 int BTHIDConn::getGamepadRightStickYAxis()
 {    
-    if (!m_stateValid) return 0;
-    return m_axisScalerY1.ScaleValue( m_gamepadAxes[hid::GamepadConfig::RZ] ); 
+    return m_snapshot.rightY;
 }
 
 bool BTHIDConn::getGamePadButton( int idx )
@@ -555,9 +1374,52 @@ void BTHIDConn::resetMouseDeltas()
 
 bool BTHIDConn::getMouseButton( int idx )
 {
+    if ( isDigitizer() )
+    {
+        // Digitizer buttons share the mouse button indexes. The tip clicks on devices that have no buttons (pens),
+        // the barrel switch is the right button
+        bool pressed = m_digitizerButtons[idx];
+        if ( idx==hid::MouseConfig::BTN_LEFT && (m_pointerFlags & POINTER_TIP_CLICKS) )
+        {
+            pressed |= m_digitizerButtons[hid::DigitizerConfig::TIP_SWITCH];
+        }
+        else if ( idx==hid::MouseConfig::BTN_RIGHT )
+        {
+            pressed |= m_digitizerButtons[hid::DigitizerConfig::BARREL_SWITCH];
+        }
+        return pressed;
+    }
+
     return m_mouseButtons[idx];
 }
 
+hid::SelectiveInputReportParser::ChangeMask BTHIDConn::takeChanges()
+{
+    hid::SelectiveInputReportParser::ChangeMask changes = m_changes;
+    m_changes = {};
+    return changes;
+}
+
+bool BTHIDConn::popInputEvent( hid::InputEventQueue::Event& event )
+{
+    return m_events.Pop( event );
+}
+
+void BTHIDConn::setGamepadInterest( const hid::SelectiveInputReportParser::ChangeMask& interest )
+{
+    // SetInterest costs a pass over the compiled fields, so only when the set changes
+    if ( interest.int32s==m_gamepadInterest.int32s && interest.bools==m_gamepadInterest.bools )
+    {
+        return;
+    }
+
+    m_gamepadInterest = interest;
+    if ( isGamepad() )
+    {
+        m_parser.SetInterest( interest );
+    }
+}
+
 
     
 
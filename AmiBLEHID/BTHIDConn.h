@@ -5,11 +5,33 @@
 
 #include <NimBLEDevice.h>
 #include "HIDAxisScaler.h"
+#include "HIDPointerTracker.h"
+#include "HIDReportQueue.h"
+#include "DeviceQuirks.h"
 #include "hid_report_parser.h"
 
 
 class BTClientCallbacks;
 
+// The normalized gamepad state after a batch of reports. Consumers take one copy per update rather than calling the
+// accessors one by one, so all the outputs they compute come from the same reports
+struct InputSnapshot
+{
+    uint32_t sequence;        // Incremented by every publish
+    int16_t  leftX;           // Sticks: -256 to 256
+    int16_t  leftY;
+    int16_t  rightX;
+    int16_t  rightY;
+    int8_t   hatDir;          // 0 = centred, 1-8 = up, clockwise
+    int8_t   digitalX;        // Hat as -1/0/1
+    int8_t   digitalY;
+    uint8_t  mouseButtons;    // Composite devices: mouse buttons 0-2 as bits
+    uint32_t buttons;         // Gamepad buttons 0-31 as bits
+
+    bool button( int idx ) const { return (buttons>>idx) & 1; }
+    bool mouseButton( int idx ) const { return (mouseButtons>>idx) & 1; }
+};
+
 class BTHIDConn
 {
 
@@ -18,11 +40,32 @@ private:
     BTClientCallbacks* m_clientCallbacks;
 
     uint8_t                                         m_deviceTypes;
+
+    // All parser mapping memory comes from this fixed block rather than the heap, so reconnects don't fragment it.
+    // Declared before m_parser, which must be destroyed (or Reset) before the arena
+    static const size_t PARSER_ARENA_SIZE = 8192;
+    alignas(8) uint8_t                              m_parserArenaBuffer[PARSER_ARENA_SIZE];
+    hid::Arena                                      m_parserArena;
+
+    // Detects the device type and records the parser events while the report map is still being read.
+    // Uses m_parserArena, so it has to be Reset before the arena is cleared
+    hid::InitMultipleStream                         m_descriptorStream;
+
     hid::SelectiveInputReportParser                 m_parser;    
+
+    // Kept between connections so Init can reuse their vectors
+    hid::GamepadConfig                              m_gamepadCfg;
+    hid::MouseConfig                                m_mouseCfg;
+    hid::GamepadMouseConfig                         m_gamepadMouseCfg;    // Both of the above, for composite devices
+    hid::KeyboardConfig                             m_keyboardCfg;
+    hid::DigitizerConfig                            m_digitizerCfg;
     hid::BitField<hid::MouseConfig::NUM_BUTTONS>    m_mouseButtons;
 	hid::Int32Array<hid::MouseConfig::NUM_AXES>     m_mouseAxes;
     hid::BitField<hid::GamepadConfig::NUM_BUTTONS>  m_gamepadButtons;
 	hid::Int32Array<hid::GamepadConfig::NUM_AXES>   m_gamepadAxes;
+    hid::BitField<hid::KeyboardConfig::NUM_KEYS>    m_keyboardKeys;
+    hid::BitField<hid::DigitizerConfig::NUM_BUTTONS> m_digitizerButtons;
+    hid::Int32Array<hid::DigitizerConfig::NUM_AXES> m_digitizerAxes;
 
     HIDAxisScaler m_axisScalerX0;    
     HIDAxisScaler m_axisScalerY0;
@@ -30,17 +73,104 @@ private:
     HIDAxisScaler m_axisScalerY1;
     HIDAxisScaler m_axisScalerHat;
 
+    // Digitizers are used as a mouse. Pens move while hovering and click with the tip, touchpads move while
+    // touched and click with their button. Which one we have is decided by the usages the mapping found
+    HIDPointerTracker m_pointerTracker;
+    uint8_t           m_pointerFlags;
+
+    static const uint8_t POINTER_HOVERS         = 0x01;    // Has an in-range switch, moves while hovering (pens)
+    static const uint8_t POINTER_TIP_CLICKS     = 0x02;    // Has no buttons, the tip is the left button
+    static const int     DIGITIZER_MOUSE_COUNTS = 2048;    // Mouse counts for the longer side of the surface, about 2" of a 1000 DPI mouse
+
     int m_mouseDeltaX;
     int m_mouseDeltaY;    
     
     // False until we've recieved first state update (to ensure axes init to centre position)
     bool m_stateValid;
 
+    // Raw reports from notifyCB (NimBLE host task), parsed by processReports (loop task). Room for about 30ms
+    // of reports from a 1kHz device
+    static const size_t REPORT_QUEUE_SIZE = 32;
+    HIDReportQueue::Report                      m_reportBuffer[REPORT_QUEUE_SIZE];
+    HIDReportQueue                              m_reports;
+    uint32_t                                    m_reportsLost;           // As last logged
+    uint32_t                                    m_maxReportLatencyUs;    // Longest wait in the queue
+
+    // Notified by notifyCB for every queued report, so it doesn't have to poll. nullptr for none
+    TaskHandle_t                                m_reportTask;
+
+    // Time from the arrival of a report to the outputs that follow it (see outputsUpdated), in power of two
+    // buckets: <64us, <128us ... <16ms, longer
+    static const int LATENCY_BUCKETS = 10;
+    uint32_t                                    m_latencyHistogram[LATENCY_BUCKETS];
+    uint32_t                                    m_pendingSinceUs;        // Arrival of the oldest report not yet in the outputs
+    bool                                        m_outputsPending;        // m_pendingSinceUs is valid
+
+    // Written by processReports and read by the sketch, both on the loop task, so it needs no locking
+    InputSnapshot                               m_snapshot;
+
+    // Mapped values that have changed since the last takeChanges() call
+    hid::SelectiveInputReportParser::ChangeMask m_changes;
+
+    // The gamepad variables the sketch currently reads
+    hid::SelectiveInputReportParser::ChangeMask m_gamepadInterest;
+
+    // Button transitions pushed by m_parser and popped by the sketch, so short presses aren't missed when several
+    // reports are parsed in one loop iteration
+    static const size_t EVENT_QUEUE_SIZE = 32;
+    hid::InputEventQueue::Event                 m_eventBuffer[EVENT_QUEUE_SIZE];
+    hid::InputEventQueue                        m_events;
+
+    // millis() at the start of connect(), for logging the time to the first report
+    uint32_t m_connectStartMs;
+
+    // The connected device's PnP ID and the quirks that match it
+    static const int   MAX_DEVICE_QUIRKS = 8;
+    PnPId              m_pnpId;
+    const DeviceQuirk* m_quirks[MAX_DEVICE_QUIRKS];
+    int                m_numQuirks;
+
+    void resetParser();
+    bool parseReport( const uint8_t* pData, size_t length, uint8_t reportId );
+    void publishSnapshot();
+    void recordLatency( uint32_t latencyUs );
+    bool readReportMap( NimBLEClient* pClient, NimBLERemoteCharacteristic* pChr, std::string& value );
+
+    void readPnPId( NimBLEClient* pClient );
+    bool applyDescriptorPatches( std::string& descriptor );
+    void applyAxisRemaps();
+    void applyReportLengths( hid::SelectiveInputReportParser& parser );
+    int  getHatNullValue();
+
+    // Parser mapping cache (compiled mappings stored in NVS per peer address, so known devices skip descriptor parsing)
+    int  getMappingTargets( hid::SelectiveInputReportParser::BlobTarget* targets );
+    void initGamepadScalers( hid::Int32Fields::FieldProperties* axisProps );
+    void initPointerTracker( hid::Int32Fields::FieldProperties* axisProps, uint8_t pointerFlags );
+    bool loadCachedMapping( const NimBLEAddress& address, const uint8_t* descriptorData, size_t descriptorLength );
+    void saveCachedMapping( const NimBLEAddress& address, const uint8_t* descriptorData, size_t descriptorLength, const hid::Int32Fields::FieldProperties* axisProps );
+    void clearMappingCache();
+
 public:
 
     bool connect( const NimBLEAdvertisedDevice* device );
     void disconnect();
     void notifyCB( NimBLERemoteCharacteristic* pRemoteCharacteristic, uint8_t* pData, size_t length, uint8_t reportId, bool isNotify);        
+
+    // Parses the reports queued by notifyCB and returns their number. The state accessors below only change here
+    int  processReports();
+
+    // The task to notify (xTaskNotifyGive) when a report is queued, so it can block in ulTaskNotifyTake
+    void setReportTask( TaskHandle_t task ) { m_reportTask = task; }
+
+    // Call after writing outputs that follow the reports processed so far (the joystick pins, the mouse rates...).
+    // Adds the time since the oldest report that changed something arrived to the latency histogram, unless an
+    // earlier call already wrote outputs for it
+    void outputsUpdated();
+    void printLatencyHistogram();
+
+    // Copies the gamepad state published by the last processReports() call. Call from the loop task, like
+    // processReports()
+    InputSnapshot getInputSnapshot();
     bool isConnected();    
 
     void deleteAllBonds();
@@ -48,6 +178,16 @@ public:
     bool isGamepad() { return (m_deviceTypes & hid::FLAG_GAMEPAD); }
     bool isMouse()   { return (m_deviceTypes & hid::FLAG_MOUSE);   }
 
+    // Gamepad with a mouse collection (e.g. a touchpad). Both are mapped, and the mouse accessors return its deltas/buttons
+    bool isComposite() { return isGamepad() && isMouse(); }
+
+    // Pen tablet, touchscreen or touchpad without a mouse collection. Handled as a mouse: the mouse accessors
+    // return the deltas of its absolute positions and its buttons
+    bool isDigitizer() { return (m_deviceTypes & hid::FLAG_DIGITIZER) && !isGamepad() && !isMouse(); }
+
+    // Keyboards are only used if there's nothing else (many mice have a keyboard collection for macros)
+    bool isKeyboard() { return (m_deviceTypes & hid::FLAG_KEYBOARD) && !isGamepad() && !isMouse() && !isDigitizer(); }
+
     int  getGamepadDigitalXAxis();
     int  getGamepadDigitalYAxis();
     int  getGamepadHatSwitchDir();
@@ -61,6 +201,20 @@ public:
     int  getMouseDeltaY();
     void resetMouseDeltas();
     bool getMouseButton( int idx );
+
+    // Indexed with the hid::USAGE_KEYBOARD_* / USAGE_KEYPAD_* constants. Use ForEachSet() to find the held keys
+    const hid::BitField<hid::KeyboardConfig::NUM_KEYS>& getKeyboardKeys() { return m_keyboardKeys; }
+
+    // Returns which gamepad/mouse axes (int32s, by GamepadConfig/MouseConfig axis index) and buttons (bools) have
+    // changed since the previous call, and clears them
+    hid::SelectiveInputReportParser::ChangeMask takeChanges();
+
+    // Restricts report parsing to the given gamepad axes and buttons (same indexes as takeChanges). Cheap to call
+    // every update, the parser is only touched when the set changes. Ignored for mice
+    void setGamepadInterest( const hid::SelectiveInputReportParser::ChangeMask& interest );
+
+    // Pops the oldest button up/down event (index is the gamepad or mouse button index). False if there are none
+    bool popInputEvent( hid::InputEventQueue::Event& event );
     
     BTHIDConn();
     ~BTHIDConn();    
@@ -0,0 +1,54 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// DeviceQuirks.cpp
+// Fixes for devices whose report descriptor doesn't match what they actually send, looked up by PnP ID
+// ------------------------------------------------------------------------------------------------------------------------
+
+#include <DeviceQuirks.h>
+#include <stddef.h>
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Quirk table
+//
+// Const, so it stays in flash. Several entries can match the same device, they're applied in table order. Entries look
+// like this (vendor ID source, vendor ID, product ID, type, index, value, data):
+//
+//   { 2, 0x1234, 0x5678, QUIRK_HAT_NULL,      0, 8,    nullptr },    // Hat sends 8 when centred, declares 0-8
+//   { 2, 0x1234, 0x5678, QUIRK_AXIS_REMAP,    2, 0x33, nullptr },    // Right stick X is Rx rather than Z
+//   { 2, 0x1234, 0x5678, QUIRK_REPORT_LENGTH, 1, 9,    nullptr },    // Report 1 is 9 bytes, declared longer
+//
+// A descriptor patch with the original bytes followed by the replacements:
+//
+//   static const uint8_t k_examplePatch[] = { 0x25, 0x08,  0x25, 0x07 };    // Logical max 8 -> 7
+//   { 2, 0x1234, 0x5678, QUIRK_DESCRIPTOR_PATCH, 2, 0x4a, k_examplePatch },
+//
+// Axis remaps and report lengths end up in the cached mapping (see BTHIDConn.cpp), so bump MAPPING_CACHE_MAGIC when
+// changing those entries. The cache is keyed by the patched descriptor, so patches don't need it
+// ------------------------------------------------------------------------------------------------------------------------
+
+static const DeviceQuirk k_deviceQuirks[] =
+{
+    // End of table (vendor ID source 0 never matches)
+    { 0, 0, 0, 0, 0, 0, nullptr }
+};
+
+
+int findDeviceQuirks( const PnPId& pnpId, const DeviceQuirk** quirks, int maxQuirks )
+{
+    int numQuirks = 0;
+
+    if ( pnpId.vendorIdSource==0 )
+    {
+        return 0;
+    }
+
+    for ( const DeviceQuirk* quirk = k_deviceQuirks; quirk->vendorIdSource!=0 && numQuirks<maxQuirks; quirk++ )
+    {
+        if ( quirk->vendorIdSource==pnpId.vendorIdSource && quirk->vendorId==pnpId.vendorId && quirk->productId==pnpId.productId )
+        {
+            quirks[numQuirks++] = quirk;
+        }
+    }
+
+    return numQuirks;
+}
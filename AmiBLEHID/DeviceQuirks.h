@@ -0,0 +1,44 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// DeviceQuirks.h
+// Fixes for devices whose report descriptor doesn't match what they actually send, looked up by PnP ID
+// ------------------------------------------------------------------------------------------------------------------------
+
+#include <stdint.h>
+
+// PnP ID characteristic (0x2A50) of the Device Information service
+struct PnPId
+{
+    uint8_t  vendorIdSource;    // 1 = Bluetooth SIG, 2 = USB Implementer's Forum. 0 if the device has no PnP ID
+    uint16_t vendorId;
+    uint16_t productId;
+    uint16_t productVersion;
+};
+
+enum DeviceQuirkType : uint8_t
+{
+    QUIRK_DESCRIPTOR_PATCH,    // Overwrite descriptor bytes, if the original bytes match
+    QUIRK_AXIS_REMAP,          // Map a gamepad axis from a different generic desktop usage
+    QUIRK_REPORT_LENGTH,       // The device sends shorter reports than its descriptor declares
+    QUIRK_HAT_NULL,            // The hat switch value that means centred is inside its logical range
+};
+
+struct DeviceQuirk
+{
+    uint8_t        vendorIdSource;
+    uint16_t       vendorId;
+    uint16_t       productId;
+    uint8_t        type;
+
+    // QUIRK_AXIS_REMAP: hid::GamepadConfig axis index. QUIRK_REPORT_LENGTH: report ID. QUIRK_DESCRIPTOR_PATCH: number of bytes
+    uint8_t        index;
+
+    // QUIRK_AXIS_REMAP: generic desktop usage. QUIRK_REPORT_LENGTH: length in bytes (without the report ID).
+    // QUIRK_DESCRIPTOR_PATCH: offset into the descriptor. QUIRK_HAT_NULL: the centred value
+    uint16_t       value;
+
+    // QUIRK_DESCRIPTOR_PATCH: the original bytes followed by their replacements
+    const uint8_t* data;
+};
+
+// Quirks are only looked up while connecting, Parse never sees them. Fills in up to maxQuirks matches, returns their number
+int findDeviceQuirks( const PnPId& pnpId, const DeviceQuirk** quirks, int maxQuirks );
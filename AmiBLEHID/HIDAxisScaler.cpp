@@ -7,11 +7,10 @@
 #include "hid_report_parser.h"
 
 
-void HIDAxisScaler::Init( hid::Int32Fields::FieldProperties *properties, int outputMin, int outputMax, bool isHatSwitch )
+void HIDAxisScaler::Init( hid::Int32Fields::FieldProperties *properties, int outputMin, int outputMax )
 {
     _logicalMin  = _outputMin = outputMin;
     _logicalMax  = _outputMax = outputMax;
-    _isHatSwitch = isHatSwitch;
 
     if ( properties )
     {
@@ -23,14 +22,33 @@ void HIDAxisScaler::Init( hid::Int32Fields::FieldProperties *properties, int out
 
 int HIDAxisScaler::ScaleValue( int srcValue )
 {
-    if ( _isHatSwitch )
+    int t = (((srcValue - _logicalMin)<<12)+0x7ff)/(_logicalMax-_logicalMin);        
+    return _outputMin + (((_outputMax-_outputMin)*t)>>12);    
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Hat switches
+// The parser stores hid::HAT_SWITCH_NULL for the neutral position, which falls outside the table, so needs no special case
+// ------------------------------------------------------------------------------------------------------------------------
+
+void HIDAxisScaler::InitHatSwitch( hid::Int32Fields::FieldProperties *properties )
+{
+    Init( properties, 1, 8 );
+
+    // An unmapped hat has a zero logical range, and anything other than 4 or 8 positions is unlikely to be a real hat
+    int positions = _logicalMax - _logicalMin + 1;
+    _hatPositions = ( positions==4 || positions==8 ) ? (uint8_t)positions : 0;
+
+    for ( int i=0; i<_hatPositions; i++ )
     {
-        if ( srcValue<_logicalMin )
-        {
-            return 0;
-        }        
+        _hatDirections[i] = (uint8_t)( 1 + (i*8)/_hatPositions );
     }
+}
 
-    int t = (((srcValue - _logicalMin)<<12)+0x7ff)/(_logicalMax-_logicalMin);        
-    return _outputMin + (((_outputMax-_outputMin)*t)>>12);    
+
+int HIDAxisScaler::HatDirection( int srcValue )
+{
+    uint32_t pos = (uint32_t)srcValue - (uint32_t)_logicalMin;
+    return ( pos<_hatPositions ) ? _hatDirections[pos] : 0;
 }
@@ -14,9 +14,16 @@ class HIDAxisScaler
 
         int  _outputMin;
         int  _outputMax;
-        bool _isHatSwitch;
+
+        // Hat switch position (relative to logical min) -> direction 1-8 (1=up, clockwise)
+        uint8_t _hatDirections[8];
+        uint8_t _hatPositions;
 
     public:
-        void Init( hid::Int32Fields::FieldProperties *properties, int outputMin, int outputMax, bool isHatSwitch=false );
+        void Init( hid::Int32Fields::FieldProperties *properties, int outputMin, int outputMax );
         int ScaleValue( int srcValue );
+
+        // Hat switches are decoded rather than scaled. Handles 4 and 8 position hats
+        void InitHatSwitch( hid::Int32Fields::FieldProperties *properties );
+        int HatDirection( int srcValue );
 };
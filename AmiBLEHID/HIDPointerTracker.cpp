@@ -0,0 +1,71 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// HIDPointerTracker.cpp
+// Helper class to turn absolute pointer positions (touchpads, pen tablets) into relative mouse deltas
+// ------------------------------------------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <HIDPointerTracker.h>
+#include "hid_report_parser.h"
+
+
+void HIDPointerTracker::Init( hid::Int32Fields::FieldProperties *propertiesX, hid::Int32Fields::FieldProperties *propertiesY, int countsPerRange )
+{
+    _logicalMinX = propertiesX->logical_min;
+    _logicalMaxX = propertiesX->logical_max;
+    _logicalMinY = propertiesY->logical_min;
+    _logicalMaxY = propertiesY->logical_max;
+
+    // The only division. An unmapped (zero) range gets a factor of zero, so never moves
+    int range = std::max( _logicalMaxX - _logicalMinX, _logicalMaxY - _logicalMinY );
+    _countsPerUnit = ( range>0 ) ? (int)( ((int64_t)countsPerRange<<16) / range ) : 0;
+
+    Reset();
+}
+
+
+void HIDPointerTracker::Reset()
+{
+    _tracking = false;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// Positions are clamped to the logical range, so a delta never exceeds it and delta*_countsPerUnit stays within
+// countsPerRange<<16. The arithmetic shift rounds towards minus infinity and leaves a positive remainder either way,
+// so the carry works the same in both directions
+// ------------------------------------------------------------------------------------------------------------------------
+
+void HIDPointerTracker::Update( bool contact, int contactId, int x, int y, int& deltaX, int& deltaY )
+{
+    deltaX = deltaY = 0;
+
+    if ( !contact )
+    {
+        _tracking = false;
+        return;
+    }
+
+    x = std::min( std::max( x, _logicalMinX ), _logicalMaxX );
+    y = std::min( std::max( y, _logicalMinY ), _logicalMaxY );
+
+    if ( !_tracking || contactId!=_contactId )
+    {
+        // New contact. Start from half a count so the carry rounds rather than truncates
+        _tracking   = true;
+        _contactId  = contactId;
+        _remainderX = _remainderY = 0x8000;
+    }
+    else
+    {
+        int fx = _remainderX + (x - _lastX) * _countsPerUnit;
+        int fy = _remainderY + (y - _lastY) * _countsPerUnit;
+
+        deltaX      = fx>>16;
+        deltaY      = fy>>16;
+        _remainderX = fx & 0xffff;
+        _remainderY = fy & 0xffff;
+    }
+
+    _lastX = x;
+    _lastY = y;
+}
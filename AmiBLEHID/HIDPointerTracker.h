@@ -0,0 +1,39 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// HIDPointerTracker.h
+// Helper class to turn absolute pointer positions (touchpads, pen tablets) into relative mouse deltas
+// ------------------------------------------------------------------------------------------------------------------------
+
+#include "hid_report_parser.h"
+
+class HIDPointerTracker
+{
+    private:
+        int  _logicalMinX;
+        int  _logicalMaxX;
+        int  _logicalMinY;
+        int  _logicalMaxY;
+
+        // Mouse counts per logical unit, 16.16 fixed point. The same for both axes so movement isn't stretched
+        int  _countsPerUnit;
+
+        int  _lastX;
+        int  _lastY;
+
+        // The fraction of a count left over from the previous reports (0 to 0xffff), so slow movement isn't lost
+        int  _remainderX;
+        int  _remainderY;
+
+        int  _contactId;
+        bool _tracking;
+
+    public:
+        // The larger of the two logical ranges is mapped onto countsPerRange mouse counts
+        void Init( hid::Int32Fields::FieldProperties *propertiesX, hid::Int32Fields::FieldProperties *propertiesY, int countsPerRange );
+
+        // Forget the current contact, the next position doesn't move
+        void Reset();
+
+        // Returns the movement since the previous position of the same contact. Zero for the first position after
+        // a lift or a change of contact ID
+        void Update( bool contact, int contactId, int x, int y, int& deltaX, int& deltaY );
+};
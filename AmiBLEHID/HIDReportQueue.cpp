@@ -0,0 +1,83 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// HIDReportQueue.cpp
+// Fixed-size queue of raw input reports, from the NimBLE host task (notifications) to the loop task (parsing)
+// ------------------------------------------------------------------------------------------------------------------------
+
+#include <string.h>
+#include <HIDReportQueue.h>
+
+
+HIDReportQueue::HIDReportQueue( Report* buffer, size_t capacity )
+    : _buf( buffer ),
+      _mask( (uint32_t)capacity - 1 )
+{
+    _head.store( 0, std::memory_order_relaxed );
+    _tail.store( 0, std::memory_order_relaxed );
+    Clear();
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------
+// The report is copied into its slot before the release store of _tail publishes it, and the consumer's release
+// store of _head only frees a slot after it's done reading it. So neither side ever locks or waits
+// ------------------------------------------------------------------------------------------------------------------------
+
+bool HIDReportQueue::Push( uint32_t timeUs, uint8_t reportId, const uint8_t* data, size_t length )
+{
+    _received.store( _received.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+
+    if ( length>MAX_REPORT_SIZE )
+    {
+        _tooLong.store( _tooLong.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        return false;
+    }
+
+    uint32_t tail  = _tail.load( std::memory_order_relaxed );
+    uint32_t depth = tail - _head.load( std::memory_order_acquire );
+    if ( depth>_mask )
+    {
+        _dropped.store( _dropped.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        return false;
+    }
+
+    Report& report  = _buf[tail & _mask];
+    report.timeUs   = timeUs;
+    report.reportId = reportId;
+    report.length   = (uint8_t)length;
+    memcpy( report.data, data, length );
+
+    _tail.store( tail + 1, std::memory_order_release );
+
+    if ( depth + 1>_maxDepth.load( std::memory_order_relaxed ) )
+    {
+        _maxDepth.store( depth + 1, std::memory_order_relaxed );
+    }
+    return true;
+}
+
+
+const HIDReportQueue::Report* HIDReportQueue::Peek()
+{
+    uint32_t head = _head.load( std::memory_order_relaxed );
+    if ( head==_tail.load( std::memory_order_acquire ) )
+    {
+        return nullptr;
+    }
+    return &_buf[head & _mask];
+}
+
+
+void HIDReportQueue::Release()
+{
+    _head.store( _head.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+}
+
+
+void HIDReportQueue::Clear()
+{
+    _head.store( _tail.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+    _received.store( 0, std::memory_order_relaxed );
+    _dropped.store( 0, std::memory_order_relaxed );
+    _tooLong.store( 0, std::memory_order_relaxed );
+    _maxDepth.store( 0, std::memory_order_relaxed );
+}
@@ -0,0 +1,59 @@
+// ------------------------------------------------------------------------------------------------------------------------
+// HIDReportQueue.h
+// Fixed-size queue of raw input reports, from the NimBLE host task (notifications) to the loop task (parsing)
+// ------------------------------------------------------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+class HIDReportQueue
+{
+    public:
+        // Longer reports are dropped (and counted). Gamepads, mice and keyboards send well under this
+        static const size_t MAX_REPORT_SIZE = 64;
+
+        struct Report
+        {
+            uint32_t timeUs;    // micros() when the notification arrived
+            uint8_t  reportId;
+            uint8_t  length;
+            uint8_t  data[MAX_REPORT_SIZE];
+        };
+
+        // capacity has to be a power of two
+        HIDReportQueue( Report* buffer, size_t capacity );
+
+        // Producer side (one task). Returns false if the report was dropped: the queue is full or it's too long
+        bool Push( uint32_t timeUs, uint8_t reportId, const uint8_t* data, size_t length );
+
+        // Consumer side (one other task). Peek returns the oldest report (nullptr if there are none), which stays
+        // valid until Release frees its slot
+        const Report* Peek();
+        void          Release();
+
+        // Drops the queued reports and zeroes the counters. Not while the producer may push
+        void Clear();
+
+        // Counters since Clear. Reports that arrived, were dropped because the queue was full or were too long, and
+        // the most reports that were queued at once
+        uint32_t Received() const { return _received.load( std::memory_order_relaxed ); }
+        uint32_t Dropped()  const { return _dropped.load( std::memory_order_relaxed );  }
+        uint32_t TooLong()  const { return _tooLong.load( std::memory_order_relaxed );  }
+        uint32_t MaxDepth() const { return _maxDepth.load( std::memory_order_relaxed ); }
+        uint32_t Capacity() const { return _mask + 1; }
+
+    private:
+        Report*  _buf;
+        uint32_t _mask;
+
+        // Free running, only the producer writes _tail and only the consumer writes _head
+        std::atomic<uint32_t> _head;
+        std::atomic<uint32_t> _tail;
+
+        // Written by the producer only
+        std::atomic<uint32_t> _received;
+        std::atomic<uint32_t> _dropped;
+        std::atomic<uint32_t> _tooLong;
+        std::atomic<uint32_t> _maxDepth;
+};
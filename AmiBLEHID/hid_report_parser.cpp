@@ -1,14 +1,23 @@
 // SPDX-License-Identifier: MIT
 // SPDX-FileCopyrightText:  2022 Istvan Pasztor
 
-// From https://github.com/pasztorpisti/hid-report-parser, but has had a little bodge added:
+// From https://github.com/pasztorpisti/hid-report-parser, with some changes:
 //
-// Logic in SetInt32Value was preventing controller hat switches (e.g. Xbox d-pad) ever resetting their direction to 0, as they have a logical range of 1-8
-// Not sure what a more correct solution this is, but the bodge (see lines 735/753) works for now
+// Hat switch usages get a null-state policy at Init: an out-of-range value (the neutral position of a d-pad, e.g. 0 on
+// an Xbox controller with a logical range of 1-8) is stored as HAT_SWITCH_NULL rather than being ignored
 
 
 #include "hid_report_parser.h"
 #include <NimBLEDevice.h>
+#include <type_traits>
+
+// The word load extractors assemble little endian report fields with plain
+// 32-bit loads. Both the ESP32 family and the usual desktop hosts qualify.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define HRP_LITTLE_ENDIAN 1
+#else
+#  define HRP_LITTLE_ENDIAN 0
+#endif
 
 namespace hid {
 
@@ -40,12 +49,16 @@ namespace hid {
 		"ERR_NOTHING_CHANGED",                      // -23
 		"ERR_INVALID_REPORT_SIZE",                  // -24
 		"ERR_UNDEFINED_USAGE_PAGE",                 // -25
+		"ERR_UNKNOWN_REPORT_ID",                    // -26
+		"ERR_REPORT_UNCHANGED",                     // -27
+		"ERR_INVALID_MAPPING_BLOB",                 // -28
+		"ERR_ARENA_EXHAUSTED",                      // -29
 	};
-	static_assert(26 == sizeof(STR_ERROR)/sizeof(STR_ERROR[0]), "wrong array size");
+	static_assert(30 == sizeof(STR_ERROR)/sizeof(STR_ERROR[0]), "wrong array size");
 
 
 	const char* str_error(int error_code, const char* default_str) {
-		if (error_code > 0 || error_code < -25)
+		if (error_code > 0 || error_code < -29)
 			return default_str;
 		return STR_ERROR[-error_code];
 	}
@@ -62,6 +75,13 @@ namespace {
 	static constexpr uint8_t ITEM_SIZE_MASK = 0b00000011;
 	static constexpr uint8_t ITEM_TAG_AND_TYPE_MASK = ITEM_TAG_MASK | ITEM_TYPE_MASK;
 
+	// The size of a short item including its prefix byte.
+	// A size field of 3 means 4 data bytes.
+	inline uint8_t short_item_size(uint8_t prefix) {
+		uint8_t data_size = prefix & ITEM_SIZE_MASK;
+		return 1 + (data_size == 3 ? 4 : data_size);
+	}
+
 	// To be used with the ITEM_TYPE_MASK:
 	static constexpr uint8_t ITEM_TYPE_MAIN   = 0b00000000;
 	static constexpr uint8_t ITEM_TYPE_GLOBAL = 0b00000100;
@@ -196,70 +216,112 @@ namespace {
 
 
 	int DescriptorParser::Parse(const void* descriptor, size_t descriptor_size, EventHandler* handler) {
+		Begin(handler);
+		int res = Feed(descriptor, descriptor_size);
+		if (res)
+			return res;
+		return End();
+	}
+
+	void DescriptorParser::Begin(EventHandler* handler) {
 		Reset();
+		_handler = handler;
+		_error = 0;
+		_pending_size = 0;
+		_long_item_bytes_left = 0;
+	}
 
-		auto p = (const uint8_t*)descriptor;
-		auto q = p + descriptor_size;
+	int DescriptorParser::Feed(const void* data, size_t size) {
+		if (_error)
+			return _error;
 
-		int res;
+		auto p = (const uint8_t*)data;
+		auto q = p + size;
 
-		while (p < q) {
-			uint8_t b = *p++;
-			auto bytes_left = q - p;
+		// Completing the item that was split by the end of the previous chunk.
+		while (_pending_size && p < q) {
+			_pending[_pending_size++] = *p++;
+			if (_pending[0] == ITEM_LONG) {
+				// The prefix and the data size are enough to skip the rest.
+				_long_item_bytes_left = 1 + (uint32_t)_pending[1];
+				_pending_size = 0;
+			}
+			else if (_pending_size == short_item_size(_pending[0])) {
+				_pending_size = 0;
+				if (_error = ParseItem(_pending[0], _pending + 1))
+					return _error;
+			}
+		}
 
-			if (b == ITEM_LONG) { // long item, skipping
-				if (bytes_left < 1)
-					return ERR_INCOMPLETE_ITEM;
-				p += 2 + (size_t)*p;
+		while (p < q) {
+			if (_long_item_bytes_left) {
+				size_t n = _hrp_min((size_t)(q - p), (size_t)_long_item_bytes_left);
+				p += n;
+				_long_item_bytes_left -= (uint32_t)n;
 				continue;
 			}
 
-			uint8_t data_size = b & ITEM_SIZE_MASK;
-			if (data_size == 3)
-				data_size = 4;
-			if (bytes_left < data_size)
-				return ERR_INCOMPLETE_ITEM;
-
-			uint8_t item = b & ITEM_TAG_AND_TYPE_MASK;
-
-			switch (b & ITEM_TYPE_MASK) {
-			case ITEM_TYPE_MAIN:
-				if (res = AssertMinMaxItemsAreMatched())
-					return res;
-				if (res = ParseMainItems(item, p, data_size, handler))
-					return res;
-				_locals.Reset();
-				break;
-
-			case ITEM_TYPE_GLOBAL:
-				if (res = ParseGlobalItems(item, p, data_size))
-					return res;
-				break;
-
-			case ITEM_TYPE_LOCAL:
-				if (res = ParseLocalItems(item, p, data_size))
-					return res;
+			uint8_t b = *p;
+			size_t item_size = b == ITEM_LONG ? 2 : short_item_size(b);
+			if ((size_t)(q - p) < item_size) {
+				_pending_size = (uint8_t)(q - p);
+				memcpy(_pending, p, _pending_size);
 				break;
+			}
 
-			default:
-				return ERR_INVALID_ITEM_TYPE;
+			if (b == ITEM_LONG) { // long item, skipping
+				_long_item_bytes_left = 1 + (uint32_t)p[1];
+				p += 2;
+				continue;
 			}
 
-			p += data_size;
+			if (_error = ParseItem(b, p + 1))
+				return _error;
+			p += item_size;
 		}
 
-		if (p > q)
-			return ERR_INCOMPLETE_ITEM;
-		if (res = AssertMinMaxItemsAreMatched())
-			return res;
+		return 0;
+	}
+
+	int DescriptorParser::End() {
+		if (_error)
+			return _error;
+		if (_pending_size || _long_item_bytes_left)
+			return _error = ERR_INCOMPLETE_ITEM;
+		if (_error = AssertMinMaxItemsAreMatched())
+			return _error;
 		if (_collection_depth != 0)
-			return ERR_UNCLOSED_COLLECTION;
+			return _error = ERR_UNCLOSED_COLLECTION;
 		if (_globals_stack_size != 0)
-			return ERR_PUSH_WITHOUT_POP;
-
+			return _error = ERR_PUSH_WITHOUT_POP;
 		return 0;
 	}
 
+	int DescriptorParser::ParseItem(uint8_t b, const uint8_t* p_data) {
+		uint8_t data_size = short_item_size(b) - 1;
+		uint8_t item = b & ITEM_TAG_AND_TYPE_MASK;
+		int res;
+
+		switch (b & ITEM_TYPE_MASK) {
+		case ITEM_TYPE_MAIN:
+			if (res = AssertMinMaxItemsAreMatched())
+				return res;
+			if (res = ParseMainItems(item, p_data, data_size, _handler))
+				return res;
+			_locals.Reset();
+			return 0;
+
+		case ITEM_TYPE_GLOBAL:
+			return ParseGlobalItems(item, p_data, data_size);
+
+		case ITEM_TYPE_LOCAL:
+			return ParseLocalItems(item, p_data, data_size);
+
+		default:
+			return ERR_INVALID_ITEM_TYPE;
+		}
+	}
+
 
 	int DescriptorParser::AssertMinMaxItemsAreMatched() {
 		if (_locals.flags & (Locals::FLAG_USAGE_MIN | Locals::FLAG_USAGE_MAX)) {
@@ -530,7 +592,8 @@ namespace {
 				break;
 			}
 			case 0:
-				_locals.AddUsageRange(usage, usage, usage_page);
+				if (!_locals.AddUsageRange(usage, usage, usage_page))
+					return ERR_TOO_MANY_USAGES;
 				_locals.flags |= Locals::FLAG_USAGE_MIN;
 				break;
 			}
@@ -565,7 +628,8 @@ namespace {
 				break;
 			}
 			case 0:
-				_locals.AddUsageRange(usage, usage, usage_page);
+				if (!_locals.AddUsageRange(usage, usage, usage_page))
+					return ERR_TOO_MANY_USAGES;
 				_locals.flags |= Locals::FLAG_USAGE_MAX;
 				break;
 			}
@@ -588,6 +652,127 @@ namespace {
 	}
 
 
+	DescriptorParser::EventFanOut::EventFanOut(EventHandler* const* handlers, int* results, size_t num_handlers)
+		: _handlers(handlers), _results(results), _num_handlers(num_handlers) {
+		for (size_t i=0; i<num_handlers; ++i)
+			results[i] = 0;
+	}
+
+	int DescriptorParser::EventFanOut::Field(const FieldParams& fp) {
+		for (size_t i=0; i<_num_handlers; ++i)
+			if (!_results[i])
+				_results[i] = _handlers[i]->Field(fp);
+		return 0;
+	}
+
+	int DescriptorParser::EventFanOut::Padding(ReportType rt, uint8_t report_id, uint32_t bit_size) {
+		for (size_t i=0; i<_num_handlers; ++i)
+			if (!_results[i])
+				_results[i] = _handlers[i]->Padding(rt, report_id, bit_size);
+		return 0;
+	}
+
+	int DescriptorParser::EventFanOut::BeginCollection(uint8_t collection_type, uint16_t usage_page, uint16_t usage, uint32_t depth) {
+		for (size_t i=0; i<_num_handlers; ++i)
+			if (!_results[i])
+				_results[i] = _handlers[i]->BeginCollection(collection_type, usage_page, usage, depth);
+		return 0;
+	}
+
+	int DescriptorParser::EventFanOut::EndCollection(uint32_t depth) {
+		for (size_t i=0; i<_num_handlers; ++i)
+			if (!_results[i])
+				_results[i] = _handlers[i]->EndCollection(depth);
+		return 0;
+	}
+
+	int DescriptorParser::EventLog::Field(const FieldParams& fp) {
+		if (_globals.empty() || memcmp(&_globals.back(), fp.globals, sizeof(Globals)))
+			_globals.push_back(*fp.globals);
+		Event e = {};
+		e.type = FIELD;
+		e.type_param = (uint8_t)fp.report_type;
+		e.flags = fp.flags;
+		e.num_usage_ranges = fp.num_usage_ranges;
+		e.size = fp.bit_size;
+		e.first_usage_range = (uint32_t)_usage_ranges.size();
+		e.globals = (uint32_t)_globals.size() - 1;
+		_usage_ranges.insert(_usage_ranges.end(), fp.usage_ranges, fp.usage_ranges + fp.num_usage_ranges);
+		_events.push_back(e);
+		return 0;
+	}
+
+	int DescriptorParser::EventLog::Padding(ReportType rt, uint8_t report_id, uint32_t bit_size) {
+		Event e = {};
+		e.type = PADDING;
+		e.type_param = (uint8_t)rt;
+		e.flags = report_id;
+		e.size = bit_size;
+		_events.push_back(e);
+		return 0;
+	}
+
+	int DescriptorParser::EventLog::BeginCollection(uint8_t collection_type, uint16_t usage_page, uint16_t usage, uint32_t depth) {
+		Event e = {};
+		e.type = BEGIN_COLLECTION;
+		e.type_param = collection_type;
+		e.flags = usage_page;
+		e.usage = usage;
+		e.size = depth;
+		_events.push_back(e);
+		return 0;
+	}
+
+	int DescriptorParser::EventLog::EndCollection(uint32_t depth) {
+		Event e = {};
+		e.type = END_COLLECTION;
+		e.size = depth;
+		_events.push_back(e);
+		return 0;
+	}
+
+	int DescriptorParser::EventLog::Replay(EventHandler* handler) const {
+		// FieldParams::usage_ranges isn't const so the handler gets a copy.
+		UsageRange inline_usage_ranges[HRP_INLINE_USAGE_RANGES];
+		arena_vector<UsageRange> spill(_usage_ranges.get_allocator());
+
+		for (const Event& e : _events) {
+			int res = 0;
+			switch (e.type) {
+			case FIELD:
+			{
+				FieldParams fp;
+				fp.report_type = (ReportType)e.type_param;
+				fp.flags = e.flags;
+				fp.globals = &_globals[e.globals];
+				fp.bit_size = e.size;
+				fp.usage_ranges = inline_usage_ranges;
+				if (e.num_usage_ranges > HRP_INLINE_USAGE_RANGES) {
+					if (spill.size() < e.num_usage_ranges)
+						spill.resize(e.num_usage_ranges);
+					fp.usage_ranges = spill.data();
+				}
+				fp.num_usage_ranges = e.num_usage_ranges;
+				memcpy(fp.usage_ranges, &_usage_ranges[e.first_usage_range], e.num_usage_ranges * sizeof(UsageRange));
+				res = handler->Field(fp);
+				break;
+			}
+			case PADDING:
+				res = handler->Padding((ReportType)e.type_param, (uint8_t)e.flags, e.size);
+				break;
+			case BEGIN_COLLECTION:
+				res = handler->BeginCollection(e.type_param, e.flags, e.usage, e.size);
+				break;
+			case END_COLLECTION:
+				res = handler->EndCollection(e.size);
+				break;
+			}
+			if (res)
+				return res;
+		}
+		return 0;
+	}
+
 	bool DescriptorParser::Locals::AddUsageRange(uint16_t usage_min, uint16_t usage_max, uint16_t usage_page) {
 		// If this range is a continuation of the previously added range
 		// then extend the previous range instead of adding a new one.
@@ -599,8 +784,19 @@ namespace {
 			}
 		}
 
-		if (num_usage_ranges >= HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM)
-			return false;
+		size_t capacity = usage_ranges == inline_usage_ranges ? INLINE_USAGE_RANGES : spill->size();
+		if (num_usage_ranges >= capacity) {
+			if (num_usage_ranges >= HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM || !spill)
+				return false;
+			// The spill storage keeps its size between main items and parses
+			// so it is resized only a few times.
+			capacity = _hrp_min(capacity * 2, (size_t)HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM);
+			if (spill->size() < capacity)
+				spill->resize(capacity);
+			if (usage_ranges == inline_usage_ranges)
+				memcpy(spill->data(), inline_usage_ranges, num_usage_ranges * sizeof(UsageRange));
+			usage_ranges = spill->data();
+		}
 		UsageRange& r = usage_ranges[num_usage_ranges++];
 		r.usage_min = usage_min;
 		r.usage_max = usage_max;
@@ -608,486 +804,1712 @@ namespace {
 		return true;
 	}
 
-	int SelectiveInputReportParser::Init(Collection* input_fields, const void* descriptor, size_t descriptor_size) {
+	int SelectiveInputReportParser::Init(Collection* input_fields, const void* descriptor, size_t descriptor_size, Arena* arena) {
 		Reset();
 		if (!input_fields || !descriptor || !descriptor_size)
 			return ERR_INVALID_PARAMETERS;
 
-		DescriptorMapper m(&_mapping, input_fields);
-		int res = m.MapFields(descriptor, descriptor_size);
-		if (res) {
-			Reset();
-			return res;
+		if (arena)
+			arena->ClearExhausted();
+		UseArena(arena);
+
+		int res;
+		{
+			mapping_t mapping(ArenaAllocator<char>(arena, false));
+			DescriptorMapper m(&mapping, input_fields, arena);
+			res = m.MapFields(descriptor, descriptor_size);
+			if (!res)
+				res = FinishInit(mapping);
 		}
+		return EndArenaInit(arena, res);
+	}
 
-		if (_mapping.empty())
-			return ERR_COULD_NOT_MAP_ANY_USAGES;
+	int SelectiveInputReportParser::InitMultiple(InitRequest* requests, size_t num_requests, const void* descriptor,
+		size_t descriptor_size, uint8_t* detected_device_types, Arena* arena) {
+		if (!requests || !num_requests || !descriptor || !descriptor_size)
+			return ERR_INVALID_PARAMETERS;
 
-		_have_report_ids = _mapping.find(0) == _mapping.end();
-		return 0;
+		InitMultipleStream stream(arena);
+		stream.Begin(descriptor_size);
+		stream.Feed(descriptor, descriptor_size);
+		return stream.Finish(requests, num_requests, detected_device_types);
 	}
 
-	int SelectiveInputReportParser::Parse(const void* report, size_t report_size, uint8_t report_id) {
-		if (!report || !report_size)
+	InitMultipleStream::InitMultipleStream(Arena* arena) :
+		_arena(arena),
+		_types(0),
+		_descriptor_size(0),
+		_log(arena),
+		_handlers{ _detector.Handler(_types), &_log },
+		_fan_out(_handlers, _results, 2),
+		_usage_range_spill(ArenaAllocator<UsageRange>(arena, false)),
+		_parser(&_usage_range_spill) {
+		Begin();
+	}
+
+	void InitMultipleStream::Begin(size_t descriptor_size_hint) {
+		if (_arena)
+			_arena->ClearExhausted();
+		_descriptor_size = 0;
+		_types = 0;
+		_log.Clear();
+		_log.Reserve(descriptor_size_hint);
+		_parser.Begin(&_fan_out);
+	}
+
+	int InitMultipleStream::Feed(const void* data, size_t size) {
+		_descriptor_size += size;
+		return _parser.Feed(data, size);
+	}
+
+	void InitMultipleStream::Reset() {
+		_log.Release();
+		_usage_range_spill = decltype(_usage_range_spill)(_usage_range_spill.get_allocator());
+		_descriptor_size = 0;
+		_types = 0;
+		_parser.Begin(&_fan_out);
+	}
+
+	int InitMultipleStream::Finish(SelectiveInputReportParser::InitRequest* requests, size_t num_requests,
+		uint8_t* detected_device_types) {
+		if (!requests || !num_requests)
 			return ERR_INVALID_PARAMETERS;
-		if (_mapping.empty())
-			return ERR_UNINITIALISED_PARSER;
 
-		const uint8_t* r = (const uint8_t*)report;
+		for (size_t i=0; i<num_requests; ++i) {
+			requests[i].parser->Reset();
+			requests[i].parser->UseArena(_arena);
+		}
 
-		auto it = _mapping.find(report_id);
-        
-        if (it == _mapping.end())
-            it = _mapping.begin();
+		int res = _descriptor_size ? _parser.End() : ERR_INVALID_PARAMETERS;
 
-		if (it == _mapping.end())
-			return ERR_NOTHING_CHANGED;
-		ReportMapper& m = it->second;
+		if (!res) {
+			using DescriptorMapper = SelectiveInputReportParser::DescriptorMapper;
+			ArenaAllocator<char> scratch(_arena, false);
 
-		if (report_size * 8 != m.bit_size)
-			return ERR_INVALID_REPORT_SIZE;
+			// One mapper per applicable request, all of them fed by a single replay.
+			arena_vector<SelectiveInputReportParser::mapping_t> mappings(num_requests, scratch);
+			arena_vector<DescriptorMapper> mappers(scratch);
+			arena_vector<DescriptorParser::EventHandler*> mapper_handlers(scratch);
+			arena_vector<size_t> mapper_requests(scratch);
+			mappers.reserve(num_requests);
 
-		if (_have_report_ids) {
-			for (auto& it : _mapping) {
-				if (it.first == report_id)
+			for (size_t i=0; i<num_requests; ++i) {
+				SelectiveInputReportParser::InitRequest& r = requests[i];
+				if (!r.input_fields) {
+					r.result = ERR_INVALID_PARAMETERS;
 					continue;
-				// Resetting those relative fields that don't belong to this
-				// report_id because they won't be updated by this report and
-				// and "no change" means zero value in case of a relative field.
-				for (ReportFieldMapping& fm : it.second.fields) 
-                {
-					if (fm.relative)
-                    {                        
-						ReportFieldMapping::ResetFields(fm);
-                    }
 				}
+				if (r.device_types && !(r.device_types & _types)) {
+					r.result = ERR_COULD_NOT_MAP_ANY_USAGES;
+					continue;
+				}
+				mappers.emplace_back(&mappings[i], r.input_fields, _arena);
+				mappers.back().Prepare();
+				mapper_requests.push_back(i);
 			}
-		}
-
-		for (ReportFieldMapping& fm : m.fields) 
-        {
-            int res = 0;
-            if ( fm.variable )
-            {                
-                res = ReportFieldMapping::ParseVarFields(fm, r);
-            }
-            else
-            {
-                res = ReportFieldMapping::ParseArrayFields(fm, r);
-            }
-
-			if (res)
-            {
-				return res;
-            }
-		}
+			for (DescriptorMapper& m : mappers)
+				mapper_handlers.push_back(m.Handler());
 
-		return 0;
-	}
+			arena_vector<int> mapper_results(mappers.size(), scratch);
+			DescriptorParser::EventFanOut mapper_fan_out(mapper_handlers.data(), mapper_results.data(), mapper_handlers.size());
+			_log.Replay(&mapper_fan_out);
 
-	void SelectiveInputReportParser::ReportFieldMapping::ResetFields(const ReportFieldMapping& m) {
-		for (auto const& it : m.mappings.int32_values) {
-			for (const UsageIndexRange& r : it.second)
-				memset(&it.first[r.val_min], 0, sizeof(int32_t)*r.length);
+			for (size_t k=0; k<mappers.size(); ++k) {
+				SelectiveInputReportParser::InitRequest& r = requests[mapper_requests[k]];
+				r.result = mapper_results[k];
+				if (r.result)
+					continue;
+				mappers[k].Finish();
+				r.result = r.parser->FinishInit(mappings[mapper_requests[k]]);
+			}
 		}
 
-		for (auto const& it : m.mappings.bool_values) {
-			for (const UsageIndexRange& r : it.second) {
-				if (r.length <= 2) {
-					for (size_t i = r.val_min, e = r.val_min + r.length; i < e; ++i)
-						it.first[i >> 3] &= ~(1 << (i & 7));
-				}
-				else {
-					size_t idx = r.val_min >> 3;
-					size_t bits_left = r.length;
-
-					uint8_t first_byte_shift = (uint8_t)(r.val_min & 7);
-					if (first_byte_shift) {
-						uint8_t bits_in_first_byte = (uint8_t)_hrp_min((size_t)(8 - first_byte_shift), bits_left);
-						bits_left -= bits_in_first_byte;
-						it.first[idx++] &= ~((((uint8_t)1 << bits_in_first_byte) - 1) << first_byte_shift);
-					}
+		if (detected_device_types)
+			*detected_device_types = res ? 0 : _types;
 
-					size_t whole_bytes = bits_left >> 3;
-					if (whole_bytes)
-						memset(&it.first[idx], 0, whole_bytes);
+		// The scratch allocations have to be freed before the arena releases them.
+		Reset();
 
-					uint8_t bits_in_last_byte = bits_left & 7;
-					if (bits_in_last_byte)
-						it.first[idx+whole_bytes] &= ~(((uint8_t)1 << bits_in_last_byte) - 1);
-				}
-			}
+		for (size_t i=0; i<num_requests; ++i) {
+			SelectiveInputReportParser::InitRequest& r = requests[i];
+			if (res)
+				r.result = res;
+			// Only the first parser releases the scratch allocations.
+			r.result = r.parser->EndArenaInit(i ? nullptr : _arena, r.result);
 		}
+		return res;
 	}
 
-	static bool IsOutOfRange(int32_t v, int32_t logical_min, int32_t logical_max) {
-		return v < logical_min || v > logical_max;
+	// Makes the vectors of the compiled mapping allocate from the arena.
+	// The parser has to be Reset before this.
+	void SelectiveInputReportParser::UseArena(Arena* arena) {
+		_arena = arena;
+		if (!arena)
+			return;
+		_programs = decltype(_programs)(ArenaAllocator<ReportProgram>(arena, true));
+		_ops = decltype(_ops)(ArenaAllocator<FieldOp>(arena, true));
+		_array_ranges = decltype(_array_ranges)(ArenaAllocator<ArrayItemRange>(arena, true));
+		_array_lookup = decltype(_array_lookup)(ArenaAllocator<uint16_t>(arena, true));
+		_resets = decltype(_resets)(ArenaAllocator<ResetRange>(arena, true));
+		_report_cache = decltype(_report_cache)(ArenaAllocator<uint32_t>(arena, true));
+		_watches = decltype(_watches)(ArenaAllocator<WatchRange>(arena, true));
+		_watch_snapshot = decltype(_watch_snapshot)(ArenaAllocator<uint32_t>(arena, true));
 	}
 
-	static bool IsOutOfRange(uint32_t v, int32_t logical_min, int32_t logical_max) {
-		return v < (uint32_t)logical_min || v >(uint32_t)logical_max;
+	// Called at the end of Init with its result after all of its temporary
+	// containers have been destroyed.
+	int SelectiveInputReportParser::EndArenaInit(Arena* arena, int res) {
+		if (arena) {
+			arena->ReleaseScratch();
+		}
+		if (!res && _arena && _arena->Exhausted())
+			res = ERR_ARENA_EXHAUSTED;
+		if (res)
+			Reset();
+		return res;
 	}
 
-	// signed int32_t value
-	static void SetInt32Value(int32_t& dest, int32_t v, int32_t logical_min, int32_t logical_max, bool relative) {
-        
-        // Xbox D-Pad reports as a hat switch with logical min of 1. But when it sends a zero, we want to clear its state to 0
-        bool hatSwitchHack = ((logical_max-logical_min)==7);
-
-		// From the HID specification:
-		//   If the host or the device receives an out-of-range value then
-		//   the current value for the respective control will not be modified.
-		if (IsOutOfRange(v, logical_min, logical_max)) {
-            if (relative) dest = 0;
-			if (hatSwitchHack) dest = -1;
-		}
-		else {
-			dest = v;
+	int SelectiveInputReportParser::FinishInit(const mapping_t& mapping) {
+		if (mapping.empty())
+			return ERR_COULD_NOT_MAP_ANY_USAGES;
+
+		int res = Compile(mapping);
+		if (res) {
+			Reset();
+			return res;
 		}
-	}
 
-	// unsigned uint32_t value
-	static void SetInt32Value(int32_t& dest, uint32_t v, int32_t logical_min, int32_t logical_max, bool relative) {
+		CompileMinSizes();
+		LinkOps();
 
-        // Xbox D-Pad reports as a hat switch with logical min of 1. But when it sends a zero, we want to clear its state to 0
-        bool hatSwitchHack = ((logical_max-logical_min)==7);
+		_have_report_ids = mapping.find(0) == mapping.end();
 
-		// From the HID specification:
-		//   If the host or the device receives an out-of-range value then
-		//   the current value for the respective control will not be modified.
-		if (IsOutOfRange(v, logical_min, logical_max)) {
-			if (relative) dest = 0;
-			if (hatSwitchHack) dest = -1;
+		if (_have_report_ids) {
+			for (size_t i=0; i<_programs.size(); ++i)
+				_program_index[_programs[i].report_id] = (uint8_t)i;
+
+			res = CompileResetLists();
+			if (res) {
+				Reset();
+				return res;
+			}
 		}
 		else {
-			dest = (int32_t)v;
+			// Without report IDs in the descriptor there is only one program
+			// and it handles whatever report_id the transport layer passes in.
+			memset(_program_index, 0, sizeof(_program_index));
 		}
-	}
 
-	int SelectiveInputReportParser::ReportFieldMapping::ParseVarFields(const ReportFieldMapping& m, const uint8_t* report) {
-
-		// IInt32Target
+		CompileArrayLookups();
+		CompileDedup();
+		ApplyInterest();
+		return 0;
+	}
 
-		if (m.byte_aligned) {
-			// integer fields are often byte-aligned in HID descriptors
-			size_t offset = m.bit_offset >> 3;
-			size_t size = m.report_size >> 3;
-			if (m.signed_) {
-				for (auto const& it : m.mappings.int32_values) {
-					for (const UsageIndexRange& r : it.second) {
-						for (size_t i=r.val_min,e=r.val_min+r.length,k=offset+r.desc_min*size; i<e; ++i,k+=size) {
-							int32_t v;
-							switch (size) {
-							case 1: v = (int8_t)report[k]; break;
-							case 2: v = (int16_t)((int16_t)report[k] | ((int16_t)report[k+1] << 8)); break;
-							case 3: v = (int32_t)((int16_t)report[k] | ((int16_t)report[k+1] << 8) | ((int32_t)(int8_t)report[k+2] << 16)); break;
-							default: v = (int32_t)((int32_t)report[k] | ((int32_t)report[k+1] << 8) | ((int32_t)report[k+2] << 16) | ((int32_t)report[k+3] << 24)); break;
-							}
-							SetInt32Value(it.first[i], v, m.logical_min, m.logical_max, m.relative);
-						}
-					}
+	// Flattens the std::map based output of the DescriptorMapper into one
+	// contiguous FieldOp array. Every UsageIndexRange of a variable field
+	// becomes an op of its own so Parse doesn't have to look at the
+	// DescFieldMappings at all. An array field becomes a single op because its
+	// items have to be matched against all of its ranges.
+	int SelectiveInputReportParser::Compile(const mapping_t& mapping) {
+		size_t num_ops = 0;
+		size_t num_ranges = 0;
+		for (auto const& it : mapping) {
+			for (const ReportFieldMapping& fm : it.second.fields) {
+				size_t n = 0;
+				for (auto const& v : fm.mappings.int32_values)
+					n += v.second.size();
+				for (auto const& v : fm.mappings.bool_values)
+					n += v.second.size();
+				if (fm.variable) {
+					num_ops += n;
 				}
-			}
-			else { // !m.signed_
-				for (auto const& it : m.mappings.int32_values) {
-					for (const UsageIndexRange& r : it.second) {
-						for (size_t i=r.val_min,e=r.val_min+r.length,k=offset+r.desc_min*size; i<e; ++i,k+=size) {
-							uint32_t v;
-							switch (size) {
-							case 1: v = report[k]; break;
-							case 2: v = report[k] | ((uint16_t)report[k+1] << 8); break;
-							case 3: v = report[k] | ((uint16_t)report[k+1] << 8) | ((uint32_t)report[k+2] << 16); break;
-							default: v = report[k] | ((uint16_t)report[k+1] << 8) | ((uint32_t)report[k+2] << 16) | ((uint32_t)report[k+3] << 24); break;
-							}
-							SetInt32Value(it.first[i], v, m.logical_min, m.logical_max, m.relative);
-						}
-					}
+				else {
+					num_ops++;
+					num_ranges += n;
 				}
 			}
 		}
-		else { // !m.byte_aligned
 
-			size_t size = m.report_size;
-			size_t limited_size = _hrp_min(size, size_t(32));
-
-			// https://graphics.stanford.edu/~seander/bithacks.html#VariableSignExtend
-			int32_t mask = m.signed_ ? (uint32_t)1 << (limited_size - 1) : 0;
-
-			for (auto const& it : m.mappings.int32_values) {
-				for (const UsageIndexRange& r : it.second) {
-					for (size_t i=r.val_min,e=r.val_min+r.length,k=m.bit_offset+r.desc_min*size; i<e; ++i,k+=size) {
-						uint8_t shift = (uint8_t)(k & 7);
-						size_t idx = k >> 3;
-
-						// n is the number of bytes in the report array that contain our report_size-bits long integer
-						// Example: A 10-bit integer may span 2 or 3 bytes. It spans 3 bytes only if the first bit
-						//          starts at the most significant bit of the first byte (in which case shift==7).
-						// An unaligned 32 bit integer spans 5 bytes but the HID specification clearly states that
-						// the maximum span is 4 bytes so 32 bit values can satisfy that only by being byte-aligned.
-						uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
-
-						uint32_t v = 0;
-						switch (n) {
-						case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
-						case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
-						case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
-						case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
-						case 1: v |= report[idx] >> shift;
-						}
-
-						// zero'ing the bits above position 'limited_size'
-						v &= ((uint32_t)1 << limited_size) - 1;
+		// Op and range indexes are stored as uint16_t.
+		if (num_ops > 0xffff || num_ranges > 0xffff)
+			return ERR_UNSPECIFIED;
 
-						if (m.signed_) {
-							// sign-extending the limited_size-bits wide integer
-							int32_t sv = (int32_t)((v ^ mask) - mask);
-							SetInt32Value(it.first[i], sv, m.logical_min, m.logical_max, m.relative);
+		_programs.reserve(mapping.size());
+		_ops.reserve(num_ops);
+		_array_ranges.reserve(num_ranges);
+
+		for (auto const& it : mapping) {
+			ReportProgram prog = {};
+			prog.report_id = it.first;
+			prog.bit_size = it.second.bit_size;
+			prog.first_op = (uint16_t)_ops.size();
+
+			for (const ReportFieldMapping& fm : it.second.fields) {
+				FieldOp op = {};
+				op.logical_min = fm.logical_min;
+				op.logical_max = fm.logical_max;
+				op.report_size = (uint16_t)fm.report_size;
+				op.flags = (fm.relative ? FieldOp::FLAG_RELATIVE : 0) |
+					(fm.signed_ ? FieldOp::FLAG_SIGNED : 0) |
+					(fm.byte_aligned ? FieldOp::FLAG_BYTE_ALIGNED : 0) |
+					(fm.first_usage_is_zero ? FieldOp::FLAG_FIRST_USAGE_IS_ZERO : 0);
+
+				if (!fm.variable) {
+					op.kind = FieldOp::ARRAY;
+					op.bit_offset = fm.bit_offset;
+					op.count = (uint16_t)fm.report_count;
+					op.aux = (uint16_t)_array_ranges.size();
+					// ProcessArrayItem tries the int32 ranges before the bool ranges.
+					for (auto const& v : fm.mappings.int32_values) {
+						for (const UsageIndexRange& r : v.second) {
+							if (r.desc_min + r.length > 0xffff || r.val_min + r.length > 0xffff)
+								return ERR_UNSPECIFIED;
+							_array_ranges.push_back({ v.first, (uint16_t)r.desc_min, (uint16_t)r.val_min, (uint16_t)r.length, false });
 						}
-						else {
-							SetInt32Value(it.first[i], v, m.logical_min, m.logical_max, m.relative);
+					}
+					for (auto const& v : fm.mappings.bool_values) {
+						for (const UsageIndexRange& r : v.second) {
+							if (r.desc_min + r.length > 0xffff || r.val_min + r.length > 0xffff)
+								return ERR_UNSPECIFIED;
+							_array_ranges.push_back({ v.first, (uint16_t)r.desc_min, (uint16_t)r.val_min, (uint16_t)r.length, true });
 						}
 					}
+					op.num_aux = (uint16_t)(_array_ranges.size() - op.aux);
+					_ops.push_back(op);
+					continue;
 				}
-			}
-		}
 
-		// IBoolTarget
-
-		if (m.report_size == 1) {
-			// This is a bitfield that can be very long: up to HRP_MAX_REPORT_COUNT bits.
-			// A typical example to this is an NKRO gaming keyboard sending 100+
-			// keys but many other gaming- and simulation-related devices send
-			// the state of similarly high number of buttons in large bitfields.
-
-			// As a 1-bit integer the value of 1 can be interpreted as either
-			// 1 or -1 so logical_max can be anything but zero. In practice
-			// logical_min and logical_max will be 0 and 1 respectively 99.99%
-			// of the time. Anything else is likely to be a pathological case.
-			if (m.logical_min <= 0 && m.logical_max != 0) {
-				// bit_copy_t must be an unsigned integral type that is at least 16 bits wide.
-				typedef size_t bit_copy_t;  // C99 standard: The bit width of size_t is not less than 16.
-				static_assert(sizeof(bit_copy_t)>=2 && sizeof(bit_copy_t)<=8, "the width of bit_copy_t must be between 16 and 64 bits");
-				static_assert((bit_copy_t)-1 > (bit_copy_t)0, "bit_copy_t must be unsigned");
-				// MAX_BLOCK_SIZE is the maximum number of bits we shift and move
-				// from the source to the destination in a bit_copy_t instance.
-				static constexpr size_t MAX_BLOCK_SIZE = sizeof(bit_copy_t) * 8 - 8;
-
-				for (auto const& it : m.mappings.bool_values) {
-					uint8_t* bits = it.first;
-					for (const UsageIndexRange& r : it.second) {
-						size_t bits_remaining = r.length;
-						for (size_t i=r.val_min,k=m.bit_offset+r.desc_min; bits_remaining; i+=MAX_BLOCK_SIZE,k+=MAX_BLOCK_SIZE) {
-							size_t block_size = _hrp_min(bits_remaining, MAX_BLOCK_SIZE);
-							bits_remaining -= block_size;
-
-							int8_t shift_src = (int8_t)(k & 7);
-							int8_t shift_dest = (int8_t)(i & 7);
-							// positive shift -> left shift
-							// negative shift -> right shift (by -shift number of bits)
-							int8_t shift = shift_dest - shift_src;
-
-							bit_copy_t mask = (((bit_copy_t)1 << block_size) - 1) << shift_dest;
-							bit_copy_t v = 0;
-							{
-								// source
-								size_t idx = k >> 3;
-								uint8_t n = (uint8_t)((shift_src + block_size + 7) >> 3);
-
-								if (shift == 0) {
-									switch (n) {
-									case 8: v |= (bit_copy_t)report[idx+7] << 56;
-									case 7: v |= (bit_copy_t)report[idx+6] << 48;
-									case 6: v |= (bit_copy_t)report[idx+5] << 40;
-									case 5: v |= (bit_copy_t)report[idx+4] << 32;
-									case 4: v |= (bit_copy_t)report[idx+3] << 24;
-									case 3: v |= (bit_copy_t)report[idx+2] << 16;
-									case 2: v |= (bit_copy_t)report[idx+1] << 8;
-									case 1: v |= (bit_copy_t)report[idx];
-									}
-								}
-								else {
-									switch (n) {
-									case 8: v |= (bit_copy_t)report[idx+7] << (56 + shift);
-									case 7: v |= (bit_copy_t)report[idx+6] << (48 + shift);
-									case 6: v |= (bit_copy_t)report[idx+5] << (40 + shift);
-									case 5: v |= (bit_copy_t)report[idx+4] << (32 + shift);
-									case 4: v |= (bit_copy_t)report[idx+3] << (24 + shift);
-									case 3: v |= (bit_copy_t)report[idx+2] << (16 + shift);
-									case 2: v |= (bit_copy_t)report[idx+1] << (8 + shift);
-									case 1: v |= (shift<0) ? ((bit_copy_t)report[idx] >> -shift) : ((bit_copy_t)report[idx] << shift);
-									}
-								}
-
-								v &= mask;
-							}
-
-							{
-								// destination
-								size_t idx = i >> 3;
-								uint8_t n = (uint8_t)((shift_dest + block_size + 7) >> 3);
-								mask = ~mask;
-
-								switch (n) {
-								case 8: bits[idx+7] = (sizeof(bit_copy_t)!=8 && n>8) ? (uint8_t)(v >> 56) : ((bits[idx+7] & (uint8_t)(mask >> 56)) | (uint8_t)(v >> 56));
-								case 7: bits[idx+6] = (sizeof(bit_copy_t)!=7 && n>7) ? (uint8_t)(v >> 48) : ((bits[idx+6] & (uint8_t)(mask >> 48)) | (uint8_t)(v >> 48));
-								case 6: bits[idx+5] = (sizeof(bit_copy_t)!=6 && n>6) ? (uint8_t)(v >> 40) : ((bits[idx+5] & (uint8_t)(mask >> 40)) | (uint8_t)(v >> 40));
-								case 5: bits[idx+4] = (sizeof(bit_copy_t)!=5 && n>5) ? (uint8_t)(v >> 32) : ((bits[idx+4] & (uint8_t)(mask >> 32)) | (uint8_t)(v >> 32));
-								case 4: bits[idx+3] = (sizeof(bit_copy_t)!=4 && n>4) ? (uint8_t)(v >> 24) : ((bits[idx+3] & (uint8_t)(mask >> 24)) | (uint8_t)(v >> 24));
-								case 3: bits[idx+2] = (sizeof(bit_copy_t)!=3 && n>3) ? (uint8_t)(v >> 16) : ((bits[idx+2] & (uint8_t)(mask >> 16)) | (uint8_t)(v >> 16));
-								case 2: bits[idx+1] = (sizeof(bit_copy_t)!=2 && n>2) ? (uint8_t)(v >> 8)  : ((bits[idx+1] & (uint8_t)(mask >> 8))  | (uint8_t)(v >> 8));
-								case 1: bits[idx] = (bits[idx] & (uint8_t)mask) | (uint8_t)v;
-								}
-							}
-						}
+				op.kind = FieldOp::INT32_VAR;
+				for (auto const& v : fm.mappings.int32_values) {
+					for (const UsageIndexRange& r : v.second) {
+						if (r.val_min + r.length > 0xffff)
+							return ERR_UNSPECIFIED;
+						op.target = v.first + r.val_min;
+						op.val_min = (uint16_t)r.val_min;
+						op.bit_offset = fm.bit_offset + (uint32_t)r.desc_min * fm.report_size;
+						op.count = (uint16_t)r.length;
+						if (r.hat_switch)
+							op.flags |= FieldOp::FLAG_NULL_STATE;
+						else
+							op.flags &= ~FieldOp::FLAG_NULL_STATE;
+						_ops.push_back(op);
+					}
+				}
+				op.flags &= ~FieldOp::FLAG_NULL_STATE;
+
+				if (fm.report_size == 1) {
+					// As a 1-bit integer the value of 1 can be interpreted as either
+					// 1 or -1 so logical_max can be anything but zero. In practice
+					// logical_min and logical_max will be 0 and 1 respectively 99.99%
+					// of the time. Anything else is likely to be a pathological case
+					// that we don't even compile.
+					if (fm.logical_min > 0 || fm.logical_max == 0)
+						continue;
+					op.kind = FieldOp::BOOL_BITS;
+					op.parse = FieldOp::ParseBoolBits;
+				}
+				else {
+					op.kind = FieldOp::BOOL_INTS;
+					op.parse = FieldOp::ParseBoolInts;
+				}
+
+				for (auto const& v : fm.mappings.bool_values) {
+					for (const UsageIndexRange& r : v.second) {
+						if (r.val_min + r.length > 0xffff)
+							return ERR_UNSPECIFIED;
+						op.target = v.first;
+						op.bit_offset = fm.bit_offset + (uint32_t)r.desc_min * fm.report_size;
+						op.count = (uint16_t)r.length;
+						op.val_min = (uint16_t)r.val_min;
+						_ops.push_back(op);
 					}
 				}
 			}
+
+			prog.num_ops = (uint16_t)(_ops.size() - prog.first_op);
+			_programs.push_back(prog);
 		}
-		else { // m.report_size > 1
 
-			// This branch maps integer fields of the reports onto bool fields
-			// of the application. No one should do this in practice.
+		return 0;
+	}
 
-			size_t size = m.report_size;
-			size_t limited_size = _hrp_min(size, size_t(32));
+	// Keyboard and consumer control arrays map their items onto a single
+	// bitfield. For these a dense table gives the bit index of each item value
+	// so ParseArray doesn't have to match every item against the ranges.
+	void SelectiveInputReportParser::CompileArrayLookups() {
+		size_t total = 0;
+		for (FieldOp& op : _ops) {
+			if (op.kind != FieldOp::ARRAY || !op.num_aux || op.logical_min < 0)
+				continue;
 
-			int32_t mask = m.signed_ ? (uint32_t)1 << (limited_size - 1) : 0;
+			const ArrayItemRange* ranges = &_array_ranges[op.aux];
+			size_t size = 0;
+			bool ok = true;
+			for (size_t i=0; i<op.num_aux && ok; ++i) {
+				const ArrayItemRange& r = ranges[i];
+				ok = r.is_bool && r.target == ranges[0].target && (size_t)r.val_min + r.length <= 0x8000;
+				size = _hrp_max(size, (size_t)r.desc_min + r.length);
+			}
+			// Items above logical_max are ignored anyway.
+			size = (size_t)_hrp_min((int64_t)size, (int64_t)op.logical_max - op.logical_min + 1);
+			if (!ok || size == 0 || size > HRP_MAX_ARRAY_LOOKUP_SIZE || total + size > 0xffff)
+				continue;
 
-			for (auto const& it : m.mappings.bool_values) {
-				for (const UsageIndexRange& r : it.second) {
-					for (size_t i=r.val_min,e=r.val_min+r.length,k=m.bit_offset+r.desc_min*size; i<e; ++i,k+=size) {
-						uint8_t shift = (uint8_t)(k & 7);
-						size_t idx = k >> 3;
+			op.target = ranges[0].target;
+			op.lookup_first = (uint16_t)total;
+			op.lookup_size = (uint16_t)size;
+			total += size;
+		}
 
-						uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
-						uint32_t v = 0;
-						switch (n) {
-						case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
-						case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
-						case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
-						case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
-						case 1: v |= report[idx] >> shift;
-						}
+		_array_lookup.assign(total, 0);
 
-						// zero'ing the bits above position 'limited_size'
-						v &= ((uint32_t)1 << limited_size) - 1;
+		for (const FieldOp& op : _ops) {
+			if (op.kind != FieldOp::ARRAY || !op.lookup_size)
+				continue;
+			uint16_t* lookup = &_array_lookup[op.lookup_first];
+			// The first matching range wins like in ProcessArrayItem.
+			for (const ArrayItemRange* r = &_array_ranges[op.aux], *e = r + op.num_aux; r < e; ++r) {
+				for (size_t i=0; i<r->length && (size_t)r->desc_min + i < op.lookup_size; ++i) {
+					uint16_t& entry = lookup[r->desc_min + i];
+					if (!entry)
+						entry = (uint16_t)(((r->val_min + i) << 1) | 1);
+				}
+			}
+			if (op.flags & FieldOp::FLAG_FIRST_USAGE_IS_ZERO)
+				lookup[0] = 0;
+		}
+	}
 
-						bool out_of_range;
-						if (m.signed_) {
-							// sign-extending the limited_size-bits wide integer
-							int32_t sv = (int32_t)((v ^ mask) - mask);
-							out_of_range = IsOutOfRange(sv, m.logical_min, m.logical_max);
-						}
-						else {
-							out_of_range = IsOutOfRange(v, m.logical_min, m.logical_max);
-						}
+	// A report doesn't update the relative fields of the other report IDs
+	// but "no change" means zero value in case of a relative field so these
+	// have to be zeroed whenever a report arrives. This collects them per
+	// report ID so Parse doesn't have to scan the ops of every other program.
+	void SelectiveInputReportParser::AddReset(size_t first, const ResetRange& rr) {
+		// Composite devices often report the same relative variables under
+		// several report IDs.
+		for (size_t i=first; i<_resets.size(); ++i) {
+			if (_resets[i] == rr)
+				return;
+		}
+		_resets.push_back(rr);
+	}
 
-						if (!out_of_range) {
-							if (v)
-								it.first[i >> 3] |= 1 << (i & 7);
+	int SelectiveInputReportParser::CompileResetLists() {
+		for (ReportProgram& prog : _programs) {
+			size_t first = _resets.size();
+			for (const ReportProgram& other : _programs) {
+				if (&other == &prog)
+					continue;
+				for (size_t i=other.first_op,e=i+other.num_ops; i<e; ++i) {
+					const FieldOp& op = _ops[i];
+					if (!(op.flags & FieldOp::FLAG_RELATIVE))
+						continue;
+
+					switch (op.kind) {
+					case FieldOp::INT32_VAR:
+						AddReset(first, { op.target, op.val_min, op.count, false });
+						break;
+					case FieldOp::BOOL_BITS:
+					case FieldOp::BOOL_INTS:
+						AddReset(first, { op.target, op.val_min, op.count, true });
+						break;
+					case FieldOp::ARRAY:
+						for (size_t k=op.aux,ke=k+op.num_aux; k<ke; ++k) {
+							const ArrayItemRange& ar = _array_ranges[k];
+							if (ar.is_bool)
+								AddReset(first, { ar.target, ar.val_min, ar.length, true });
 							else
-								it.first[i >> 3] &= ~(1 << (i & 7));
+								AddReset(first, { (int32_t*)ar.target + ar.val_min, ar.val_min, ar.length, false });
 						}
+						break;
 					}
 				}
 			}
-		}
 
+			if (_resets.size() > 0xffff)
+				return ERR_UNSPECIFIED;
+			prog.first_reset = (uint16_t)first;
+			prog.num_resets = (uint16_t)(_resets.size() - first);
+		}
 		return 0;
 	}
 
-	int SelectiveInputReportParser::ReportFieldMapping::ParseArrayFields(const ReportFieldMapping& m, const uint8_t* report) {
-		// Zeroing out the bitfields and the rest of the function will set only
-		// those bits that are referenced by the integer values found in the array.
-		ResetFields(m);
-
-		if (m.byte_aligned) {
-			// integer fields are often byte-aligned in HID descriptors
-			size_t offset = m.bit_offset >> 3;
-			size_t size = m.report_size >> 3;
-
-			for (size_t i=offset,e=offset+m.report_count*size; i<e; i+=size) {
-				uint32_t v;
-				switch (size) {
-				case 1: v = report[i]; break;
-				case 2: v = report[i] | ((uint16_t)report[i+1] << 8); break;
-				case 3: v = report[i] | ((uint16_t)report[i+1] << 8) | ((uint32_t)report[i+2] << 16); break;
-				default: v = report[i] | ((uint16_t)report[i+1] << 8) | ((uint32_t)report[i+2] << 16) | ((uint32_t)report[i+3] << 24); break;
-				}
-
-				ProcessArrayItem(m, v);
-			}
+	static void ClearBits(uint8_t* bits, size_t first, size_t length) {
+		if (length <= 2) {
+			for (size_t i = first, e = first + length; i < e; ++i)
+				bits[i >> 3] &= ~(1 << (i & 7));
+			return;
 		}
-		else { // !m.byte_aligned
-			size_t size = m.report_size;
-			size_t limited_size = _hrp_min(size, size_t(32));
 
-			for (size_t i=m.bit_offset,e=m.bit_offset+m.report_count*size; i<e; i+=size) {
-				uint8_t shift = (uint8_t)(i & 7);
-				size_t idx = i >> 3;
+		size_t idx = first >> 3;
+		size_t bits_left = length;
 
-				// n is the number of bytes in the report array that contain our report_size-bits long integer
-				// Example: A 10-bit integer may span 2 or 3 bytes. It spans 3 bytes only if the first bit
-				//          starts at the most significant bit of the first byte (in which case shift==7).
-				// An unaligned 32 bit integer spans 5 bytes but the HID specification clearly states that
-				// the maximum span is 4 bytes so 32 bit values can satisfy that only by being byte-aligned.
-				uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
+		uint8_t first_byte_shift = (uint8_t)(first & 7);
+		if (first_byte_shift) {
+			uint8_t bits_in_first_byte = (uint8_t)_hrp_min((size_t)(8 - first_byte_shift), bits_left);
+			bits_left -= bits_in_first_byte;
+			bits[idx++] &= ~((((uint8_t)1 << bits_in_first_byte) - 1) << first_byte_shift);
+		}
 
-				uint32_t v = 0;
-				switch (n) {
-				case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
-				case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
-				case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
-				case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
-				case 1: v |= report[idx] >> shift;
-				}
+		size_t whole_bytes = bits_left >> 3;
+		if (whole_bytes)
+			memset(&bits[idx], 0, whole_bytes);
 
-				// zero'ing the bits above position 'limited_size'
-				v &= ((uint32_t)1 << limited_size) - 1;
+		uint8_t bits_in_last_byte = bits_left & 7;
+		if (bits_in_last_byte)
+			bits[idx+whole_bytes] &= ~(((uint8_t)1 << bits_in_last_byte) - 1);
+	}
 
-				ProcessArrayItem(m, v);
+	// A report is accepted if it covers every mapped field, the rest of the
+	// declared report (constants, unmapped fields) may be missing.
+	void SelectiveInputReportParser::CompileMinSizes() {
+		for (ReportProgram& prog : _programs) {
+			uint32_t end = 0;
+			for (size_t i=prog.first_op,e=i+prog.num_ops; i<e; ++i) {
+				const FieldOp& op = _ops[i];
+				end = _hrp_max(end, op.bit_offset + (uint32_t)op.count * op.report_size);
 			}
+			prog.min_size = (end + 7) >> 3;
+			prog.short_reports = 0;
 		}
-		return 0;
 	}
 
-	void SelectiveInputReportParser::ReportFieldMapping::ProcessArrayItem(const ReportFieldMapping& m, uint32_t item) {
-		if (IsOutOfRange(item, m.logical_min, m.logical_max))
-			return;
-		item -= m.logical_min;
-		if (item == 0 && m.first_usage_is_zero)
-			return;
-
-		// I don't know why anyone would use IInt32Target to store bool values
-		// but we provide the implementation for the sake of completeness...
-		for (auto const& it : m.mappings.int32_values) {
-			for (const UsageIndexRange& r : it.second) {
-				if (item >= r.desc_min && item < r.desc_min + r.length) {
-					it.first[r.val_min + item - r.desc_min] = 1;
-					return;
+	// Selects the extractor of every op. Function pointers can't be stored
+	// in a blob so LoadBlob has to do this too. The extractors may read only
+	// the first min_size bytes of a report.
+	void SelectiveInputReportParser::LinkOps() {
+		for (const ReportProgram& prog : _programs) {
+			for (size_t i=prog.first_op,e=i+prog.num_ops; i<e; ++i) {
+				FieldOp& op = _ops[i];
+				switch (op.kind) {
+				case FieldOp::INT32_VAR: op.parse = FieldOp::SelectInt32Parser(op, prog.min_size * 8); break;
+				case FieldOp::BOOL_BITS: op.parse = FieldOp::ParseBoolBits; break;
+				case FieldOp::BOOL_INTS: op.parse = FieldOp::ParseBoolInts; break;
+				default:                 op.parse = nullptr; break;
 				}
 			}
 		}
+	}
 
-		for (auto const& it : m.mappings.bool_values) {
-			for (const UsageIndexRange& r : it.second) {
-				if (item >= r.desc_min && item < r.desc_min + r.length) {
-					size_t idx = r.val_min + item - r.desc_min;
-					it.first[idx >> 3] |= (uint8_t)(1 << (idx & 7));
-					return;
-				}
+	// Mapping blob layout: BlobHeader, BlobProgram[], BlobOp[], BlobArrayRange[]
+	// Target pointers are stored as (index into the targets array << 24) | byte offset.
+
+	static constexpr uint32_t BLOB_MAGIC = 0x43505248; // "HRPC"
+	static constexpr uint16_t BLOB_VERSION = 1;
+
+	struct BlobHeader {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t num_programs;
+		uint16_t num_ops;
+		uint16_t num_array_ranges;
+		uint8_t have_report_ids;
+		uint8_t reserved[3];
+	};
+
+	struct BlobProgram {
+		uint32_t bit_size;
+		uint16_t first_op;
+		uint16_t num_ops;
+		uint8_t report_id;
+		uint8_t reserved[3];
+	};
+
+	struct BlobOp {
+		uint32_t target;
+		uint32_t bit_offset;
+		int32_t logical_min;
+		int32_t logical_max;
+		uint16_t report_size;
+		uint16_t count;
+		uint16_t val_min;
+		uint16_t aux;
+		uint16_t num_aux;
+		uint8_t kind;
+		uint8_t flags;
+	};
+
+	struct BlobArrayRange {
+		uint32_t target;
+		uint16_t desc_min;
+		uint16_t val_min;
+		uint16_t length;
+		uint8_t is_bool;
+		uint8_t reserved;
+	};
+
+	static bool EncodeBlobTarget(const void* p, const SelectiveInputReportParser::BlobTarget* targets, size_t num_targets, uint32_t& out) {
+		for (size_t i=0; i<num_targets && i<0x100; ++i) {
+			const uint8_t* base = (const uint8_t*)targets[i].data;
+			if ((const uint8_t*)p >= base && (const uint8_t*)p < base + targets[i].size) {
+				size_t offset = (const uint8_t*)p - base;
+				if (offset > 0xffffff)
+					return false;
+				out = ((uint32_t)i << 24) | (uint32_t)offset;
+				return true;
 			}
 		}
+		return false;
 	}
 
-	int SelectiveInputReportParser::DescriptorMapper::MapFields(const void* descriptor, size_t descriptor_size) {
-		ResizeVectors(_root);
+	// Returns the target pointer if the first..first+count variables of the
+	// given type starting at the encoded location fit into the target (and
+	// the int32 variables are aligned).
+	static void* DecodeBlobTarget(uint32_t v, size_t first, size_t count, bool is_bool,
+		const SelectiveInputReportParser::BlobTarget* targets, size_t num_targets) {
+		size_t index = v >> 24;
+		size_t offset = v & 0xffffff;
+		if (index >= num_targets || offset > targets[index].size)
+			return nullptr;
+		// Parse stores the int32 variables with aligned writes.
+		if (!is_bool && (((uintptr_t)targets[index].data + offset) & (alignof(int32_t) - 1)))
+			return nullptr;
+		size_t end = is_bool ? offset + ((first + count + 7) >> 3) : offset + (first + count)*sizeof(int32_t);
+		if (end > targets[index].size)
+			return nullptr;
+		return (uint8_t*)targets[index].data + offset;
+	}
 
-		DescriptorParser dp;
-		int res = dp.Parse(descriptor, descriptor_size, this);
+	int SelectiveInputReportParser::SaveBlob(void* blob, size_t blob_size, const BlobTarget* targets, size_t num_targets) const {
+		if (_programs.empty())
+			return ERR_UNINITIALISED_PARSER;
+
+		size_t size = sizeof(BlobHeader) + _programs.size()*sizeof(BlobProgram) +
+			_ops.size()*sizeof(BlobOp) + _array_ranges.size()*sizeof(BlobArrayRange);
+		if (size > 0x7fffffff)
+			return ERR_UNSPECIFIED;
+		if (!blob)
+			return (int)size;
+		if (blob_size < size || !targets)
+			return ERR_INVALID_PARAMETERS;
+
+		uint8_t* p = (uint8_t*)blob;
+
+		BlobHeader h = {};
+		h.magic = BLOB_MAGIC;
+		h.version = BLOB_VERSION;
+		h.num_programs = (uint16_t)_programs.size();
+		h.num_ops = (uint16_t)_ops.size();
+		h.num_array_ranges = (uint16_t)_array_ranges.size();
+		h.have_report_ids = _have_report_ids;
+		memcpy(p, &h, sizeof(h));
+		p += sizeof(h);
+
+		for (const ReportProgram& prog : _programs) {
+			BlobProgram bp = {};
+			bp.bit_size = prog.bit_size;
+			bp.first_op = prog.first_op;
+			bp.num_ops = prog.num_ops;
+			bp.report_id = prog.report_id;
+			memcpy(p, &bp, sizeof(bp));
+			p += sizeof(bp);
+		}
+
+		for (const FieldOp& op : _ops) {
+			BlobOp bo = {};
+			if (op.kind != FieldOp::ARRAY && !EncodeBlobTarget(op.target, targets, num_targets, bo.target))
+				return ERR_INVALID_PARAMETERS;
+			bo.bit_offset = op.bit_offset;
+			bo.logical_min = op.logical_min;
+			bo.logical_max = op.logical_max;
+			bo.report_size = op.report_size;
+			bo.count = op.count;
+			bo.val_min = op.val_min;
+			bo.aux = op.aux;
+			bo.num_aux = op.num_aux;
+			bo.kind = op.kind;
+			// the interest belongs to the parser, not to the mapping
+			bo.flags = op.flags & ~FieldOp::FLAG_IDLE;
+			memcpy(p, &bo, sizeof(bo));
+			p += sizeof(bo);
+		}
+
+		for (const ArrayItemRange& ar : _array_ranges) {
+			BlobArrayRange ba = {};
+			if (!EncodeBlobTarget(ar.target, targets, num_targets, ba.target))
+				return ERR_INVALID_PARAMETERS;
+			ba.desc_min = ar.desc_min;
+			ba.val_min = ar.val_min;
+			ba.length = ar.length;
+			ba.is_bool = ar.is_bool;
+			memcpy(p, &ba, sizeof(ba));
+			p += sizeof(ba);
+		}
+
+		return (int)size;
+	}
+
+	int SelectiveInputReportParser::LoadBlob(const void* blob, size_t blob_size, const BlobTarget* targets, size_t num_targets, Arena* arena) {
+		Reset();
+		if (!blob || !targets)
+			return ERR_INVALID_PARAMETERS;
+
+		if (arena)
+			arena->ClearExhausted();
+		UseArena(arena);
+		return EndArenaInit(arena, LoadBlobMapping(blob, blob_size, targets, num_targets));
+	}
+
+	int SelectiveInputReportParser::LoadBlobMapping(const void* blob, size_t blob_size, const BlobTarget* targets, size_t num_targets) {
+
+		const uint8_t* p = (const uint8_t*)blob;
+
+		BlobHeader h;
+		if (blob_size < sizeof(h))
+			return ERR_INVALID_MAPPING_BLOB;
+		memcpy(&h, p, sizeof(h));
+		p += sizeof(h);
+
+		if (h.magic != BLOB_MAGIC || h.version != BLOB_VERSION || !h.num_programs ||
+			(!h.have_report_ids && h.num_programs != 1) ||
+			blob_size != sizeof(BlobHeader) + h.num_programs*sizeof(BlobProgram) +
+				h.num_ops*sizeof(BlobOp) + h.num_array_ranges*sizeof(BlobArrayRange))
+			return ERR_INVALID_MAPPING_BLOB;
+
+		_programs.resize(h.num_programs);
+		_ops.resize(h.num_ops);
+		_array_ranges.resize(h.num_array_ranges);
+
+		for (size_t i=0; i<h.num_programs; ++i) {
+			BlobProgram bp;
+			memcpy(&bp, p, sizeof(bp));
+			p += sizeof(bp);
+
+			ReportProgram& prog = _programs[i];
+			prog = {};
+			prog.bit_size = bp.bit_size;
+			prog.first_op = bp.first_op;
+			prog.num_ops = bp.num_ops;
+			prog.report_id = bp.report_id;
+
+			if ((size_t)bp.first_op + bp.num_ops > h.num_ops || (bp.bit_size & 7) ||
+				(i && bp.report_id <= _programs[i-1].report_id) ||
+				(h.have_report_ids && !bp.report_id)) {
+				Reset();
+				return ERR_INVALID_MAPPING_BLOB;
+			}
+		}
+
+		for (size_t i=0; i<h.num_ops; ++i) {
+			BlobOp bo;
+			memcpy(&bo, p, sizeof(bo));
+			p += sizeof(bo);
+
+			FieldOp& op = _ops[i];
+			op = {};
+			op.bit_offset = bo.bit_offset;
+			op.logical_min = bo.logical_min;
+			op.logical_max = bo.logical_max;
+			op.report_size = bo.report_size;
+			op.count = bo.count;
+			op.val_min = bo.val_min;
+			op.aux = bo.aux;
+			op.num_aux = bo.num_aux;
+			op.kind = bo.kind;
+			op.flags = bo.flags & ~FieldOp::FLAG_IDLE;
+
+			bool ok = op.report_size && op.report_size <= HRP_MAX_REPORT_SIZE && op.count;
+			switch (op.kind) {
+			case FieldOp::INT32_VAR:
+				// the target is already offset to variable val_min
+				op.target = DecodeBlobTarget(bo.target, 0, op.count, false, targets, num_targets);
+				ok = ok && op.target;
+				break;
+			case FieldOp::BOOL_BITS:
+			case FieldOp::BOOL_INTS:
+				op.target = DecodeBlobTarget(bo.target, op.val_min, op.count, true, targets, num_targets);
+				ok = ok && op.target;
+				break;
+			case FieldOp::ARRAY:
+				ok = ok && (size_t)op.aux + op.num_aux <= h.num_array_ranges;
+				break;
+			default:
+				ok = false;
+				break;
+			}
+			if (!ok) {
+				Reset();
+				return ERR_INVALID_MAPPING_BLOB;
+			}
+		}
+
+		for (size_t i=0; i<h.num_array_ranges; ++i) {
+			BlobArrayRange ba;
+			memcpy(&ba, p, sizeof(ba));
+			p += sizeof(ba);
+
+			ArrayItemRange& ar = _array_ranges[i];
+			ar.desc_min = ba.desc_min;
+			ar.val_min = ba.val_min;
+			ar.length = ba.length;
+			ar.is_bool = ba.is_bool != 0;
+			ar.target = DecodeBlobTarget(ba.target, ar.val_min, ar.length, ar.is_bool, targets, num_targets);
+			if (!ar.target) {
+				Reset();
+				return ERR_INVALID_MAPPING_BLOB;
+			}
+		}
+
+		// The ops mustn't read past the end of their report.
+		for (const ReportProgram& prog : _programs) {
+			for (size_t i=prog.first_op,e=i+prog.num_ops; i<e; ++i) {
+				const FieldOp& op = _ops[i];
+				if ((uint64_t)op.bit_offset + (uint64_t)op.count*op.report_size > prog.bit_size) {
+					Reset();
+					return ERR_INVALID_MAPPING_BLOB;
+				}
+			}
+		}
+
+		_have_report_ids = h.have_report_ids != 0;
+		CompileMinSizes();
+		LinkOps();
+
+		if (_have_report_ids) {
+			for (size_t i=0; i<_programs.size(); ++i)
+				_program_index[_programs[i].report_id] = (uint8_t)i;
+
+			int res = CompileResetLists();
+			if (res) {
+				Reset();
+				return res;
+			}
+		}
+		else {
+			memset(_program_index, 0, sizeof(_program_index));
+		}
+
+		CompileArrayLookups();
+		CompileDedup();
+		ApplyInterest();
+		return 0;
+	}
+
+	// Byte range of the variables written by an op or one of its array ranges.
+	struct TargetSpan {
+		const uint8_t* begin;
+		const uint8_t* end;
+	};
+
+	static TargetSpan Int32Span(const void* target, size_t count) {
+		const uint8_t* p = (const uint8_t*)target;
+		return { p, p + count*sizeof(int32_t) };
+	}
+
+	static TargetSpan BitSpan(const void* target, size_t first, size_t count) {
+		const uint8_t* p = (const uint8_t*)target;
+		return { p + (first >> 3), p + ((first + count + 7) >> 3) };
+	}
+
+	// Adds first..first+count of target to the watches of the program that
+	// starts at watches[first_watch], extending its run of the same target.
+	void SelectiveInputReportParser::AddWatch(size_t first_watch, const void* target, bool is_bool, size_t first, size_t count) {
+		for (size_t i=first_watch; i<_watches.size(); ++i) {
+			WatchRange& w = _watches[i];
+			if (w.target == target && w.is_bool == is_bool) {
+				size_t e = _hrp_max((size_t)w.first + w.count, first + count);
+				w.first = (uint16_t)_hrp_min((size_t)w.first, first);
+				w.count = (uint16_t)(e - w.first);
+				return;
+			}
+		}
+		_watches.push_back({ target, (uint16_t)first, (uint16_t)count, 0, is_bool });
+	}
+
+	// Collects the watches of every program from its resets and its ops, or
+	// only its active ops unless include_idle. Idle ops don't run so they
+	// can't change anything. Every op adds at most one watch, and a subset of
+	// the ops needs at most as many words of snapshot as all of them, so the
+	// vectors only grow when include_idle.
+	void SelectiveInputReportParser::CompileWatches(bool include_idle) {
+		size_t max_watches = _resets.size();
+		for (const FieldOp& op : _ops)
+			max_watches += op.kind == FieldOp::ARRAY ? op.num_aux : 1;
+		_watches.clear();
+		_watches.reserve(max_watches);
+
+		size_t snapshot_words = 0;
+		for (ReportProgram& prog : _programs) {
+			size_t first_watch = _watches.size();
+			for (size_t i=prog.first_reset,e=i+prog.num_resets; i<e; ++i) {
+				const ResetRange& rr = _resets[i];
+				const void* target = rr.is_bool ? rr.target : (const void*)((const int32_t*)rr.target - rr.val_min);
+				AddWatch(first_watch, target, rr.is_bool, rr.val_min, rr.length);
+			}
+			for (size_t i=prog.first_op,e=i+prog.num_ops; i<e; ++i) {
+				const FieldOp& op = _ops[i];
+				if ((op.flags & FieldOp::FLAG_IDLE) && !include_idle)
+					continue;
+				switch (op.kind) {
+				case FieldOp::INT32_VAR:
+					AddWatch(first_watch, (const int32_t*)op.target - op.val_min, false, op.val_min, op.count);
+					break;
+				case FieldOp::BOOL_BITS:
+				case FieldOp::BOOL_INTS:
+					AddWatch(first_watch, op.target, true, op.val_min, op.count);
+					break;
+				case FieldOp::ARRAY:
+					for (size_t k=op.aux,ke=k+op.num_aux; k<ke; ++k) {
+						const ArrayItemRange& ar = _array_ranges[k];
+						AddWatch(first_watch, ar.target, ar.is_bool, ar.val_min, ar.length);
+					}
+					break;
+				}
+			}
+			prog.first_watch = (uint16_t)first_watch;
+			prog.num_watches = (uint16_t)(_watches.size() - first_watch);
+
+			// The programs run one at a time so their copies can overlap.
+			size_t words = 0;
+			for (size_t i=first_watch; i<_watches.size(); ++i) {
+				_watches[i].snapshot_word = (uint16_t)words;
+				words += WatchWords(_watches[i]);
+			}
+			snapshot_words = _hrp_max(snapshot_words, words);
+		}
+
+		if (include_idle)
+			_watch_snapshot.assign(snapshot_words, 0);
+	}
+
+	// Words a watched run takes in _watch_snapshot.
+	size_t SelectiveInputReportParser::WatchWords(const WatchRange& w) {
+		if (w.is_bool)
+			return ((((w.first & 7) + w.count + 7) >> 3) + 3) >> 2;
+		return w.count;
+	}
+
+	void SelectiveInputReportParser::CompileDedup() {
+		// Collecting the variables written by each program.
+		arena_vector<arena_vector<TargetSpan>> spans(_programs.size(), ArenaAllocator<char>(_arena, false));
+		for (size_t p=0; p<_programs.size(); ++p) {
+			ReportProgram& prog = _programs[p];
+			prog.dedup = DEDUP_ALWAYS;
+			for (size_t i=prog.first_op,e=i+prog.num_ops; i<e; ++i) {
+				const FieldOp& op = _ops[i];
+				if (op.flags & FieldOp::FLAG_RELATIVE)
+					prog.dedup = DEDUP_NEVER;
+
+				switch (op.kind) {
+				case FieldOp::INT32_VAR:
+					spans[p].push_back(Int32Span(op.target, op.count));
+					break;
+				case FieldOp::BOOL_BITS:
+				case FieldOp::BOOL_INTS:
+					spans[p].push_back(BitSpan(op.target, op.val_min, op.count));
+					break;
+				case FieldOp::ARRAY:
+					for (size_t k=op.aux,ke=k+op.num_aux; k<ke; ++k) {
+						const ArrayItemRange& ar = _array_ranges[k];
+						if (ar.is_bool)
+							spans[p].push_back(BitSpan(ar.target, ar.val_min, ar.length));
+						else
+							spans[p].push_back(Int32Span((int32_t*)ar.target + ar.val_min, ar.length));
+					}
+					break;
+				}
+			}
+			if (prog.num_resets && prog.dedup == DEDUP_ALWAYS)
+				prog.dedup = DEDUP_SAME_ID;
+		}
+
+		for (size_t p=0; p<_programs.size(); ++p) {
+			if (_programs[p].dedup != DEDUP_ALWAYS)
+				continue;
+			for (size_t q=0; q<_programs.size() && _programs[p].dedup == DEDUP_ALWAYS; ++q) {
+				if (p == q)
+					continue;
+				for (const TargetSpan& a : spans[p]) {
+					for (const TargetSpan& b : spans[q]) {
+						if (a.begin < b.end && b.begin < a.end)
+							_programs[p].dedup = DEDUP_SAME_ID;
+					}
+				}
+			}
+		}
+
+		size_t words = 0;
+		for (ReportProgram& prog : _programs) {
+			prog.cache_valid = false;
+			prog.cache_word = (uint32_t)words;
+			if (prog.dedup != DEDUP_NEVER)
+				words += (prog.min_size + 3) >> 2;
+		}
+		_report_cache.assign(words, 0);
+
+		// Sized for every op so that ApplyInterest never has to allocate.
+		CompileWatches(true);
+	}
+
+	static bool SameAsCached(const uint32_t* cache, const uint8_t* report, size_t report_size) {
+		size_t words = report_size >> 2;
+		for (size_t i=0; i<words; ++i) {
+			uint32_t w;
+			memcpy(&w, report + i*4, sizeof(w));
+			if (w != cache[i])
+				return false;
+		}
+		size_t tail = report_size & 3;
+		if (tail) {
+			// the cache is zero padded after the last byte of the report
+			uint32_t w = 0;
+			memcpy(&w, report + words*4, tail);
+			if (w != cache[words])
+				return false;
+		}
+		return true;
+	}
+
+	static void MarkRange(SelectiveInputReportParser::ChangeMask& m, bool is_bool, size_t first, size_t count) {
+		size_t last_bit = is_bool ? 63 : 31;
+		size_t e = _hrp_min(first + count, last_bit + 1);
+		uint64_t bits = 0;
+		for (size_t i=first; i<e; ++i)
+			bits |= (uint64_t)1 << i;
+		if (first + count > last_bit)
+			bits |= (uint64_t)1 << last_bit;
+		if (is_bool)
+			m.bools |= bits;
+		else
+			m.int32s |= (uint32_t)bits;
+	}
+
+	// Copies a watched run into the snapshot.
+	void SelectiveInputReportParser::SaveWatch(const WatchRange& w, uint32_t* snapshot) {
+		if (w.is_bool)
+			memcpy(snapshot, (const uint8_t*)w.target + (w.first >> 3), ((w.first & 7) + w.count + 7) >> 3);
+		else
+			memcpy(snapshot, (const int32_t*)w.target + w.first, w.count * sizeof(int32_t));
+	}
+
+	// Compares a watched run with its copy taken before the program ran and
+	// records the changed variables in the ChangeMask and (if not nullptr)
+	// their transitions in events.
+	void SelectiveInputReportParser::DiffWatch(const WatchRange& w, const uint32_t* snapshot,
+			ChangeMask& m, InputEventQueue* events) {
+		if (!w.is_bool) {
+			const int32_t* values = (const int32_t*)w.target + w.first;
+			uint32_t changed = 0;
+			for (size_t i=0; i<w.count; ++i) {
+				int32_t old = (int32_t)snapshot[i];
+				int32_t now = values[i];
+				if (now != old) {
+					changed |= (uint32_t)1 << _hrp_min(w.first + i, (size_t)31);
+					if (events)
+						events->Int32Changed(w.first + i, old, now);
+				}
+			}
+			m.int32s |= changed;
+			return;
+		}
+
+		// Bits outside the run can't change so XOR-ing whole bytes is fine.
+		const uint8_t* bytes = (const uint8_t*)w.target + (w.first >> 3);
+		const uint8_t* copy = (const uint8_t*)snapshot;
+		size_t base = w.first & ~(size_t)7;
+		uint64_t changed = 0;
+		for (size_t i=0,e=((w.first & 7) + w.count + 7) >> 3; i<e; ++i) {
+			uint8_t now = bytes[i];
+			for (unsigned diff = now ^ copy[i]; diff; diff &= diff - 1) {
+				size_t bit = (size_t)__builtin_ctz(diff);
+				changed |= (uint64_t)1 << _hrp_min(base + i*8 + bit, (size_t)63);
+				if (events)
+					events->BoolChanged(base + i*8 + bit, (now >> bit) & 1);
+			}
+		}
+		m.bools |= changed;
+	}
+
+	// Resets the relative fields of the other report IDs (precomputed by
+	// CompileResetLists, empty without report IDs) and runs the ops.
+	void SelectiveInputReportParser::RunProgram(const ReportProgram& prog, const uint8_t* report) {
+		const FieldOp* ops = _ops.data();
+		const ArrayItemRange* ranges = _array_ranges.data();
+		const uint16_t* lookup = _array_lookup.data();
+
+		for (const ResetRange* rr = _resets.data() + prog.first_reset, *e = rr + prog.num_resets; rr < e; ++rr) {
+			if (rr->is_bool)
+				ClearBits((uint8_t*)rr->target, rr->val_min, rr->length);
+			else
+				memset(rr->target, 0, sizeof(int32_t)*rr->length);
+		}
+
+		for (const FieldOp* op = ops + prog.first_op, *e = op + prog.num_ops; op < e; ++op) {
+			if (op->flags & FieldOp::FLAG_IDLE)
+				continue;
+			if (op->kind == FieldOp::ARRAY)
+				FieldOp::ParseArray(*op, ranges, lookup, report);
+			else
+				op->parse(*op, report);
+		}
+	}
+
+	// RunProgram between a copy and a comparison of the program's watches,
+	// for the ChangeMask and the events. The ops run exactly as untracked.
+	void SelectiveInputReportParser::ParseTracked(const ReportProgram& prog, const uint8_t* report, ChangeMask& changed) {
+		const WatchRange* watches = _watches.data() + prog.first_watch;
+		uint32_t* snapshot = _watch_snapshot.data();
+
+		for (size_t i=0; i<prog.num_watches; ++i)
+			SaveWatch(watches[i], snapshot + watches[i].snapshot_word);
+
+		RunProgram(prog, report);
+
+		for (size_t i=0; i<prog.num_watches; ++i)
+			DiffWatch(watches[i], snapshot + watches[i].snapshot_word, changed, _events);
+	}
+
+	void SelectiveInputReportParser::SetInterest(const ChangeMask& interest) {
+		_interest = interest;
+		ApplyInterest();
+	}
+
+	// Flags the ops that write none of the variables in _interest as idle.
+	void SelectiveInputReportParser::ApplyInterest() {
+		for (FieldOp& op : _ops) {
+			ChangeMask writes = {};
+			switch (op.kind) {
+			case FieldOp::INT32_VAR:
+				MarkRange(writes, false, op.val_min, op.count);
+				break;
+			case FieldOp::BOOL_BITS:
+			case FieldOp::BOOL_INTS:
+				MarkRange(writes, true, op.val_min, op.count);
+				break;
+			case FieldOp::ARRAY:
+				for (size_t k=op.aux,ke=k+op.num_aux; k<ke; ++k) {
+					const ArrayItemRange& ar = _array_ranges[k];
+					MarkRange(writes, ar.is_bool, ar.val_min, ar.length);
+				}
+				break;
+			}
+
+			if (writes.Intersects(_interest))
+				op.flags &= ~FieldOp::FLAG_IDLE;
+			else
+				op.flags |= FieldOp::FLAG_IDLE;
+		}
+
+		// The cached reports were parsed with the old interest. Skipping a
+		// repeat of one would leave the newly interesting variables stale.
+		for (ReportProgram& prog : _programs)
+			prog.cache_valid = false;
+
+		CompileWatches(false);
+	}
+
+	int SelectiveInputReportParser::Parse(const void* report, size_t report_size, uint8_t report_id) {
+		return Parse(report, report_size, report_id, nullptr);
+	}
+
+	int SelectiveInputReportParser::Parse(const void* report, size_t report_size, uint8_t report_id, ChangeMask* changed) {
+		if (changed)
+			*changed = {};
+
+		if (!report || !report_size)
+			return ERR_INVALID_PARAMETERS;
+		if (_programs.empty())
+			return ERR_UNINITIALISED_PARSER;
+
+		const uint8_t* r = (const uint8_t*)report;
+
+		uint8_t prog_index = _program_index[report_id];
+		if (prog_index == NO_PROGRAM) {
+			_unknown_report_ids++;
+			return ERR_UNKNOWN_REPORT_ID;
+		}
+		ReportProgram* prog = &_programs[prog_index];
+
+		if (report_size < prog->min_size) {
+			prog->short_reports++;
+			return ERR_INVALID_REPORT_SIZE;
+		}
+
+		// Bytes past min_size can't change any of the mapped variables.
+		uint32_t* cache = nullptr;
+		if (prog->dedup != DEDUP_NEVER) {
+			cache = _report_cache.data() + prog->cache_word;
+			if (prog->cache_valid &&
+				(prog->dedup == DEDUP_ALWAYS || _last_program == prog_index) &&
+				SameAsCached(cache, r, prog->min_size)) {
+				_unchanged_reports++;
+				return ERR_REPORT_UNCHANGED;
+			}
+		}
+
+		if (changed || _events) {
+			ChangeMask unused = {};
+			ParseTracked(*prog, r, changed ? *changed : unused);
+			if (cache) {
+				memcpy(cache, r, prog->min_size);
+				prog->cache_valid = true;
+			}
+			_last_program = prog_index;
+			return 0;
+		}
+
+		RunProgram(*prog, r);
+
+		if (cache) {
+			memcpy(cache, r, prog->min_size);
+			prog->cache_valid = true;
+		}
+		_last_program = prog_index;
+		return 0;
+	}
+
+	size_t SelectiveInputReportParser::MinReportSize(uint8_t report_id) const {
+		uint8_t prog_index = _program_index[report_id];
+		if (_programs.empty() || prog_index == NO_PROGRAM)
+			return 0;
+		return _programs[prog_index].min_size;
+	}
+
+	int SelectiveInputReportParser::TruncateReport(uint8_t report_id, size_t size) {
+		if (_programs.empty())
+			return ERR_UNINITIALISED_PARSER;
+		uint8_t prog_index = _program_index[report_id];
+		if (prog_index == NO_PROGRAM)
+			return ERR_UNKNOWN_REPORT_ID;
+
+		// The ops of the programs follow each other in _ops so they can be
+		// compacted in place. An op of consecutive values (or array items)
+		// keeps the ones that fit.
+		uint32_t bit_size = (uint32_t)_hrp_min(size, (size_t)0xffffff) * 8;
+		size_t w = 0;
+		for (size_t p=0; p<_programs.size(); ++p) {
+			ReportProgram& prog = _programs[p];
+			size_t first = w;
+			for (size_t i=prog.first_op,e=i+prog.num_ops; i<e; ++i) {
+				FieldOp op = _ops[i];
+				if (p == prog_index) {
+					uint32_t fit = op.bit_offset < bit_size && op.report_size ? (bit_size - op.bit_offset) / op.report_size : 0;
+					if (fit < op.count)
+						op.count = (uint16_t)fit;
+					if (!op.count)
+						continue;
+				}
+				_ops[w++] = op;
+			}
+			prog.first_op = (uint16_t)first;
+			prog.num_ops = (uint16_t)(w - first);
+			if (p == prog_index)
+				prog.bit_size = _hrp_min(prog.bit_size, bit_size);
+		}
+		_ops.erase(_ops.begin() + w, _ops.end());
+
+		CompileMinSizes();
+		LinkOps();
+		if (_have_report_ids) {
+			_resets.clear();
+			int res = CompileResetLists();
+			if (res) {
+				Reset();
+				return res;
+			}
+		}
+		CompileDedup();
+		ApplyInterest();
+		// CompileDedup's temporary vectors, the mapping itself only shrank
+		if (_arena)
+			_arena->ReleaseScratch();
+		return 0;
+	}
+
+	uint32_t SelectiveInputReportParser::ShortReports(uint8_t report_id) const {
+		uint8_t prog_index = _program_index[report_id];
+		if (_programs.empty() || prog_index == NO_PROGRAM)
+			return 0;
+		return _programs[prog_index].short_reports;
+	}
+
+	void SelectiveInputReportParser::FieldOp::ResetValues(const FieldOp& op, const ArrayItemRange* ranges) {
+		switch (op.kind) {
+		case INT32_VAR:
+			memset(op.target, 0, sizeof(int32_t)*op.count);
+			break;
+		case BOOL_BITS:
+		case BOOL_INTS:
+			ClearBits((uint8_t*)op.target, op.val_min, op.count);
+			break;
+		case ARRAY:
+			for (const ArrayItemRange* r = ranges + op.aux, *e = r + op.num_aux; r < e; ++r) {
+				if (r->is_bool)
+					ClearBits((uint8_t*)r->target, r->val_min, r->length);
+				else
+					memset((int32_t*)r->target + r->val_min, 0, sizeof(int32_t)*r->length);
+			}
+			break;
+		}
+	}
+
+	static bool IsOutOfRange(int32_t v, int32_t logical_min, int32_t logical_max) {
+		return v < logical_min || v > logical_max;
+	}
+
+	static bool IsOutOfRange(uint32_t v, int32_t logical_min, int32_t logical_max) {
+		return v < (uint32_t)logical_min || v >(uint32_t)logical_max;
+	}
+
+	// From the HID specification:
+	//   If the host or the device receives an out-of-range value then
+	//   the current value for the respective control will not be modified.
+	// The exceptions are relative fields ("no change" is zero) and hat
+	// switches (out-of-range is the null state). For these Compile sets
+	// reset=true and reset_value is stored instead.
+
+	// signed int32_t value
+	static void SetInt32Value(int32_t& dest, int32_t v, int32_t logical_min, int32_t logical_max, bool reset, int32_t reset_value) {
+		if (IsOutOfRange(v, logical_min, logical_max)) {
+			if (reset) dest = reset_value;
+		}
+		else {
+			dest = v;
+		}
+	}
+
+	// unsigned uint32_t value
+	static void SetInt32Value(int32_t& dest, uint32_t v, int32_t logical_min, int32_t logical_max, bool reset, int32_t reset_value) {
+		if (IsOutOfRange(v, logical_min, logical_max)) {
+			if (reset) dest = reset_value;
+		}
+		else {
+			dest = (int32_t)v;
+		}
+	}
+
+	bool SelectiveInputReportParser::FieldOp::CoversFullRange(const FieldOp& op) {
+		if (op.report_size >= 32)
+			return false;
+		if (op.flags & FLAG_SIGNED) {
+			int64_t half = (int64_t)1 << (op.report_size - 1);
+			return op.logical_min <= -half && op.logical_max >= half - 1;
+		}
+		return op.logical_min <= 0 && op.logical_max >= ((int64_t)1 << op.report_size) - 1;
+	}
+
+	SelectiveInputReportParser::FieldOp::parse_func
+	SelectiveInputReportParser::FieldOp::SelectInt32Parser(const FieldOp& op, uint32_t report_bit_size) {
+		bool sign = (op.flags & FLAG_SIGNED) != 0;
+		bool check = !CoversFullRange(op);
+
+		if (op.flags & FLAG_BYTE_ALIGNED) {
+			switch (op.report_size) {
+			case 8:
+				if (sign) return check ? ParseAlignedInt32s<int8_t, true> : ParseAlignedInt32s<int8_t, false>;
+				return check ? ParseAlignedInt32s<uint8_t, true> : ParseAlignedInt32s<uint8_t, false>;
+			case 16:
+				if (sign) return check ? ParseAlignedInt32s<int16_t, true> : ParseAlignedInt32s<int16_t, false>;
+				return check ? ParseAlignedInt32s<uint16_t, true> : ParseAlignedInt32s<uint16_t, false>;
+			default:
+				return ParseInt32s;
+			}
+		}
+
+		if (op.report_size > 32)
+			return ParseInt32s;
+
+		// A value that starts at bit 7 of a byte still fits into a 32-bit
+		// window if it's at most 25 bits wide. The window of the last value
+		// mustn't reach past the end of the report.
+		bool word_load = HRP_LITTLE_ENDIAN && op.report_size <= 25 &&
+			((op.bit_offset + (uint32_t)(op.count - 1) * op.report_size) >> 3) + 4 <= (report_bit_size >> 3);
+
+		if (word_load) {
+			if (sign) return check ? ParseUnalignedInt32s<true, true, true> : ParseUnalignedInt32s<true, false, true>;
+			return check ? ParseUnalignedInt32s<false, true, true> : ParseUnalignedInt32s<false, false, true>;
+		}
+		if (sign) return check ? ParseUnalignedInt32s<true, true, false> : ParseUnalignedInt32s<true, false, false>;
+		return check ? ParseUnalignedInt32s<false, true, false> : ParseUnalignedInt32s<false, false, false>;
+	}
+
+	template <typename T, bool CHECK_RANGE>
+	void SelectiveInputReportParser::FieldOp::ParseAlignedInt32s(const FieldOp& op, const uint8_t* report) {
+		int32_t* dest = (int32_t*)op.target;
+		const uint8_t* p = report + (op.bit_offset >> 3);
+		bool reset = (op.flags & (FLAG_RELATIVE | FLAG_NULL_STATE)) != 0;
+		int32_t reset_value = (op.flags & FLAG_NULL_STATE) ? HAT_SWITCH_NULL : 0;
+
+		for (size_t i=0; i<op.count; ++i,p+=sizeof(T)) {
+			T v = (sizeof(T) == 1) ? (T)p[0] : (T)(p[0] | (p[1] << 8));
+			if (CHECK_RANGE) {
+				// int8_t/int16_t promote to int32_t, uint8_t/uint16_t to uint32_t
+				if (std::is_signed<T>::value)
+					SetInt32Value(dest[i], (int32_t)v, op.logical_min, op.logical_max, reset, reset_value);
+				else
+					SetInt32Value(dest[i], (uint32_t)v, op.logical_min, op.logical_max, reset, reset_value);
+			}
+			else {
+				dest[i] = v;
+			}
+		}
+	}
+
+	template <bool SIGNED, bool CHECK_RANGE, bool WORD_LOAD>
+	void SelectiveInputReportParser::FieldOp::ParseUnalignedInt32s(const FieldOp& op, const uint8_t* report) {
+		int32_t* dest = (int32_t*)op.target;
+		bool reset = (op.flags & (FLAG_RELATIVE | FLAG_NULL_STATE)) != 0;
+		int32_t reset_value = (op.flags & FLAG_NULL_STATE) ? HAT_SWITCH_NULL : 0;
+		size_t size = op.report_size;
+		uint32_t value_mask = size < 32 ? ((uint32_t)1 << size) - 1 : 0xffffffff;
+		// https://graphics.stanford.edu/~seander/bithacks.html#VariableSignExtend
+		uint32_t sign_mask = (uint32_t)1 << (size - 1);
+
+		for (size_t i=0,k=op.bit_offset; i<op.count; ++i,k+=size) {
+			uint8_t shift = (uint8_t)(k & 7);
+			size_t idx = k >> 3;
+
+			uint32_t v;
+			if (WORD_LOAD) {
+				uint32_t w;
+				memcpy(&w, &report[idx], sizeof(w));
+				v = w >> shift;
+			}
+			else {
+				// see ParseInt32s
+				uint8_t n = (uint8_t)((shift + size + 7) >> 3);
+				v = 0;
+				switch (n) {
+				case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
+				case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
+				case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
+				case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
+				case 1: v |= report[idx] >> shift;
+				}
+			}
+			v &= value_mask;
+
+			if (SIGNED) {
+				int32_t sv = (int32_t)((v ^ sign_mask) - sign_mask);
+				if (CHECK_RANGE)
+					SetInt32Value(dest[i], sv, op.logical_min, op.logical_max, reset, reset_value);
+				else
+					dest[i] = sv;
+			}
+			else {
+				if (CHECK_RANGE)
+					SetInt32Value(dest[i], v, op.logical_min, op.logical_max, reset, reset_value);
+				else
+					dest[i] = (int32_t)v;
+			}
+		}
+	}
+
+	void SelectiveInputReportParser::FieldOp::ParseInt32s(const FieldOp& op, const uint8_t* report) {
+		int32_t* dest = (int32_t*)op.target;
+		bool reset = (op.flags & (FLAG_RELATIVE | FLAG_NULL_STATE)) != 0;
+		int32_t reset_value = (op.flags & FLAG_NULL_STATE) ? HAT_SWITCH_NULL : 0;
+
+		if (op.flags & FLAG_BYTE_ALIGNED) {
+			// integer fields are often byte-aligned in HID descriptors
+			size_t size = op.report_size >> 3;
+			const uint8_t* p = report + (op.bit_offset >> 3);
+			if (op.flags & FLAG_SIGNED) {
+				for (size_t i=0; i<op.count; ++i,p+=size) {
+					int32_t v;
+					switch (size) {
+					case 1: v = (int8_t)p[0]; break;
+					case 2: v = (int16_t)((int16_t)p[0] | ((int16_t)p[1] << 8)); break;
+					case 3: v = (int32_t)((int16_t)p[0] | ((int16_t)p[1] << 8) | ((int32_t)(int8_t)p[2] << 16)); break;
+					default: v = (int32_t)((int32_t)p[0] | ((int32_t)p[1] << 8) | ((int32_t)p[2] << 16) | ((int32_t)p[3] << 24)); break;
+					}
+					SetInt32Value(dest[i], v, op.logical_min, op.logical_max, reset, reset_value);
+				}
+			}
+			else {
+				for (size_t i=0; i<op.count; ++i,p+=size) {
+					uint32_t v;
+					switch (size) {
+					case 1: v = p[0]; break;
+					case 2: v = p[0] | ((uint16_t)p[1] << 8); break;
+					case 3: v = p[0] | ((uint16_t)p[1] << 8) | ((uint32_t)p[2] << 16); break;
+					default: v = p[0] | ((uint16_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); break;
+					}
+					SetInt32Value(dest[i], v, op.logical_min, op.logical_max, reset, reset_value);
+				}
+			}
+			return;
+		}
+
+		size_t size = op.report_size;
+		size_t limited_size = _hrp_min(size, size_t(32));
+
+		// https://graphics.stanford.edu/~seander/bithacks.html#VariableSignExtend
+		int32_t mask = (op.flags & FLAG_SIGNED) ? (uint32_t)1 << (limited_size - 1) : 0;
+
+		for (size_t i=0,k=op.bit_offset; i<op.count; ++i,k+=size) {
+			uint8_t shift = (uint8_t)(k & 7);
+			size_t idx = k >> 3;
+
+			// n is the number of bytes in the report array that contain our report_size-bits long integer
+			// Example: A 10-bit integer may span 2 or 3 bytes. It spans 3 bytes only if the first bit
+			//          starts at the most significant bit of the first byte (in which case shift==7).
+			// An unaligned 32 bit integer spans 5 bytes but the HID specification clearly states that
+			// the maximum span is 4 bytes so 32 bit values can satisfy that only by being byte-aligned.
+			uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
+
+			uint32_t v = 0;
+			switch (n) {
+			case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
+			case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
+			case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
+			case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
+			case 1: v |= report[idx] >> shift;
+			}
+
+			// zero'ing the bits above position 'limited_size'
+			v &= ((uint32_t)1 << limited_size) - 1;
+
+			if (op.flags & FLAG_SIGNED) {
+				// sign-extending the limited_size-bits wide integer
+				int32_t sv = (int32_t)((v ^ mask) - mask);
+				SetInt32Value(dest[i], sv, op.logical_min, op.logical_max, reset, reset_value);
+			}
+			else {
+				SetInt32Value(dest[i], v, op.logical_min, op.logical_max, reset, reset_value);
+			}
+		}
+	}
+
+	void SelectiveInputReportParser::FieldOp::ParseBoolBits(const FieldOp& op, const uint8_t* report) {
+		// This is a bitfield that can be very long: up to HRP_MAX_REPORT_COUNT bits.
+		// A typical example to this is an NKRO gaming keyboard sending 100+
+		// keys but many other gaming- and simulation-related devices send
+		// the state of similarly high number of buttons in large bitfields.
+
+		// bit_copy_t must be an unsigned integral type that is at least 16 bits wide.
+		typedef size_t bit_copy_t;  // C99 standard: The bit width of size_t is not less than 16.
+		static_assert(sizeof(bit_copy_t)>=2 && sizeof(bit_copy_t)<=8, "the width of bit_copy_t must be between 16 and 64 bits");
+		static_assert((bit_copy_t)-1 > (bit_copy_t)0, "bit_copy_t must be unsigned");
+		// MAX_BLOCK_SIZE is the maximum number of bits we shift and move
+		// from the source to the destination in a bit_copy_t instance.
+		static constexpr size_t MAX_BLOCK_SIZE = sizeof(bit_copy_t) * 8 - 8;
+
+		uint8_t* bits = (uint8_t*)op.target;
+		size_t bits_remaining = op.count;
+		for (size_t i=op.val_min,k=op.bit_offset; bits_remaining; i+=MAX_BLOCK_SIZE,k+=MAX_BLOCK_SIZE) {
+			size_t block_size = _hrp_min(bits_remaining, MAX_BLOCK_SIZE);
+			bits_remaining -= block_size;
+
+			int8_t shift_src = (int8_t)(k & 7);
+			int8_t shift_dest = (int8_t)(i & 7);
+			// positive shift -> left shift
+			// negative shift -> right shift (by -shift number of bits)
+			int8_t shift = shift_dest - shift_src;
+
+			bit_copy_t mask = (((bit_copy_t)1 << block_size) - 1) << shift_dest;
+			bit_copy_t v = 0;
+			{
+				// source
+				size_t idx = k >> 3;
+				uint8_t n = (uint8_t)((shift_src + block_size + 7) >> 3);
+
+				if (shift == 0) {
+					switch (n) {
+					case 8: v |= (bit_copy_t)report[idx+7] << 56;
+					case 7: v |= (bit_copy_t)report[idx+6] << 48;
+					case 6: v |= (bit_copy_t)report[idx+5] << 40;
+					case 5: v |= (bit_copy_t)report[idx+4] << 32;
+					case 4: v |= (bit_copy_t)report[idx+3] << 24;
+					case 3: v |= (bit_copy_t)report[idx+2] << 16;
+					case 2: v |= (bit_copy_t)report[idx+1] << 8;
+					case 1: v |= (bit_copy_t)report[idx];
+					}
+				}
+				else {
+					switch (n) {
+					case 8: v |= (bit_copy_t)report[idx+7] << (56 + shift);
+					case 7: v |= (bit_copy_t)report[idx+6] << (48 + shift);
+					case 6: v |= (bit_copy_t)report[idx+5] << (40 + shift);
+					case 5: v |= (bit_copy_t)report[idx+4] << (32 + shift);
+					case 4: v |= (bit_copy_t)report[idx+3] << (24 + shift);
+					case 3: v |= (bit_copy_t)report[idx+2] << (16 + shift);
+					case 2: v |= (bit_copy_t)report[idx+1] << (8 + shift);
+					case 1: v |= (shift<0) ? ((bit_copy_t)report[idx] >> -shift) : ((bit_copy_t)report[idx] << shift);
+					}
+				}
+
+				v &= mask;
+			}
+
+			{
+				// destination
+				size_t idx = i >> 3;
+				uint8_t n = (uint8_t)((shift_dest + block_size + 7) >> 3);
+				mask = ~mask;
+
+				switch (n) {
+				case 8: bits[idx+7] = (sizeof(bit_copy_t)!=8 && n>8) ? (uint8_t)(v >> 56) : ((bits[idx+7] & (uint8_t)(mask >> 56)) | (uint8_t)(v >> 56));
+				case 7: bits[idx+6] = (sizeof(bit_copy_t)!=7 && n>7) ? (uint8_t)(v >> 48) : ((bits[idx+6] & (uint8_t)(mask >> 48)) | (uint8_t)(v >> 48));
+				case 6: bits[idx+5] = (sizeof(bit_copy_t)!=6 && n>6) ? (uint8_t)(v >> 40) : ((bits[idx+5] & (uint8_t)(mask >> 40)) | (uint8_t)(v >> 40));
+				case 5: bits[idx+4] = (sizeof(bit_copy_t)!=5 && n>5) ? (uint8_t)(v >> 32) : ((bits[idx+4] & (uint8_t)(mask >> 32)) | (uint8_t)(v >> 32));
+				case 4: bits[idx+3] = (sizeof(bit_copy_t)!=4 && n>4) ? (uint8_t)(v >> 24) : ((bits[idx+3] & (uint8_t)(mask >> 24)) | (uint8_t)(v >> 24));
+				case 3: bits[idx+2] = (sizeof(bit_copy_t)!=3 && n>3) ? (uint8_t)(v >> 16) : ((bits[idx+2] & (uint8_t)(mask >> 16)) | (uint8_t)(v >> 16));
+				case 2: bits[idx+1] = (sizeof(bit_copy_t)!=2 && n>2) ? (uint8_t)(v >> 8)  : ((bits[idx+1] & (uint8_t)(mask >> 8))  | (uint8_t)(v >> 8));
+				case 1: bits[idx] = (bits[idx] & (uint8_t)mask) | (uint8_t)v;
+				}
+			}
+		}
+	}
+
+	void SelectiveInputReportParser::FieldOp::ParseBoolInts(const FieldOp& op, const uint8_t* report) {
+		// This maps integer fields of the reports onto bool fields
+		// of the application. No one should do this in practice.
+
+		uint8_t* bits = (uint8_t*)op.target;
+		size_t size = op.report_size;
+		size_t limited_size = _hrp_min(size, size_t(32));
+
+		int32_t mask = (op.flags & FLAG_SIGNED) ? (uint32_t)1 << (limited_size - 1) : 0;
+
+		for (size_t i=op.val_min,e=op.val_min+op.count,k=op.bit_offset; i<e; ++i,k+=size) {
+			uint8_t shift = (uint8_t)(k & 7);
+			size_t idx = k >> 3;
+
+			uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
+			uint32_t v = 0;
+			switch (n) {
+			case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
+			case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
+			case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
+			case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
+			case 1: v |= report[idx] >> shift;
+			}
+
+			// zero'ing the bits above position 'limited_size'
+			v &= ((uint32_t)1 << limited_size) - 1;
+
+			bool out_of_range;
+			if (op.flags & FLAG_SIGNED) {
+				// sign-extending the limited_size-bits wide integer
+				int32_t sv = (int32_t)((v ^ mask) - mask);
+				out_of_range = IsOutOfRange(sv, op.logical_min, op.logical_max);
+			}
+			else {
+				out_of_range = IsOutOfRange(v, op.logical_min, op.logical_max);
+			}
+
+			if (!out_of_range) {
+				if (v)
+					bits[i >> 3] |= 1 << (i & 7);
+				else
+					bits[i >> 3] &= ~(1 << (i & 7));
+			}
+		}
+	}
+
+	template <typename F>
+	void SelectiveInputReportParser::FieldOp::ForEachArrayItem(const FieldOp& op, const uint8_t* report, F process) {
+		if (op.flags & FLAG_BYTE_ALIGNED) {
+			// integer fields are often byte-aligned in HID descriptors
+			size_t offset = op.bit_offset >> 3;
+			size_t size = op.report_size >> 3;
+
+			for (size_t i=offset,e=offset+op.count*size; i<e; i+=size) {
+				uint32_t v;
+				switch (size) {
+				case 1: v = report[i]; break;
+				case 2: v = report[i] | ((uint16_t)report[i+1] << 8); break;
+				case 3: v = report[i] | ((uint16_t)report[i+1] << 8) | ((uint32_t)report[i+2] << 16); break;
+				default: v = report[i] | ((uint16_t)report[i+1] << 8) | ((uint32_t)report[i+2] << 16) | ((uint32_t)report[i+3] << 24); break;
+				}
+
+				process(v);
+			}
+			return;
+		}
+
+		size_t size = op.report_size;
+		size_t limited_size = _hrp_min(size, size_t(32));
+
+		for (size_t i=op.bit_offset,e=op.bit_offset+op.count*size; i<e; i+=size) {
+			uint8_t shift = (uint8_t)(i & 7);
+			size_t idx = i >> 3;
+
+			// n is the number of bytes in the report array that contain our report_size-bits long integer
+			// (see ParseInt32s)
+			uint8_t n = (uint8_t)((shift + limited_size + 7) >> 3);
+
+			uint32_t v = 0;
+			switch (n) {
+			case 5: v |= (uint32_t)report[idx+4] << (32 - shift);
+			case 4: v |= (uint32_t)report[idx+3] << (24 - shift);
+			case 3: v |= (uint32_t)report[idx+2] << (16 - shift);
+			case 2: v |= (uint16_t)report[idx+1] << (8 - shift);
+			case 1: v |= report[idx] >> shift;
+			}
+
+			// zero'ing the bits above position 'limited_size'
+			v &= ((uint32_t)1 << limited_size) - 1;
+
+			process(v);
+		}
+	}
+
+	void SelectiveInputReportParser::FieldOp::ParseArray(const FieldOp& op, const ArrayItemRange* ranges, const uint16_t* lookup, const uint8_t* report) {
+		// Zeroing out the bitfields and the rest of the function will set only
+		// those bits that are referenced by the integer values found in the array.
+		ResetValues(op, ranges);
+
+		if (op.lookup_size) {
+			// See CompileArrayLookups. logical_min isn't negative here so
+			// items below it wrap around and fail the size check too.
+			uint8_t* bits = (uint8_t*)op.target;
+			const uint16_t* table = lookup + op.lookup_first;
+			uint32_t logical_min = (uint32_t)op.logical_min;
+			uint32_t table_size = op.lookup_size;
+			ForEachArrayItem(op, report, [=](uint32_t item) {
+				item -= logical_min;
+				if (item < table_size) {
+					// Unmapped items OR zero into the first byte instead of branching.
+					uint32_t entry = table[item];
+					bits[entry >> 4] |= (uint8_t)((entry & 1) << ((entry >> 1) & 7));
+				}
+			});
+			return;
+		}
+
+		ForEachArrayItem(op, report, [&](uint32_t item) {
+			ProcessArrayItem(op, ranges, item);
+		});
+	}
+
+	void SelectiveInputReportParser::FieldOp::ProcessArrayItem(const FieldOp& op, const ArrayItemRange* ranges, uint32_t item) {
+		if (IsOutOfRange(item, op.logical_min, op.logical_max))
+			return;
+		item -= op.logical_min;
+		if (item == 0 && (op.flags & FLAG_FIRST_USAGE_IS_ZERO))
+			return;
+
+		// I don't know why anyone would use IInt32Target to store bool values
+		// but we provide the implementation for the sake of completeness...
+		for (const ArrayItemRange* r = ranges + op.aux, *e = r + op.num_aux; r < e; ++r) {
+			if (item >= r->desc_min && item < (uint32_t)r->desc_min + r->length) {
+				size_t idx = r->val_min + item - r->desc_min;
+				if (r->is_bool)
+					((uint8_t*)r->target)[idx >> 3] |= (uint8_t)(1 << (idx & 7));
+				else
+					((int32_t*)r->target)[idx] = 1;
+				return;
+			}
+		}
+	}
+
+	int SelectiveInputReportParser::DescriptorMapper::MapFields(const void* descriptor, size_t descriptor_size) {
+		Prepare();
+
+		arena_vector<UsageRange> usage_range_spill(_scratch);
+		DescriptorParser dp(&usage_range_spill);
+		int res = dp.Parse(descriptor, descriptor_size, this);
 		if (res)
 			return res;
 
+		Finish();
+		return 0;
+	}
+
+	void SelectiveInputReportParser::DescriptorMapper::Finish() {
 		for (auto it=_mapping->begin(),eit=_mapping->end(); it!=eit;) {
 			// _mapping may contain empty entries because it is used not only to
 			// store mappings but also to track the bit positions inside the
@@ -1101,8 +2523,6 @@ namespace {
 			it->second.bit_size = (it->second.bit_size + 7) & ~7;
 			++it;
 		}
-
-		return 0;
 	}
 
 	void SelectiveInputReportParser::DescriptorMapper::ResizeVectors(Collection* c) {
@@ -1127,7 +2547,7 @@ namespace {
 		if (fp.report_type != ReportType::input)
 			return 0;
 
-		DescFieldMappings dfm;
+		DescFieldMappings dfm(_scratch);
 
 		if (_matched.empty()) {
 			// If the root collection doesn't have type and usages defined
@@ -1144,7 +2564,7 @@ namespace {
 			}
 		}
 		else {
-			std::vector<bool> matched_usage_indexes;
+			arena_vector<bool> matched_usage_indexes(_scratch);
 			if (fp.flags & FLAG_FIELD_VARIABLE)
 				matched_usage_indexes.resize(fp.globals->report_count);
 			else
@@ -1277,7 +2697,7 @@ namespace {
 		if (it != _collection_field_indexes.end())
 			return it->second;
 
-		FieldIndexes fi;
+		FieldIndexes fi(_scratch);
 		for (size_t i = 0, e = c->int32s.size(); i < e; ++i)
 			AddFieldIndexes(fi.int32_indexes, i, c->int32s[i]->usages);
 		for (size_t i = 0, e = c->bools.size(); i < e; ++i)
@@ -1332,10 +2752,12 @@ namespace {
 		bool _processed_all;
 	};
 
+	static constexpr uint32_t USAGE32_HAT_SWITCH = ((uint32_t)PAGE_GENERIC_DESKTOP << 16) | USAGE_HAT_SWITCH;
+
 	// Returns the number of found/mapped usage indexes or a negative error code.
 	int32_t SelectiveInputReportParser::DescriptorMapper::FindFieldUsagesInCollection(
 		Collection* c, const DescriptorParser::FieldParams& fp,
-		DescFieldMappings& dfm, std::vector<bool>* matched_usage_indexes) {
+		DescFieldMappings& dfm, arena_vector<bool>* matched_usage_indexes) {
 		FieldIndexes& fi = GetFieldIndexes(c);
 
 		// In case of an array field we have to iterate through all declared usages.
@@ -1375,7 +2797,7 @@ namespace {
 
 				Int32Fields& i32 = *c->int32s[it->second.field_index];
 				if (i32.target)
-					dfm.AddMapping(i32.target->Data(), index, it->second.usage_index);
+					dfm.AddMapping(i32.target->Data(), index, it->second.usage_index, usage32 == USAGE32_HAT_SWITCH);
 				i32.mapped[it->second.usage_index] = true;
 
 				Int32Fields::FieldProperties& props = i32.properties[it->second.usage_index];
@@ -10,6 +10,9 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <new>
+#include <atomic>
+#include <scoped_allocator>
 
 
 // The accepted max value of a REPORT_SIZE item in the descriptor.
@@ -44,13 +47,30 @@
 // A normal USAGE item is also counted as a range (with MIN and MAX set to the same value).
 // Most input devices have HID descriptors that can be parsed with a very low
 // HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM value (5 or less). However, some devices
-// may require a significantly higher value. Increasing the value of
-// HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM adds at least 6 bytes to the size of the
-// DescriptorParser class (which is the total memory usage of the descriptor parser).
+// may require a significantly higher value. Only the first
+// HRP_INLINE_USAGE_RANGES ranges are stored inside the DescriptorParser class,
+// the rest spill to the storage passed to the DescriptorParser constructor
+// (without that storage HRP_INLINE_USAGE_RANGES is the limit).
 #ifndef HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM
 #  define HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM 0x100
 #endif
 
+// The number of usage ranges per main item stored inside the DescriptorParser
+// class. Each one adds 6 bytes to the size of the class, which is usually
+// constructed on the stack.
+#ifndef HRP_INLINE_USAGE_RANGES
+#  define HRP_INLINE_USAGE_RANGES 16
+#endif
+
+// Array fields (keyboard keys, consumer controls) whose mapped items all go
+// into the same bitfield get a lookup table with one uint16_t per item value
+// so SelectiveInputReportParser::Parse doesn't have to search the usage
+// ranges for every item. Fields with more possible item values than this
+// (only counting values up to the highest mapped one) use the search instead.
+#ifndef HRP_MAX_ARRAY_LOOKUP_SIZE
+#  define HRP_MAX_ARRAY_LOOKUP_SIZE 0x400
+#endif
+
 // Maximum stack size for the PUSH/POP global items that save/restore the globals.
 // I have quite a few input devices and none of their HID descriptors use PUSH/POP,
 // it seems to be a rarely used feature. The Linux kernel also uses a stack size of 4.
@@ -162,6 +182,29 @@ namespace hid {
 	// failed to specify a USAGE_PAGE before reaching an INPUT, OUTPUT or
 	// FEATURE item.
 	static constexpr int ERR_UNDEFINED_USAGE_PAGE = -25;
+	// The report_id passed to SelectiveInputReportParser::Parse isn't declared
+	// by the report descriptor (or none of its fields could be mapped).
+	static constexpr int ERR_UNKNOWN_REPORT_ID = -26;
+	// Returned by SelectiveInputReportParser::Parse when the report is byte
+	// for byte identical to the previous report with the same report ID and
+	// parsing it again couldn't change any of the mapped variables. Like
+	// ERR_NOTHING_CHANGED this isn't really an error: the variables still
+	// hold the (unchanged) state and the application can skip processing them.
+	// Reports that contain relative fields are never skipped.
+	static constexpr int ERR_REPORT_UNCHANGED = -27;
+	// SelectiveInputReportParser::LoadBlob was given a blob that is corrupt,
+	// was saved by a different version of the library or doesn't fit the
+	// targets passed in.
+	static constexpr int ERR_INVALID_MAPPING_BLOB = -28;
+	// The Arena passed to SelectiveInputReportParser::Init is too small.
+	static constexpr int ERR_ARENA_EXHAUSTED = -29;
+
+	// Hat switches declare their neutral position as a value outside of
+	// logical_min..logical_max. The parser recognises USAGE_HAT_SWITCH fields
+	// at Init and stores this value in the mapped int32 variable when the
+	// device reports the null state. (Other fields keep their previous value
+	// when they receive an out-of-range value.)
+	static constexpr int32_t HAT_SWITCH_NULL = INT32_MIN;
 
 
 	// Usage page and usage ID constants copied from hut1_5.pdf:
@@ -1141,6 +1184,26 @@ namespace hid {
 	static constexpr uint16_t USAGE_CONSUMER_CONTACT_MISC = 0x0514;
 	// 0x0515-0xFFFF Reserved
 
+	// Digitizers Page (0x0D)
+
+	static constexpr uint16_t USAGE_DIGITIZERS_DIGITIZER = 0x01; // Collection(Application)
+	static constexpr uint16_t USAGE_DIGITIZERS_PEN = 0x02; // Collection(Application)
+	static constexpr uint16_t USAGE_DIGITIZERS_LIGHT_PEN = 0x03; // Collection(Application)
+	static constexpr uint16_t USAGE_DIGITIZERS_TOUCH_SCREEN = 0x04; // Collection(Application)
+	static constexpr uint16_t USAGE_DIGITIZERS_TOUCH_PAD = 0x05; // Collection(Application)
+	static constexpr uint16_t USAGE_DIGITIZERS_STYLUS = 0x20; // Collection(Logical/Physical)
+	static constexpr uint16_t USAGE_DIGITIZERS_FINGER = 0x22; // Collection(Logical)
+	static constexpr uint16_t USAGE_DIGITIZERS_TIP_PRESSURE = 0x30;
+	static constexpr uint16_t USAGE_DIGITIZERS_IN_RANGE = 0x32;
+	static constexpr uint16_t USAGE_DIGITIZERS_TOUCH = 0x33;
+	static constexpr uint16_t USAGE_DIGITIZERS_TIP_SWITCH = 0x42;
+	static constexpr uint16_t USAGE_DIGITIZERS_BARREL_SWITCH = 0x44;
+	static constexpr uint16_t USAGE_DIGITIZERS_ERASER = 0x45;
+	static constexpr uint16_t USAGE_DIGITIZERS_CONFIDENCE = 0x47;
+	static constexpr uint16_t USAGE_DIGITIZERS_CONTACT_IDENTIFIER = 0x51;
+	static constexpr uint16_t USAGE_DIGITIZERS_CONTACT_COUNT = 0x54;
+	static constexpr uint16_t USAGE_DIGITIZERS_SCAN_TIME = 0x56;
+
 
 	template <typename T>
 	const T& _hrp_min(const T& a, const T& b) {
@@ -1197,6 +1260,150 @@ namespace hid {
 	enum class ReportType : uint8_t { input = 0, output = 1, feature = 2, count = 3 };
 
 
+	// Arena is a fixed-size memory block supplied by the application that can
+	// be used by SelectiveInputReportParser::Init instead of the heap. The
+	// node based containers used while mapping the descriptor cause a lot of
+	// small allocations that fragment the heap of a microcontroller if the
+	// device is initialised again and again (e.g. on every reconnect).
+	//
+	// The compiled mapping (persistent) is allocated from the top of the
+	// block and the temporary data of Init (scratch) from the bottom, so the
+	// scratch allocations can be released in one step when Init returns.
+	// The parsers that use an arena must be Reset (or destroyed) before the
+	// arena is Cleared or destroyed.
+	class Arena {
+	public:
+		Arena(void* buffer, size_t size) : _buf((uint8_t*)buffer), _size(size) { Clear(); }
+
+		void Clear() {
+			_scratch_top = 0;
+			_persistent_bottom = _size;
+			_exhausted = false;
+		}
+
+		size_t Size() const { return _size; }
+		// Bytes allocated at the moment. After Init this is the size of the
+		// compiled mapping(s).
+		size_t Used() const { return _scratch_top + (_size - _persistent_bottom); }
+		// The highest Used() value since the construction of the arena. It
+		// includes the alignment padding of the persistent allocations, which
+		// only repeats in an arena that ends at the same alignment (make the
+		// buffer address and size multiples of 8).
+		size_t HighWaterMark() const { return _high_water_mark; }
+		// Set by the first allocation that doesn't fit. These allocations are
+		// served by the heap so nothing breaks but Init will fail with
+		// ERR_ARENA_EXHAUSTED. Init clears the flag when it starts.
+		bool Exhausted() const { return _exhausted; }
+		void ClearExhausted() { _exhausted = false; }
+
+		bool Contains(const void* p) const { return (const uint8_t*)p >= _buf && (const uint8_t*)p < _buf + _size; }
+
+		// Returns nullptr if the arena is exhausted.
+		void* Allocate(size_t size, size_t alignment, bool persistent) {
+			uintptr_t base = (uintptr_t)_buf;
+			if (persistent) {
+				if (size > _persistent_bottom - _scratch_top)
+					return Exhaust();
+				uintptr_t p = (base + _persistent_bottom - size) & ~(uintptr_t)(alignment - 1);
+				if (p < base + _scratch_top)
+					return Exhaust();
+				_persistent_bottom = p - base;
+				UpdateHighWaterMark();
+				return (void*)p;
+			}
+			uintptr_t p = (base + _scratch_top + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			if (p - base > _persistent_bottom || size > _persistent_bottom - (p - base))
+				return Exhaust();
+			_scratch_top = p - base + size;
+			UpdateHighWaterMark();
+			return (void*)p;
+		}
+
+		// Only the most recent allocation of each end is actually freed. This
+		// is enough to make a growing vector reuse its previous memory block.
+		void Deallocate(void* p, size_t size, bool persistent) {
+			if (persistent) {
+				if ((uint8_t*)p == _buf + _persistent_bottom)
+					_persistent_bottom = _hrp_min_size(_persistent_bottom + size, _size);
+			}
+			else if ((uint8_t*)p + size == _buf + _scratch_top) {
+				_scratch_top -= size;
+			}
+		}
+
+		// Frees all scratch allocations.
+		void ReleaseScratch() { _scratch_top = 0; }
+
+	private:
+		void* Exhaust() { _exhausted = true; return nullptr; }
+		void UpdateHighWaterMark() { if (Used() > _high_water_mark) _high_water_mark = Used(); }
+		static size_t _hrp_min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+		uint8_t* _buf;
+		size_t _size;
+		size_t _scratch_top;
+		size_t _persistent_bottom;
+		size_t _high_water_mark = 0;
+		bool _exhausted;
+	};
+
+	// Standard allocator that allocates from an Arena or from the heap if it
+	// has no arena. The library containers use it through arena_vector, etc...
+	// that pass the allocator to their items too.
+	template <typename T>
+	class ArenaAllocator {
+	public:
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_copy_assignment;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+
+		ArenaAllocator() {}
+		ArenaAllocator(Arena* arena, bool persistent) : _arena(arena), _persistent(persistent) {}
+		template <typename U>
+		ArenaAllocator(const ArenaAllocator<U>& o) : _arena(o.arena()), _persistent(o.persistent()) {}
+
+		T* allocate(size_t n) {
+			if (_arena) {
+				void* p = _arena->Allocate(n * sizeof(T), alignof(T), _persistent);
+				if (p)
+					return (T*)p;
+			}
+			return (T*)::operator new(n * sizeof(T));
+		}
+
+		void deallocate(T* p, size_t n) {
+			if (_arena && _arena->Contains(p))
+				_arena->Deallocate(p, n * sizeof(T), _persistent);
+			else
+				::operator delete(p);
+		}
+
+		Arena* arena() const { return _arena; }
+		bool persistent() const { return _persistent; }
+
+		template <typename U>
+		bool operator==(const ArenaAllocator<U>& o) const { return _arena == o.arena() && _persistent == o.persistent(); }
+		template <typename U>
+		bool operator!=(const ArenaAllocator<U>& o) const { return !(*this == o); }
+
+	private:
+		Arena* _arena = nullptr;
+		bool _persistent = false;
+	};
+
+	template <typename T>
+	using arena_allocator = std::scoped_allocator_adaptor<ArenaAllocator<T>>;
+	template <typename T>
+	using arena_vector = std::vector<T, arena_allocator<T>>;
+	template <typename K, typename V>
+	using arena_map = std::map<K, V, std::less<K>, arena_allocator<std::pair<const K, V>>>;
+	template <typename K, typename V>
+	using arena_multimap = std::multimap<K, V, std::less<K>, arena_allocator<std::pair<const K, V>>>;
+	template <typename K>
+	using arena_set = std::set<K, std::less<K>, arena_allocator<K>>;
+
+
 	// DescriptorParser parses a binary HID report descriptor and passes the
 	// parsed main items and their parameters to callback functions.
 	//
@@ -1320,11 +1527,108 @@ namespace hid {
 			virtual int EndCollection(uint32_t depth) { return 0; }
 		};
 
+		// Forwards the events of a single Parse call to several handlers so
+		// they can all process the descriptor without parsing it again.
+		// A handler that returns an error stops receiving events and its error
+		// code is stored in results[i] (zero for the rest of the handlers).
+		// The other handlers aren't affected so Parse doesn't return
+		// handler errors when used with an EventFanOut.
+		// The handlers receive the same FieldParams so they mustn't modify
+		// its usage_ranges.
+		class EventFanOut : public EventHandler {
+		public:
+			EventFanOut(EventHandler* const* handlers, int* results, size_t num_handlers);
+
+		protected:
+			int Field(const FieldParams& fp) override;
+			int Padding(ReportType rt, uint8_t report_id, uint32_t bit_size) override;
+			int BeginCollection(uint8_t collection_type, uint16_t usage_page, uint16_t usage, uint32_t depth) override;
+			int EndCollection(uint32_t depth) override;
+
+		private:
+			EventHandler* const* _handlers;
+			int* _results;
+			size_t _num_handlers;
+		};
+
+		// Records the events of a Parse call so they can be sent to other
+		// handlers later without parsing the descriptor again. Useful when the
+		// handlers that need the events are known only after parsing it.
+		class EventLog : public EventHandler {
+		public:
+			explicit EventLog(Arena* arena=nullptr)
+				: _events(ArenaAllocator<Event>(arena, false)),
+				_globals(ArenaAllocator<Globals>(arena, false)),
+				_usage_ranges(ArenaAllocator<UsageRange>(arena, false)) {}
+
+			void Clear() { _events.clear(); _globals.clear(); _usage_ranges.clear(); }
+			// Clears and also frees the memory.
+			void Release() {
+				_events = decltype(_events)(_events.get_allocator());
+				_globals = decltype(_globals)(_globals.get_allocator());
+				_usage_ranges = decltype(_usage_ranges)(_usage_ranges.get_allocator());
+			}
+
+			// Preallocates for a descriptor of the given size so Parse doesn't
+			// have to grow the vectors. Main items take at least 2 bytes and
+			// they are usually preceded by several global/local items.
+			void Reserve(size_t descriptor_size) {
+				_events.reserve(descriptor_size / 4);
+				_globals.reserve(descriptor_size / 8);
+				_usage_ranges.reserve(descriptor_size / 4);
+			}
+
+			// Returns the first nonzero value returned by the handler.
+			int Replay(EventHandler* handler) const;
+
+		protected:
+			int Field(const FieldParams& fp) override;
+			int Padding(ReportType rt, uint8_t report_id, uint32_t bit_size) override;
+			int BeginCollection(uint8_t collection_type, uint16_t usage_page, uint16_t usage, uint32_t depth) override;
+			int EndCollection(uint32_t depth) override;
+
+		private:
+			enum EventType : uint8_t { FIELD, PADDING, BEGIN_COLLECTION, END_COLLECTION };
+
+			struct Event {
+				EventType type;
+				uint8_t type_param;  // FIELD/PADDING: report type, BEGIN_COLLECTION: collection type
+				uint16_t flags;      // FIELD: field flags, PADDING: report_id, BEGIN_COLLECTION: usage_page
+				uint16_t usage;      // BEGIN_COLLECTION: usage
+				uint16_t num_usage_ranges;
+				uint32_t size;       // FIELD/PADDING: bit_size, BEGIN/END_COLLECTION: depth
+				uint32_t first_usage_range;
+				uint32_t globals;    // index into _globals
+			};
+
+			arena_vector<Event> _events;
+			// Consecutive fields usually share the same globals so these are stored only once.
+			arena_vector<Globals> _globals;
+			arena_vector<UsageRange> _usage_ranges;
+		};
+
+		// usage_range_spill receives the usage ranges of main items that declare
+		// more than HRP_INLINE_USAGE_RANGES of them. It is resized only when
+		// needed and can be shared by consecutive parsers.
+		explicit DescriptorParser(arena_vector<UsageRange>* usage_range_spill=nullptr) {
+			_locals.spill = usage_range_spill;
+		}
+
 		// DescriptorParser instances are reusable.
 		// You can call Parse more than once on the same instance.
 		int Parse(const void* descriptor, size_t descriptor_size, EventHandler* handler);
 
+		// Push-style parsing for descriptors that arrive in chunks (e.g. a GATT
+		// long read). Begin starts a new descriptor, Feed can be called with
+		// chunks of any size (items may be split between chunks) and End performs
+		// the checks of the end of the descriptor. Parse is Begin+Feed+End.
+		// After an error Feed and End keep returning that error.
+		void Begin(EventHandler* handler);
+		int Feed(const void* data, size_t size);
+		int End();
+
 	private:
+		int ParseItem(uint8_t prefix, const uint8_t* p_data);
 		int AssertMinMaxItemsAreMatched();
 		int ParseMainItems(uint8_t item, const uint8_t* p_data, uint8_t data_size, EventHandler* handler);
 		int AddField(ReportType rt, const uint8_t* p_data, uint8_t data_size, EventHandler* handler);
@@ -1336,11 +1640,20 @@ namespace hid {
 			static constexpr uint8_t FLAG_USAGE_MAX = 2;	// set after finding a USAGE_MAX, reset after finding the related USAGE_MIN
 			uint8_t flags;
 
+			static constexpr size_t INLINE_USAGE_RANGES = HRP_INLINE_USAGE_RANGES < HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM ?
+				HRP_INLINE_USAGE_RANGES : HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM;
+
 			_narrowest_unsigned_integer<HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM>::type num_usage_ranges;
-			UsageRange usage_ranges[HRP_MAX_USAGE_RANGES_PER_MAIN_ITEM];
+			// Points to inline_usage_ranges or into *spill.
+			UsageRange* usage_ranges;
+			arena_vector<UsageRange>* spill;
+			UsageRange inline_usage_ranges[INLINE_USAGE_RANGES];
 
+			// Only the count is reset, the ranges above num_usage_ranges are never read.
 			void Reset() {
-				memset(this, 0, sizeof(*this));
+				flags = 0;
+				num_usage_ranges = 0;
+				usage_ranges = inline_usage_ranges;
 			}
 
 			uint16_t FirstUsage() const {
@@ -1370,6 +1683,14 @@ namespace hid {
 
 		_narrowest_unsigned_integer<HRP_MAX_PUSH_POP_STACK_SIZE>::type _globals_stack_size;
 		Globals _global_stack[HRP_MAX_PUSH_POP_STACK_SIZE];
+
+		// Streaming state
+		EventHandler* _handler;
+		int _error;
+		// The beginning of an item split by the end of a chunk (a short item is at most 5 bytes).
+		uint8_t _pending[5];
+		uint8_t _pending_size;
+		uint32_t _long_item_bytes_left;
 	};
 
 
@@ -1564,6 +1885,26 @@ namespace hid {
 			return v;
 		}
 
+		// Calls f(bit_index) for every set bit in ascending order. Loads a
+		// 32-bit word at a time and skips zero words, so a mostly clear
+		// bitfield (e.g. the 256 keys of an NKRO keyboard with a few held
+		// down) costs BYTE_SIZE/4 loads plus a count-trailing-zeros per set
+		// bit instead of a test per bit.
+		template <typename F>
+		void ForEachSet(F&& f) const {
+			for (size_t w=0; w*4 < BYTE_SIZE; ++w) {
+				uint32_t v;
+				if (w*4 + 4 <= BYTE_SIZE && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+					memcpy(&v, bytes + w*4, 4);
+				else
+					v = Flags<uint32_t>(w);
+				while (v) {
+					f(w*32 + (size_t)__builtin_ctz(v));
+					v &= v - 1;
+				}
+			}
+		}
+
 		BitFieldRef<BIT_SIZE> Ref() {
 			return BitFieldRef<BIT_SIZE>(bytes);
 		}
@@ -1804,6 +2145,109 @@ namespace hid {
 	};
 
 
+	// Transitions of the mapped variables recorded by
+	// SelectiveInputReportParser::Parse (see SetEventQueue) in the order they
+	// happened: every bool that changed and every int32 that crossed one of
+	// the axis thresholds. A consumer that only looks at the variables every
+	// now and then can still see a short press that started and ended
+	// between two of its looks.
+	//
+	// The queue has a fixed capacity given by the caller's buffer. One task
+	// can Parse (produce) while another one Pops (consume) without locking.
+	// Events that don't fit are dropped and counted.
+	class InputEventQueue {
+	public:
+		static constexpr uint8_t EVENT_BUTTON_UP = 0;
+		static constexpr uint8_t EVENT_BUTTON_DOWN = 1;
+		static constexpr uint8_t EVENT_AXIS_BELOW = 2; // went from >= threshold to < threshold
+		static constexpr uint8_t EVENT_AXIS_ABOVE = 3; // went from < threshold to >= threshold
+
+		struct Event {
+			// The index of the variable within its target, the same as in the
+			// SelectiveInputReportParser::ChangeMask but not limited to 31/63.
+			uint16_t index;
+			uint8_t type;
+			// EVENT_AXIS_* only: the return value of AddAxisThreshold.
+			uint8_t threshold;
+		};
+
+		static constexpr size_t MAX_AXIS_THRESHOLDS = 8;
+
+		// capacity has to be a power of two.
+		InputEventQueue(Event* buffer, size_t capacity) : _buf(buffer), _mask((uint32_t)capacity - 1) {
+			assert(capacity && (capacity & (capacity - 1)) == 0);
+		}
+
+		// Returns the index of the new threshold or -1 if there are already
+		// MAX_AXIS_THRESHOLDS. An int32 can have more than one threshold
+		// (e.g. both ends of a stick's deadzone). The thresholds mustn't be
+		// changed concurrently with Parse.
+		int AddAxisThreshold(uint16_t index, int32_t value) {
+			if (_num_thresholds >= MAX_AXIS_THRESHOLDS)
+				return -1;
+			_thresholds[_num_thresholds] = { value, index };
+			return _num_thresholds++;
+		}
+		void ClearAxisThresholds() { _num_thresholds = 0; }
+
+		// Consumer side.
+		bool Pop(Event& e) {
+			uint32_t head = _head.load(std::memory_order_relaxed);
+			if (head == _tail.load(std::memory_order_acquire))
+				return false;
+			e = _buf[head & _mask];
+			_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+		// Number of events dropped because the queue was full.
+		uint32_t Dropped() const { return _dropped.load(std::memory_order_relaxed); }
+		// Drops the queued events. Not while the parser may push.
+		void Clear() {
+			_head.store(_tail.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			_dropped.store(0, std::memory_order_relaxed);
+		}
+
+		// Producer side, called by the parser for every changed variable.
+		void BoolChanged(size_t index, bool value) {
+			Push({ (uint16_t)index, value ? EVENT_BUTTON_DOWN : EVENT_BUTTON_UP, 0 });
+		}
+		void Int32Changed(size_t index, int32_t prev, int32_t value) {
+			for (uint8_t i=0; i<_num_thresholds; ++i) {
+				const Threshold& t = _thresholds[i];
+				if (t.index != index)
+					continue;
+				bool above = value >= t.value;
+				if (above != (prev >= t.value))
+					Push({ (uint16_t)index, above ? EVENT_AXIS_ABOVE : EVENT_AXIS_BELOW, i });
+			}
+		}
+
+	private:
+		void Push(const Event& e) {
+			uint32_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail - _head.load(std::memory_order_acquire) > _mask) {
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			_buf[tail & _mask] = e;
+			_tail.store(tail + 1, std::memory_order_release);
+		}
+
+		struct Threshold {
+			int32_t value;
+			uint16_t index;
+		};
+
+		Event* _buf;
+		uint32_t _mask;
+		std::atomic<uint32_t> _head { 0 };
+		std::atomic<uint32_t> _tail { 0 };
+		std::atomic<uint32_t> _dropped { 0 };
+		Threshold _thresholds[MAX_AXIS_THRESHOLDS];
+		uint8_t _num_thresholds = 0;
+	};
+
+
 	// SelectiveInputParser tries to find specific fields in input reports and
 	// extract them by ignoring everything else. The field values are parsed into
 	// variables you define for your application with the help of the Collection,
@@ -1823,11 +2267,56 @@ namespace hid {
 		// Returns zero (ERR_SUCCESS) on success.
 		// Returns ERR_COULD_NOT_MAP_ANY_USAGES if none of the descriptor fields
 		// can be mapped to the int32 and bool variables of your program.
-		int Init(Collection* input_fields, const void* descriptor, size_t descriptor_size);
+		//
+		// With an arena Init allocates everything (the temporary data and the
+		// compiled mapping) from the arena instead of the heap and returns
+		// ERR_ARENA_EXHAUSTED if it's too small. Only the 'properties' and
+		// 'mapped' vectors of the Int32Fields/BoolFields of your config are
+		// allocated on the heap, and only if their capacity is too small (so
+		// reusing a config object avoids those allocations too). Parse doesn't
+		// allocate memory. The arena must outlive the mapping (until the next
+		// Reset/Init/LoadBlob or the destruction of the parser).
+		int Init(Collection* input_fields, const void* descriptor, size_t descriptor_size, Arena* arena=nullptr);
+
+		// Detects the device types (like detect_common_input_device_type) and
+		// initialises the parsers of the applicable mapping configs (e.g. a
+		// mouse and/or a gamepad config) with a single pass over the
+		// descriptor. The parser events are recorded and replayed only to the
+		// mappers of the requests that match the detected device types.
+		struct InitRequest {
+			SelectiveInputReportParser* parser;
+			Collection* input_fields;
+			// Zero or a combination of FLAG_KEYBOARD,etc... flags. If nonzero
+			// then the request is skipped with ERR_COULD_NOT_MAP_ANY_USAGES
+			// unless one of these device types has been detected.
+			uint8_t device_types;
+			// The return value Init would have returned for this request.
+			int result;
+		};
+
+		// Returns nonzero only if the descriptor itself is invalid. In that
+		// case all parsers are reset and all results are set to the error.
+		// The parsers can share the arena.
+		// See InitMultipleStream for descriptors that arrive in chunks.
+		static int InitMultiple(InitRequest* requests, size_t num_requests, const void* descriptor,
+			size_t descriptor_size, uint8_t* detected_device_types=nullptr, Arena* arena=nullptr);
 
-		// Reset removes any mapping configuration created by Init.
+		// Reset removes any mapping configuration created by Init and frees
+		// its memory.
 		void Reset() {
-			_mapping.clear();
+			_programs = decltype(_programs)();
+			_ops = decltype(_ops)();
+			_array_ranges = decltype(_array_ranges)();
+			_array_lookup = decltype(_array_lookup)();
+			_resets = decltype(_resets)();
+			_report_cache = decltype(_report_cache)();
+			_watches = decltype(_watches)();
+			_watch_snapshot = decltype(_watch_snapshot)();
+			_arena = nullptr;
+			memset(_program_index, NO_PROGRAM, sizeof(_program_index));
+			_unknown_report_ids = 0;
+			_unchanged_reports = 0;
+			_last_program = NO_PROGRAM;
 		}
 
 		// If Parse returns zero (ERR_SUCCESS) you have to process the mapped
@@ -1851,51 +2340,346 @@ namespace hid {
 		// of four bytes (all of them are zeros). Occasionally it sends zero
 		// sized reports too. The mouse still works perfectly with all major
 		// desktop operating systems because they seem to forgive these errors.
+		//
+		// Reports with a report_id that has no mapped fields are rejected with
+		// ERR_UNKNOWN_REPORT_ID and counted by UnknownReportIDs. If the
+		// descriptor doesn't use report IDs at all then report_id is ignored.
+		//
+		// The report has to be at least MinReportSize bytes long: the part of
+		// the declared report that contains the mapped fields. Longer reports
+		// (e.g. padded by the transport) are parsed as usual and the extra
+		// bytes are ignored. Shorter ones are rejected with
+		// ERR_INVALID_REPORT_SIZE and counted by ShortReports.
+		//
+		// A report that is identical to the previous one with the same report_id
+		// returns ERR_REPORT_UNCHANGED without touching the variables.
 		int Parse(const void* report, size_t report_size, uint8_t report_id=0);
 
-        int NumMappings() { return _mapping.size(); }
+		// Identifies the mapped variables whose value was changed by a Parse
+		// call. Bit i of int32s/bools is set if variable i of an IInt32Target
+		// or IBoolTarget has changed. With more than one target of the same
+		// type their indexes share the bits. Indexes past the last bit are
+		// reported in the last bit.
+		struct ChangeMask {
+			uint32_t int32s;
+			uint64_t bools;
+
+			bool Any() const { return int32s != 0 || bools != 0; }
+			bool Int32(size_t index) const { return (int32s >> _hrp_min_index(index, 31)) & 1; }
+			bool Bool(size_t index) const { return (bools >> _hrp_min_index(index, 63)) & 1; }
+			void Merge(const ChangeMask& o) { int32s |= o.int32s; bools |= o.bools; }
+			bool Intersects(const ChangeMask& o) const { return (int32s & o.int32s) != 0 || (bools & o.bools) != 0; }
+
+			static size_t _hrp_min_index(size_t index, size_t last) { return index < last ? index : last; }
+		};
+
+		// Same as the other Parse but also fills in *changed. A zero mask
+		// (including any nonzero return value) means that none of the mapped
+		// variables has changed. The variables the report can write are
+		// copied before and compared after parsing it, which costs a bit so
+		// use the other Parse if you process all of your variables anyway.
+		int Parse(const void* report, size_t report_size, uint8_t report_id, ChangeMask* changed);
+
+		// Restricts Parse to the fields that write at least one of the
+		// variables in the interest mask (the same indexes as in the mask
+		// filled in by Parse). The fields of the other variables aren't
+		// extracted at all so they keep their last value and are never
+		// reported as changed. A field that maps onto several variables is
+		// parsed as a whole if any of them is interesting.
+		// Everything is parsed by default. The interest is kept by Init,
+		// LoadBlob and Reset. Setting it costs one pass over the compiled
+		// fields so it can be changed e.g. whenever the consumer switches
+		// between modes, but not concurrently with Parse.
+		void SetInterest(const ChangeMask& interest);
+		const ChangeMask& Interest() const { return _interest; }
+
+		// Every Parse call pushes the transitions of the variables it has
+		// written into the queue (nullptr to stop). This costs as much as
+		// the ChangeMask (Parse takes the same path with or without it).
+		// A variable that a report zeroes and sets back to its old value
+		// (a relative field of another report ID) has no transition. The
+		// queue isn't owned by the parser and is kept by Init, LoadBlob and
+		// Reset.
+		void SetEventQueue(InputEventQueue* events) { _events = events; }
+
+		// A compiled mapping can be saved into a compact blob and loaded back
+		// later without parsing the descriptor again, e.g. to speed up the
+		// reconnection of a known device. The blob contains no pointers: each
+		// mapped variable is stored as an index into the targets array plus a
+		// byte offset, so LoadBlob has to receive the same targets in the same
+		// order as SaveBlob. A blob is valid only with the same descriptor,
+		// mapping config and version of this library.
+		struct BlobTarget {
+			void* data;   // the Data() of an IInt32Target/IBoolTarget
+			size_t size;  // in bytes
+		};
+
+		// Returns the size of the blob or a negative error code.
+		// Call it with blob=nullptr to query the required size.
+		int SaveBlob(void* blob, size_t blob_size, const BlobTarget* targets, size_t num_targets) const;
+		// Replaces the current mapping with the one in the blob. The blob is
+		// validated against the targets so a corrupt one is rejected with
+		// ERR_INVALID_MAPPING_BLOB. The target variables aren't reset.
+		// The arena is used the same way as by Init.
+		int LoadBlob(const void* blob, size_t blob_size, const BlobTarget* targets, size_t num_targets, Arena* arena=nullptr);
+
+		int NumMappings() { return (int)_programs.size(); }
+		// Number of reports rejected with ERR_UNKNOWN_REPORT_ID since Init.
+		uint32_t UnknownReportIDs() const { return _unknown_report_ids; }
+		// Number of reports skipped with ERR_REPORT_UNCHANGED since Init.
+		uint32_t UnchangedReports() const { return _unchanged_reports; }
+		// The shortest report (in bytes, not including the report_id byte)
+		// accepted with the given report_id, zero if it has no mapped fields.
+		size_t MinReportSize(uint8_t report_id) const;
+		// Drops the mapped values of report_id that don't fit into the first
+		// size bytes of the report, for devices whose descriptor declares a
+		// longer report than what they send. MinReportSize shrinks to match.
+		// Call it after Init (or LoadBlob), not concurrently with Parse. A
+		// saved blob contains the truncated mapping.
+		int TruncateReport(uint8_t report_id, size_t size);
+		// Number of reports with the given report_id rejected with
+		// ERR_INVALID_REPORT_SIZE since Init.
+		uint32_t ShortReports(uint8_t report_id) const;
 	private:
+		friend class InitMultipleStream;
 		struct ReportFieldMapping;
 		struct UsageIndexRange;
 		struct DescFieldMappings;
 		class DescriptorMapper;
 
 		// Mapping between input report fields and the program's int32/bool variables.
+		// This is the intermediate result of the DescriptorMapper. Init compiles
+		// it into the flat FieldOp array below and throws it away.
 		struct ReportMapper {
+			typedef arena_allocator<ReportFieldMapping> allocator_type;
+			explicit ReportMapper(const allocator_type& a) : fields(a) {}
+
 			// report size in bits not including the report_id byte if present
 			uint32_t bit_size = 0;
-			std::vector<ReportFieldMapping> fields;
+			arena_vector<ReportFieldMapping> fields;
 		};
 
 		// key: report_id
 		// the zero report_id belongs to structs that don't have a report_id
-		typedef std::map<uint8_t, ReportMapper> mapping_t;
-		mapping_t _mapping;
+		typedef arena_map<uint8_t, ReportMapper> mapping_t;
+
+		// An array field maps a range of item values onto a range of int32 or
+		// bool variables. One array FieldOp owns one or more of these.
+		struct ArrayItemRange {
+			void* target;       // int32_t* or uint8_t* (bitfield)
+			uint16_t desc_min;  // first item value (relative to logical_min)
+			uint16_t val_min;   // first index into the target
+			uint16_t length;
+			bool is_bool;
+		};
+
+		// FieldOp is a single fixed-size extraction step of a compiled report
+		// program. Parse executes the ops of a report ID one after the other
+		// without touching the mapping config or any node based container.
+		struct FieldOp {
+			enum Kind : uint8_t {
+				INT32_VAR,    // count integers -> int32_t target[0..count)
+				BOOL_BITS,    // 1-bit variable fields -> bits [val_min..val_min+count)
+				BOOL_INTS,    // wider variable fields -> bits [val_min..val_min+count)
+				ARRAY,        // array field -> ArrayItemRange[aux..aux+num_aux)
+			};
+
+			static constexpr uint8_t FLAG_RELATIVE = 0x01;
+			static constexpr uint8_t FLAG_SIGNED = 0x02;              // logical_min is below zero
+			static constexpr uint8_t FLAG_BYTE_ALIGNED = 0x04;        // bit_offset and report_size are a multiple of 8
+			static constexpr uint8_t FLAG_FIRST_USAGE_IS_ZERO = 0x08; // used only in case of array fields
+			static constexpr uint8_t FLAG_NULL_STATE = 0x10;          // hat switch: out-of-range -> HAT_SWITCH_NULL
+			static constexpr uint8_t FLAG_IDLE = 0x20;                // writes nothing in _interest, skipped by Parse
+
+			// int32_t* (already offset to the first mapped variable) or the
+			// uint8_t* base of a bitfield. ARRAY ops with a lookup table: the
+			// bitfield of all of their ranges.
+			void* target;
+			// offset of the first value within the report not including the
+			// report_id byte if present
+			uint32_t bit_offset;
+			int32_t logical_min;
+			int32_t logical_max;
+			uint16_t report_size;
+			// number of consecutive values (report_count in case of ARRAY ops)
+			uint16_t count;
+			// index of the first variable within the target (the first bit
+			// index in case of BOOL_* targets)
+			uint16_t val_min;
+			// ARRAY ops only: index of the first ArrayItemRange and their number
+			uint16_t aux;
+			uint16_t num_aux;
+			// ARRAY ops only: _array_lookup[lookup_first..lookup_first+lookup_size)
+			// maps item values (relative to logical_min) to bits of target.
+			// Zero lookup_size means no lookup table.
+			uint16_t lookup_first;
+			uint16_t lookup_size;
+			uint8_t kind;
+			uint8_t flags;
+
+			// The extractor picked by Compile for this op. Unused by ARRAY ops.
+			typedef void (*parse_func)(const FieldOp& op, const uint8_t* report);
+			parse_func parse;
+
+			static parse_func SelectInt32Parser(const FieldOp& op, uint32_t report_bit_size);
+			static bool CoversFullRange(const FieldOp& op);
+
+			// Specialised INT32_VAR extractors. CHECK_RANGE=false is used only
+			// if the logical range covers every value of the field's bit width.
+			template <typename T, bool CHECK_RANGE>
+			static void ParseAlignedInt32s(const FieldOp& op, const uint8_t* report);
+			// WORD_LOAD reads each value with a single little endian 32-bit
+			// load (report_size <= 25 and the load stays within the report).
+			template <bool SIGNED, bool CHECK_RANGE, bool WORD_LOAD>
+			static void ParseUnalignedInt32s(const FieldOp& op, const uint8_t* report);
+
+			// Generic INT32_VAR extractor for everything else.
+			static void ParseInt32s(const FieldOp& op, const uint8_t* report);
+			static void ParseBoolBits(const FieldOp& op, const uint8_t* report);
+			static void ParseBoolInts(const FieldOp& op, const uint8_t* report);
+			// Calls process(item) with the unsigned value of each item of an array field.
+			template <typename F>
+			static void ForEachArrayItem(const FieldOp& op, const uint8_t* report, F process);
+			static void ParseArray(const FieldOp& op, const ArrayItemRange* ranges, const uint16_t* lookup, const uint8_t* report);
+			static void ProcessArrayItem(const FieldOp& op, const ArrayItemRange* ranges, uint32_t item);
+			static void ResetValues(const FieldOp& op, const ArrayItemRange* ranges);
+		};
+
+		// The compiled ops of one report ID: _ops[first_op..first_op+num_ops)
+		struct ReportProgram {
+			// report size in bits not including the report_id byte if present
+			uint32_t bit_size;
+			// bytes up to the end of the last mapped field, see MinReportSize
+			uint32_t min_size;
+			// reports rejected for being shorter than min_size
+			uint32_t short_reports;
+			uint16_t first_op;
+			uint16_t num_ops;
+			// _resets[first_reset..first_reset+num_resets)
+			uint16_t first_reset;
+			uint16_t num_resets;
+			uint8_t report_id;
+			// DEDUP_* policy for skipping reports identical to the cached one
+			uint8_t dedup;
+			bool cache_valid;
+			// index of the last report's bytes in _report_cache
+			uint32_t cache_word;
+			// _watches[first_watch..first_watch+num_watches)
+			uint16_t first_watch;
+			uint16_t num_watches;
+		};
+
+		// The report is parsed every time (it has relative fields).
+		static constexpr uint8_t DEDUP_NEVER = 0;
+		// An identical report can be skipped only if the previous parsed report
+		// had the same ID. Other report IDs may have written the same
+		// variables or need their relative fields zeroed by this one.
+		static constexpr uint8_t DEDUP_SAME_ID = 1;
+		// No other report ID shares variables with this one.
+		static constexpr uint8_t DEDUP_ALWAYS = 2;
+
+		// A run of relative variables that has to be zeroed before a report is
+		// parsed because it belongs to another report ID.
+		struct ResetRange {
+			void* target;       // int32_t* (already offset) or uint8_t* (bitfield)
+			uint16_t val_min;   // first bit index for bitfields, first int32 index otherwise
+			uint16_t length;
+			bool is_bool;
+
+			bool operator==(const ResetRange& o) const {
+				return target == o.target && val_min == o.val_min && length == o.length && is_bool == o.is_bool;
+			}
+		};
+
+		// The variables that the resets and active ops of a program write,
+		// merged into one run per target and type. The tracked Parse copies
+		// them into _watch_snapshot before running the program and compares
+		// them after it. Rebuilt by ApplyInterest.
+		struct WatchRange {
+			const void* target; // int32_t* (not offset) or uint8_t* (bitfield)
+			uint16_t first;     // first int32 or bit index
+			uint16_t count;
+			uint16_t snapshot_word; // where the copy starts in _watch_snapshot
+			bool is_bool;
+		};
+
+		int Compile(const mapping_t& mapping);
+		int CompileResetLists();
+		void RunProgram(const ReportProgram& prog, const uint8_t* report);
+		void AddWatch(size_t first_watch, const void* target, bool is_bool, size_t first, size_t count);
+		void CompileWatches(bool include_idle);
+		static size_t WatchWords(const WatchRange& w);
+		static void SaveWatch(const WatchRange& w, uint32_t* snapshot);
+		static void DiffWatch(const WatchRange& w, const uint32_t* snapshot, ChangeMask& m, InputEventQueue* events);
+		void ParseTracked(const ReportProgram& prog, const uint8_t* report, ChangeMask& changed);
+		void AddReset(size_t first, const ResetRange& rr);
+		void CompileDedup();
+		void CompileArrayLookups();
+		void CompileMinSizes();
+		void LinkOps();
+		void ApplyInterest();
+		int FinishInit(const mapping_t& mapping);
+		int LoadBlobMapping(const void* blob, size_t blob_size, const BlobTarget* targets, size_t num_targets);
+		void UseArena(Arena* arena);
+		int EndArenaInit(Arena* arena, int res);
+
+		// Allocates the vectors below if not nullptr.
+		Arena* _arena = nullptr;
+		// Sorted by report_id.
+		arena_vector<ReportProgram> _programs;
+		// The ops of all report IDs in one contiguous array.
+		arena_vector<FieldOp> _ops;
+		arena_vector<ArrayItemRange> _array_ranges;
+		// Item -> (bit index << 1) | 1 tables of ARRAY ops, zero for unmapped items.
+		arena_vector<uint16_t> _array_lookup;
+		arena_vector<ResetRange> _resets;
 		bool _have_report_ids = false;
+
+		// report_id -> index into _programs. There are at most 255 programs
+		// (report ID 0 is reserved when report IDs are used) so 0xff is free.
+		static constexpr uint8_t NO_PROGRAM = 0xff;
+		uint8_t _program_index[256] = {};
+		uint32_t _unknown_report_ids = 0;
+
+		// The first min_size bytes of the last parsed report of each program
+		// that can be deduplicated, zero padded to whole words.
+		arena_vector<uint32_t> _report_cache;
+		arena_vector<WatchRange> _watches;
+		// Big enough for the watches of any program, each rounded up to words.
+		arena_vector<uint32_t> _watch_snapshot;
+		uint8_t _last_program = NO_PROGRAM;
+		uint32_t _unchanged_reports = 0;
+
+		ChangeMask _interest = { ~(uint32_t)0, ~(uint64_t)0 };
+		InputEventQueue* _events = nullptr;
 	};
 
 	struct SelectiveInputReportParser::UsageIndexRange {
 		size_t desc_min; // minimum usage index for the descriptor field
 		size_t val_min;  // minimum usage index for IInt32Target or IBoolTarget
 		size_t length;   // number of indexes both for the descriptor field and the values
+		bool hat_switch; // int32 hat switch values: out-of-range means HAT_SWITCH_NULL
 	};
 
 	struct SelectiveInputReportParser::DescFieldMappings {
-		std::map<int32_t*, std::vector<UsageIndexRange>> int32_values;
-		std::map<uint8_t*, std::vector<UsageIndexRange>> bool_values;
+		typedef arena_allocator<UsageIndexRange> allocator_type;
+		explicit DescFieldMappings(const allocator_type& a) : int32_values(a), bool_values(a) {}
+
+		arena_map<int32_t*, arena_vector<UsageIndexRange>> int32_values;
+		arena_map<uint8_t*, arena_vector<UsageIndexRange>> bool_values;
 
-		bool AddMapping(int32_t* v, size_t desc_usage_index, size_t values_usage_index) {
+		bool AddMapping(int32_t* v, size_t desc_usage_index, size_t values_usage_index, bool hat_switch) {
 			assert(v);
-			return AppendUsageIndex(int32_values[v], desc_usage_index, values_usage_index);
+			return AppendUsageIndex(int32_values[v], desc_usage_index, values_usage_index, hat_switch);
 		}
 
 		bool AddMapping(uint8_t* v, size_t desc_usage_index, size_t values_usage_index) {
 			assert(v);
-			return AppendUsageIndex(bool_values[v], desc_usage_index, values_usage_index);
+			return AppendUsageIndex(bool_values[v], desc_usage_index, values_usage_index, false);
 		}
 
 	private:
-		bool AppendUsageIndex(std::vector<UsageIndexRange>& ranges, size_t desc_usage_index, size_t values_usage_index) {
+		bool AppendUsageIndex(arena_vector<UsageIndexRange>& ranges, size_t desc_usage_index, size_t values_usage_index, bool hat_switch) {
 			// The logic that tries map descriptor fields onto the application's
 			// variables (the FindFieldUsagesInCollection method) works by
 			// iterating through the usages found in the descriptor and trying
@@ -1915,12 +2699,13 @@ namespace hid {
 			if (!ranges.empty()) {
 				UsageIndexRange& r = ranges.back();
 				if (r.desc_min + r.length == desc_usage_index &&
-					r.val_min + r.length == values_usage_index) {
+					r.val_min + r.length == values_usage_index &&
+					r.hat_switch == hat_switch) {
 					r.length++;
 					return true;
 				}
 			}
-			ranges.push_back({ desc_usage_index, values_usage_index, 1 });
+			ranges.push_back({ desc_usage_index, values_usage_index, 1, hat_switch });
 			return true;
 		}
 	};
@@ -1939,20 +2724,22 @@ namespace hid {
 		bool signed_ : 1;  // true if logical_min is below zero
 		bool first_usage_is_zero : 1; // used only in case of array fields
 		bool byte_aligned : 1;  // true if both bit_offset and report_size are a multiple of 8
-
-		static int ParseVarFields(const ReportFieldMapping& m, const uint8_t* report);
-		static int ParseArrayFields(const ReportFieldMapping& m, const uint8_t* report);
-		static void ProcessArrayItem(const ReportFieldMapping& m, uint32_t index);
-
-		static void ResetFields(const ReportFieldMapping& m);
 	};
 
 
 	class SelectiveInputReportParser::DescriptorMapper : private DescriptorParser::EventHandler {
 	public:
-		DescriptorMapper(mapping_t* m, Collection* input_fields) : _mapping(m), _root(input_fields) {}
+		DescriptorMapper(mapping_t* m, Collection* input_fields, Arena* arena=nullptr)
+			: _mapping(m), _root(input_fields), _scratch(arena, false), _matched_set(_scratch),
+			_matched(_scratch), _prev_matched_size(_scratch), _collection_field_indexes(_scratch) {}
 		int MapFields(const void* descriptor, size_t descriptor_size);
 
+		// MapFields in steps, for sharing a DescriptorParser pass with other
+		// handlers: Prepare, parse with Handler(), then Finish.
+		void Prepare() { ResizeVectors(_root); }
+		DescriptorParser::EventHandler* Handler() { return this; }
+		void Finish();
+
 	private:
 		void ResizeVectors(Collection* c);
 
@@ -1976,8 +2763,11 @@ namespace hid {
 			size_t usage_index;
 		};
 
-		typedef std::multimap<uint32_t, FieldIndex> usage_to_field_index;
+		typedef arena_multimap<uint32_t, FieldIndex> usage_to_field_index;
 		struct FieldIndexes {
+			typedef arena_allocator<FieldIndex> allocator_type;
+			explicit FieldIndexes(const allocator_type& a) : int32_indexes(a), bool_indexes(a) {}
+
 			usage_to_field_index int32_indexes;
 			usage_to_field_index bool_indexes;
 		};
@@ -1989,17 +2779,18 @@ namespace hid {
 
 		// Returns the number of found/mapped usages or a negative error code.
 		int32_t FindFieldUsagesInCollection(Collection* c, const DescriptorParser::FieldParams& fp,
-			DescFieldMappings& dfm, std::vector<bool>* matched_usage_indexes = nullptr);
+			DescFieldMappings& dfm, arena_vector<bool>* matched_usage_indexes = nullptr);
 
 	private:
 		mapping_t* _mapping;
 
 		Collection* _root;
-		std::set<Collection*> _matched_set;
-		std::vector<Collection*> _matched;
-		std::vector<size_t> _prev_matched_size;
+		ArenaAllocator<char> _scratch;
+		arena_set<Collection*> _matched_set;
+		arena_vector<Collection*> _matched;
+		arena_vector<size_t> _prev_matched_size;
 
-		std::map<Collection*, FieldIndexes> _collection_field_indexes;
+		arena_map<Collection*, FieldIndexes> _collection_field_indexes;
 	};
 
 
@@ -2183,7 +2974,8 @@ namespace hid {
 			_collapse_collections = collapse_collections;
 			_collection_stack.clear();
 
-			DescriptorParser p;
+			arena_vector<UsageRange> usage_range_spill;
+			DescriptorParser p(&usage_range_spill);
 			return p.Parse(desc, desc_size, this);
 		}
 
@@ -2230,6 +3022,7 @@ namespace hid {
 	static constexpr uint8_t FLAG_MOUSE    = 0x08;
 	static constexpr uint8_t FLAG_GAMEPAD  = 0x10;
 	static constexpr uint8_t FLAG_JOYSTICK = 0x20;
+	static constexpr uint8_t FLAG_DIGITIZER = 0x40; // pen tablet, touchscreen or touchpad
 
 	// Returns zero or a combination of FLAG_KEYBOARD,etc... flags
 	uint8_t detect_common_input_device_type(const void* desc, size_t desc_size);
@@ -2238,11 +3031,16 @@ namespace hid {
 	class CommonInputDeviceTypeDetector : private DescriptorParser::EventHandler {
 	public:
 		int Detect(const void* desc, size_t desc_size, uint8_t& detected_device_types) {
+			arena_vector<UsageRange> usage_range_spill;
+			DescriptorParser p(&usage_range_spill);
+			return p.Parse(desc, desc_size, Handler(detected_device_types));
+		}
+
+		// For detecting in a DescriptorParser pass shared with other handlers.
+		DescriptorParser::EventHandler* Handler(uint8_t& detected_device_types) {
 			detected_device_types = 0;
 			_detected_device_types = &detected_device_types;
-
-			DescriptorParser p;
-			return p.Parse(desc, desc_size, this);
+			return this;
 		}
 
 	private:
@@ -2260,6 +3058,11 @@ namespace hid {
 			case usage32(PAGE_GENERIC_DESKTOP, USAGE_GAMEPAD):   *_detected_device_types |= FLAG_GAMEPAD;  break;
 			case usage32(PAGE_GENERIC_DESKTOP, USAGE_JOYSTICK):  *_detected_device_types |= FLAG_JOYSTICK; break;
 			case usage32(PAGE_CONSUMER, USAGE_CONSUMER_CONTROL): *_detected_device_types |= FLAG_CONSUMER; break;
+			case usage32(PAGE_DIGITIZERS, USAGE_DIGITIZERS_DIGITIZER):
+			case usage32(PAGE_DIGITIZERS, USAGE_DIGITIZERS_PEN):
+			case usage32(PAGE_DIGITIZERS, USAGE_DIGITIZERS_LIGHT_PEN):
+			case usage32(PAGE_DIGITIZERS, USAGE_DIGITIZERS_TOUCH_SCREEN):
+			case usage32(PAGE_DIGITIZERS, USAGE_DIGITIZERS_TOUCH_PAD):  *_detected_device_types |= FLAG_DIGITIZER; break;
 			}
 			return 0;
 		}
@@ -2268,6 +3071,51 @@ namespace hid {
 	};
 
 
+	// SelectiveInputReportParser::InitMultiple for descriptors that arrive in
+	// chunks (e.g. a GATT long read of the HID report map). Device type
+	// detection and the recording of the parser events happen in Feed while
+	// the rest of the descriptor is still on its way, Finish only has to
+	// replay the recorded events to the mappers.
+	// Holds pointers to itself so it can't be copied or moved.
+	class InitMultipleStream {
+	public:
+		// The arena (if any) receives the recorded events in its scratch area
+		// and is then passed to the parsers by Finish.
+		explicit InitMultipleStream(Arena* arena=nullptr);
+		InitMultipleStream(const InitMultipleStream&) = delete;
+		InitMultipleStream& operator=(const InitMultipleStream&) = delete;
+
+		// Starts a new descriptor. descriptor_size_hint (zero if unknown) is
+		// used to preallocate the event log.
+		void Begin(size_t descriptor_size_hint=0);
+		// Returns nonzero if the descriptor is invalid, later calls return the same error.
+		int Feed(const void* data, size_t size);
+		// The number of bytes fed since Begin.
+		size_t DescriptorSize() const { return _descriptor_size; }
+		// The FLAG_* device types detected in the bytes fed since Begin.
+		uint8_t DeviceTypes() const { return _types; }
+		// Same parameters and results as InitMultiple (with the descriptor
+		// received by Feed) and it also frees the recorded events.
+		int Finish(SelectiveInputReportParser::InitRequest* requests, size_t num_requests,
+			uint8_t* detected_device_types=nullptr);
+		// Drops the descriptor fed since Begin and frees the recorded events.
+		// Has to be called before clearing the arena if Finish isn't called.
+		void Reset();
+
+	private:
+		Arena* _arena;
+		uint8_t _types;
+		size_t _descriptor_size;
+		CommonInputDeviceTypeDetector _detector;
+		DescriptorParser::EventLog _log;
+		DescriptorParser::EventHandler* _handlers[2];
+		int _results[2];
+		DescriptorParser::EventFanOut _fan_out;
+		arena_vector<UsageRange> _usage_range_spill;
+		DescriptorParser _parser;
+	};
+
+
 	struct MouseConfig {
 		// Indexes into the IBoolTarget that receives the button states.
 		static constexpr uint8_t BTN_LEFT = 0;
@@ -2360,6 +3208,67 @@ namespace hid {
 	};
 
 
+	// Absolute pointing devices declared on the digitizers page: pen tablets,
+	// touchscreens and touchpads. The axes receive positions (within the
+	// logical range stored in axes.properties) rather than deltas.
+	//
+	// Multi-touch devices declare the same usages in one logical collection
+	// per finger. Only the first one gets mapped, which is the first contact
+	// reported by each report (the order isn't stable, so a change of
+	// CONTACT_ID has to be treated like lifting the old contact).
+	struct DigitizerConfig {
+		// Indexes into the IBoolTarget that receives the switch states. The
+		// buttons come first so they have the same indexes as the
+		// MouseConfig buttons.
+		static constexpr uint8_t BTN_PRIMARY = 0;   // touchpad click
+		static constexpr uint8_t BTN_SECONDARY = 1;
+		static constexpr uint8_t BTN_TERTIARY = 2;
+		static constexpr uint8_t TIP_SWITCH = 3;    // touching the surface
+		static constexpr uint8_t IN_RANGE = 4;      // pen hovering (or touching)
+		static constexpr uint8_t BARREL_SWITCH = 5; // pen side button
+
+		static constexpr uint8_t NUM_BUTTONS = 6;
+
+		BoolFields buttons {
+			.usages {
+				{ PAGE_BUTTON, 1, 3 },
+				{ PAGE_DIGITIZERS, USAGE_DIGITIZERS_TIP_SWITCH },
+				{ PAGE_DIGITIZERS, USAGE_DIGITIZERS_IN_RANGE },
+				{ PAGE_DIGITIZERS, USAGE_DIGITIZERS_BARREL_SWITCH },
+			},
+		};
+
+		// Indexes into the IInt32Target that receives the axis values.
+		static constexpr uint8_t X = 0;
+		static constexpr uint8_t Y = 1;
+		static constexpr uint8_t CONTACT_ID = 2;
+
+		static constexpr uint8_t NUM_AXES = 3;
+
+		Int32Fields axes {
+			.usages {
+				{ PAGE_GENERIC_DESKTOP, USAGE_X, USAGE_Y },
+				{ PAGE_DIGITIZERS, USAGE_DIGITIZERS_CONTACT_IDENTIFIER },
+			},
+			.mask = FLAG_FIELD_CONST | FLAG_FIELD_VARIABLE | FLAG_FIELD_RELATIVE,
+			.flags = FLAG_FIELD_VARIABLE,
+		};
+
+		Collection root {
+			.type = COLLECTION_TYPE_APPLICATION,
+			.usages { { PAGE_DIGITIZERS, USAGE_DIGITIZERS_DIGITIZER, USAGE_DIGITIZERS_TOUCH_PAD } },
+			.int32s { &axes },
+			.bools { &buttons },
+		};
+
+		Collection* Init(IBoolTarget* buttons_, IInt32Target* axes_) {
+			buttons.target = buttons_;
+			axes.target = axes_;
+			return &root;
+		}
+	};
+
+
 	// Commonly used multimedia keys.
 	struct MediaKeys {
 		// media player
@@ -2625,6 +3534,25 @@ namespace hid {
 	};
 
 
+	// A controller that declares a mouse (e.g. its touchpad) next to the
+	// gamepad. Both application collections are mapped by one parser with
+	// the non-permissive gamepad and mouse configs, so each report updates
+	// the variables of the collection it belongs to. The two configs are
+	// borrowed and keep their own state (e.g. the axis properties).
+	struct GamepadMouseConfig {
+		Collection root;
+
+		Collection* Init(GamepadConfig* gamepad, IBoolTarget* gamepad_buttons, IInt32Target* gamepad_axes,
+			MouseConfig* mouse, IBoolTarget* mouse_buttons, IInt32Target* mouse_axes) {
+			root.collections = {
+				gamepad->Init(gamepad_buttons, gamepad_axes, false),
+				mouse->Init(mouse_buttons, mouse_axes, false),
+			};
+			return &root;
+		}
+	};
+
+
 	// Gamepad with support for more buttons and axes.
 	struct BigGamepadConfig {
 		static constexpr uint8_t NUM_BUTTONS = 64;
@@ -0,0 +1,120 @@
+// Connect-time costs: the DescriptorParser on its own, detect_common_input_device_type + Init against InitMultiple,
+// the streamed InitMultipleStream, and LoadBlob. Microseconds (or nanoseconds) on the host, best of several runs
+#include <stdlib.h>
+#include <vector>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+static const int RUNS = 5;
+
+struct NullHandler : DescriptorParser::EventHandler {};
+
+// Consumer usages given one by one, more of them than fit in the parser's fixed usage range slots
+static std::vector<uint8_t> ManyUsages(int n) {
+	std::vector<uint8_t> d = { 0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x15, 0x00, 0x26, 0xFF, 0x03 };
+	for (int i=0; i<n; ++i) {
+		d.push_back(0x0A);
+		d.push_back((uint8_t)(0x100 + i*2));
+		d.push_back(0x01);
+	}
+	d.insert(d.end(), { 0x75, 0x10, 0x95, 0x01, 0x81, 0x00, 0xC0 });
+	return d;
+}
+
+static void DescriptorParsing() {
+	printf("sizeof(DescriptorParser) %zu\n", sizeof(DescriptorParser));
+	NullHandler handler;
+	for (const TestDevice& dev : TEST_DEVICES) {
+		double ns = BestNsPerIteration(RUNS, 100000, [&](long) {
+			DescriptorParser p;
+			if (p.Parse(dev.desc, dev.size, &handler))
+				abort();
+			ClobberMemory();
+		});
+		printf("%-8s %4zu bytes %8.1f ns/parse %6.2f ns/byte\n", dev.name, dev.size, ns, ns / dev.size);
+	}
+	for (int n : { 16, 17, 200 }) {
+		std::vector<uint8_t> d = ManyUsages(n);
+		arena_vector<UsageRange> spill;
+		double ns = BestNsPerIteration(RUNS, 20000, [&](long) {
+			DescriptorParser p(&spill);
+			if (p.Parse(d.data(), d.size(), &handler))
+				abort();
+			ClobberMemory();
+		});
+		printf("%3d usages %4zu bytes %8.1f ns/parse\n", n, d.size(), ns);
+	}
+}
+
+static void ConnectInit() {
+	alignas(8) static uint8_t buf[16384];
+	Arena arena(buf, sizeof buf);
+	for (const TestDevice& dev : TEST_DEVICES) {
+		// ConfigTargets configs 0 and 1
+		ConfigTargets gt, mt;
+		SelectiveInputReportParser g, m;
+
+		// The connect path before InitMultiple: detect, then Init the detected type's config
+		double detect_init = BestNsPerIteration(RUNS, 20000, [&](long) {
+			uint8_t types = detect_common_input_device_type(dev.desc, dev.size);
+			if (types & FLAG_GAMEPAD)
+				g.Init(gt.Init(0), dev.desc, dev.size);
+			else if (types & FLAG_MOUSE)
+				m.Init(mt.Init(1), dev.desc, dev.size);
+		}) / 1000;
+
+		double multiple = BestNsPerIteration(RUNS, 20000, [&](long) {
+			SelectiveInputReportParser::InitRequest r[2] = {
+				{ &g, gt.Init(0), FLAG_GAMEPAD, 0 }, { &m, mt.Init(1), FLAG_MOUSE, 0 } };
+			g.Reset(); m.Reset();
+			arena.Clear();
+			SelectiveInputReportParser::InitMultiple(r, 2, dev.desc, dev.size, nullptr, &arena);
+		}) / 1000;
+
+		// As the GATT long read delivers it: 22 byte chunks, then Finish
+		double streamed_finish = 1e30;
+		for (int run=0; run<RUNS; ++run) {
+			double total = 0;
+			for (int i=0; i<2000; ++i) {
+				SelectiveInputReportParser::InitRequest r[2] = {
+					{ &g, gt.Init(0), FLAG_GAMEPAD, 0 }, { &m, mt.Init(1), FLAG_MOUSE, 0 } };
+				g.Reset(); m.Reset();
+				arena.Clear();
+				InitMultipleStream s(&arena);
+				s.Begin(256);
+				for (size_t o=0; o<dev.size; o+=22)
+					s.Feed(dev.desc + o, _hrp_min((size_t)22, dev.size - o));
+				total += BestNsPerIteration(1, 1, [&](long) { s.Finish(r, 2, nullptr); });
+			}
+			streamed_finish = _hrp_min(streamed_finish, total / 2000 / 1000);
+		}
+
+		// A gamepad Init against LoadBlob of the same mapping
+		double load_blob = 0;
+		SelectiveInputReportParser::BlobTarget bt[ConfigTargets::NUM_BLOB_TARGETS];
+		gt.BlobTargets(bt);
+		g.Reset(); m.Reset();
+		arena.Clear();
+		if (g.Init(gt.Init(0), dev.desc, dev.size) == 0) {
+			static uint8_t blob[4096];
+			int size = g.SaveBlob(blob, sizeof blob, bt, ConfigTargets::NUM_BLOB_TARGETS);
+			load_blob = BestNsPerIteration(RUNS, 20000, [&](long) { g.LoadBlob(blob, size, bt, ConfigTargets::NUM_BLOB_TARGETS); }) / 1000;
+		}
+		g.Reset(); m.Reset();
+
+		printf("%-8s detect+Init %6.2f us  InitMultiple %6.2f us  streamed Finish %6.2f us", dev.name, detect_init, multiple, streamed_finish);
+		if (load_blob)
+			printf("  LoadBlob %5.2f us", load_blob);
+		printf("\n");
+	}
+}
+
+int main() {
+	printf("-- DescriptorParser\n");
+	DescriptorParsing();
+	printf("-- Init at connect\n");
+	ConnectInit();
+	return 0;
+}
@@ -0,0 +1,109 @@
+// From parsed values to the joystick port: finding the held keys of a keyboard with ForEachSet against testing
+// every key, and the latency from a report arriving to the loop task picking it up, woken by a notification against
+// the fixed 3 ms poll
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <semaphore>
+#include <thread>
+#include <vector>
+#include <HIDReportQueue.h>
+#include "test_util.h"
+
+using namespace hid;
+
+static const int RUNS = 5;
+
+static void HeldKeys() {
+	// Output bits of the keys a keyboard-to-joystick mapping uses (cursor keys, space, ctrl, alt, keypad)
+	uint8_t outputs[256] = {};
+	outputs[0x52] = 1; outputs[0x51] = 2; outputs[0x50] = 4; outputs[0x4f] = 8;
+	outputs[0x2c] = 16; outputs[0xe0] = 16; outputs[0xe2] = 32; outputs[0x60] = 1;
+
+	// 0 to 4 held keys
+	TestRng rng(12345);
+	const int NUM_SETS = 4096;
+	std::vector<BitField<256>> sets(NUM_SETS);
+	for (BitField<256>& s : sets) {
+		memset(s.bytes, 0, sizeof s.bytes);
+		for (int k=rng.Below(5); k>0; --k) {
+			size_t i = 4 + rng.Below(0xE4);
+			s.bytes[i >> 3] |= 1 << (i & 7);
+		}
+	}
+
+	unsigned h1 = 0, h2 = 0;
+	double per_key = BestNsPerIteration(RUNS, 500L*NUM_SETS, [&](long i) {
+		const BitField<256>& s = sets[i % NUM_SETS];
+		uint8_t o = 0;
+		for (size_t k=0; k<256; ++k)
+			if (s[k])
+				o |= outputs[k];
+		h1 += o;
+		ClobberMemory();
+	});
+	double for_each = BestNsPerIteration(RUNS, 500L*NUM_SETS, [&](long i) {
+		uint8_t o = 0;
+		sets[i % NUM_SETS].ForEachSet([&](size_t k) { o |= outputs[k]; });
+		h2 += o;
+		ClobberMemory();
+	});
+	printf("held keys: every key %.1f ns, ForEachSet %.1f ns%s\n", per_key, for_each, h1 == h2 ? "" : " (results differ!)");
+}
+
+static uint32_t nowUs() {
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Reports every periodUs (plus jitter), the consumer either sleeping 3 ms at a time or waiting for a notification
+// with a 3 ms timeout, like the loop task
+static void WakeLatency(bool notify, int periodUs, int numReports) {
+	static HIDReportQueue::Report buf[32];
+	HIDReportQueue q(buf, 32);
+	std::counting_semaphore<1000000> sem(0);
+	std::atomic<bool> done { false };
+	std::thread producer([&] {
+		auto t = std::chrono::steady_clock::now();
+		for (int i=0; i<numReports; ++i) {
+			uint8_t r[8] = {};
+			if (q.Push(nowUs(), 1, r, 8) && notify)
+				sem.release();
+			t += std::chrono::microseconds(periodUs + (i*7919) % 500);
+			std::this_thread::sleep_until(t);
+		}
+		done = true;
+	});
+
+	std::vector<uint32_t> latency;
+	int wakes = 0;
+	while (!done || q.Peek()) {
+		while (const HIDReportQueue::Report* r = q.Peek()) {
+			latency.push_back(nowUs() - r->timeUs);
+			q.Release();
+		}
+		wakes++;
+		if (notify) {
+			(void)sem.try_acquire_for(std::chrono::milliseconds(3));
+			while (sem.try_acquire()) {}
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(3));
+		}
+	}
+	producer.join();
+
+	std::sort(latency.begin(), latency.end());
+	printf("%-8s every %4d us: %zu reports, %d wakes, latency median %u us, p99 %u us, max %u us\n", notify ? "notify" : "poll 3ms",
+		periodUs, latency.size(), wakes, latency[latency.size()/2], latency[latency.size()*99/100], latency.back());
+}
+
+int main() {
+	printf("-- Keyboard to joystick\n");
+	HeldKeys();
+	printf("-- Report to loop task latency\n");
+	WakeLatency(false, 7500, 600);
+	WakeLatency(true, 7500, 600);
+	WakeLatency(false, 1000, 1500);
+	WakeLatency(true, 1000, 1500);
+	return 0;
+}
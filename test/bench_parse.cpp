@@ -0,0 +1,223 @@
+// Parse throughput. Nanoseconds per report on the host, best of several runs; only the ratios carry over to the
+// ESP32-H2. The hashes change only if what the parser extracts changes.
+//
+// Also built against the baseline parser (BASELINE_PARSER). make bench runs that build first and passes its output
+// file here, so each time is printed next to the baseline's
+#include <map>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+static const int RUNS = 5;
+
+static std::map<std::string, double> s_baseline;
+
+static void LoadBaseline(const char* path) {
+	FILE* f = fopen(path, "r");
+	if (!f)
+		return;
+	char line[256], name[64];
+	double ns;
+	while (fgets(line, sizeof line, f))
+		if (sscanf(line, "%63s %lf", name, &ns) == 2)
+			s_baseline[name] = ns;
+	fclose(f);
+}
+
+// One line per measurement: name, ns/report, then the baseline's time and the speedup if there is one
+static void PrintTime(const std::string& name, double ns, const char* suffix = "") {
+	printf("%-28s %6.1f ns/report", name.c_str(), ns);
+	auto it = s_baseline.find(name);
+	if (it != s_baseline.end())
+		printf("   baseline %6.1f ns/report, %4.2fx", it->second, it->second / ns);
+	printf("%s\n", suffix);
+}
+
+// The hash of what the parser extracted, the same for the baseline unless that changed
+static std::string HashSuffix(uint64_t h) {
+	char buf[32];
+	snprintf(buf, sizeof buf, "   hash %016llx", (unsigned long long)h);
+	return buf;
+}
+
+// One report of the device over and over, with one byte changing (so dedup doesn't skip it)
+static void DeviceReports(const TestDevice& dev, int config) {
+	ConfigTargets t;
+	SelectiveInputReportParser p;
+	if (p.Init(t.Init(config), dev.desc, dev.size))
+		return;
+	// The first input report
+	uint8_t id = MaxInputReportID(dev.desc, dev.size) ? 1 : 0;
+	while (!InputReportSize(dev.desc, dev.size, id))
+		++id;
+	size_t size = InputReportSize(dev.desc, dev.size, id);
+	uint8_t report[512];
+	for (size_t i=0; i<size; ++i)
+		report[i] = (uint8_t)(i*37);
+	if (p.Parse(report, size, id))
+		abort();
+	double ns = BestNsPerIteration(RUNS, 1000000, [&](long i) {
+		report[1] = (uint8_t)i;
+		p.Parse(report, size, id);
+		ClobberMemory();
+	});
+	PrintTime(std::string(dev.name) + "/" + ConfigTargets::Name(config), ns);
+}
+
+// The DS4 report with random contents, or with one random byte of the first ten changing from report to report.
+// Untracked is Parse without a ChangeMask, tracked with one. "game" limits the interest to what the sketch's
+// joystick modes read. The baseline has neither, so it only runs untracked/all
+static void DS4Reports(bool one_byte_changes) {
+	ConfigTargets t;
+	SelectiveInputReportParser p;
+	if (p.Init(t.Init(0), DS4, sizeof DS4))
+		return;
+
+	TestRng rng(12345);
+	const size_t size = InputReportSize(DS4, sizeof DS4, 1);
+	const int NUM_REPORTS = 4096;
+	std::vector<uint8_t> reports(NUM_REPORTS*size);
+	for (size_t k=0; k<size; ++k)
+		reports[k] = (uint8_t)rng.Next();
+	for (int i=1; i<NUM_REPORTS; ++i) {
+		uint8_t* r = &reports[i*size];
+		if (one_byte_changes) {
+			memcpy(r, r - size, size);
+			r[rng.Below(10)] = (uint8_t)rng.Next();
+		}
+		else {
+			for (size_t k=0; k<size; ++k)
+				r[k] = (uint8_t)rng.Next();
+		}
+	}
+
+#ifdef BASELINE_PARSER
+	const int NUM_MODES = 1;
+#else
+	const int NUM_MODES = 4;
+	SelectiveInputReportParser::ChangeMask game = {
+		(1u << GamepadConfig::X) | (1u << GamepadConfig::Y) | (1u << GamepadConfig::Z) | (1u << GamepadConfig::RZ) | (1u << GamepadConfig::HAT_SWITCH),
+		(1ull << 0) | (1ull << 1) | (1ull << 3) | (1ull << 4) | (1ull << 6) | (1ull << 7) | (1ull << 10) | (1ull << 11) };
+	SelectiveInputReportParser::ChangeMask all = { ~0u, ~0ull };
+#endif
+
+	for (int mode=0; mode<NUM_MODES; ++mode) {
+		bool tracked = mode & 1, game_only = mode & 2;
+#ifdef BASELINE_PARSER
+		auto parse = [&](const uint8_t* r) { p.Parse(r, size, 1); };
+#else
+		p.SetInterest(game_only ? game : all);
+		SelectiveInputReportParser::ChangeMask mask, *changed = tracked ? &mask : nullptr;
+		auto parse = [&](const uint8_t* r) { p.Parse(r, size, 1, changed); };
+#endif
+		uint64_t h = Fnv(nullptr, 0);
+		for (int i=0; i<NUM_REPORTS; ++i) {
+			parse(&reports[i*size]);
+			for (int k : { GamepadConfig::X, GamepadConfig::Y, GamepadConfig::Z, GamepadConfig::RZ, GamepadConfig::HAT_SWITCH }) {
+				int32_t v = t.axes[k];
+#ifndef BASELINE_PARSER
+				// The baseline's centred hat
+				if (v == HAT_SWITCH_NULL)
+					v = -1;
+#endif
+				h = Fnv(&v, 4, h);
+			}
+			h = Fnv(t.buttons.bytes, 2, h);
+		}
+		double ns = BestNsPerIteration(RUNS, 300L*NUM_REPORTS, [&](long i) {
+			parse(&reports[(i % NUM_REPORTS)*size]);
+			ClobberMemory();
+		});
+		PrintTime(std::string(one_byte_changes ? "ds4-one-byte" : "ds4-random") + (tracked ? "/tracked" : "/untracked") +
+			(game_only ? "/game" : "/all"), ns, HashSuffix(h).c_str());
+	}
+}
+
+// Array fields: the 6KRO keyboard and the consumer array (report 3 of the composite mouse)
+static void ArrayReports() {
+	TestRng rng(12345);
+	const int NUM_REPORTS = 4096;
+	{
+		KeyboardConfig kc;
+		BitField<KeyboardConfig::NUM_KEYS> keys;
+		auto kr = keys.Ref();
+		SelectiveInputReportParser p;
+		if (p.Init(kc.Init(&kr), KEYBOARD, sizeof KEYBOARD))
+			return;
+		std::vector<uint8_t> reports(NUM_REPORTS*8);
+		for (int i=0; i<NUM_REPORTS; ++i) {
+			uint8_t* r = &reports[i*8];
+			r[0] = (uint8_t)rng.Next();
+			r[1] = 0;
+			int n = rng.Below(7);
+			for (int k=0; k<6; ++k)
+				r[2+k] = k < n ? 4 + rng.Below(0x60) : 0;
+			// now and then a rollover error
+			if (rng.Below(50) == 0)
+				r[2] = 1;
+		}
+		uint64_t h = Fnv(nullptr, 0);
+		for (int i=0; i<NUM_REPORTS; ++i) {
+			p.Parse(&reports[i*8], 8, 0);
+			h = Fnv(keys.bytes, sizeof keys.bytes, h);
+		}
+		double ns = BestNsPerIteration(RUNS, 500L*NUM_REPORTS, [&](long i) {
+			p.Parse(&reports[(i % NUM_REPORTS)*8], 8, 0);
+			ClobberMemory();
+		});
+		PrintTime("6kro-keyboard", ns, HashSuffix(h).c_str());
+	}
+	{
+		MultimediaKeyboardConfig mc;
+		BitField<MultimediaKeyboardConfig::NUM_KEYS> keys; BitField<64> media;
+		memset(&keys, 0, sizeof keys); memset(&media, 0, sizeof media);
+		auto kr = keys.Ref(); auto mr = media.Ref();
+		SelectiveInputReportParser p;
+		if (p.Init(mc.Init(&kr, &mr, true), MOUSE, sizeof MOUSE))
+			return;
+		static const uint16_t usages[] = { 0xB0, 0xB1, 0xB5, 0xB6, 0xCD, 0xE2, 0xE9, 0xEA, 0x183, 0x18A, 0x192, 0x194, 0x223,
+			0x224, 0x225, 0x227, 0x22A, 0x30, 0x400, 0x40 };
+		std::vector<uint8_t> reports(NUM_REPORTS*4);
+		for (int i=0; i<NUM_REPORTS; ++i) {
+			for (int k=0; k<2; ++k) {
+				uint16_t v = rng.Below(3) ? usages[rng.Below(sizeof usages / sizeof usages[0])] : 0;
+				reports[i*4 + 2*k] = (uint8_t)v;
+				reports[i*4 + 2*k + 1] = (uint8_t)(v >> 8);
+			}
+		}
+		uint64_t h = Fnv(nullptr, 0);
+		for (int i=0; i<NUM_REPORTS; ++i) {
+			p.Parse(&reports[i*4], 4, 3);
+			h = Fnv(media.bytes, sizeof media.bytes, h);
+		}
+		double ns = BestNsPerIteration(RUNS, 500L*NUM_REPORTS, [&](long i) {
+			p.Parse(&reports[(i % NUM_REPORTS)*4], 4, 3);
+			ClobberMemory();
+		});
+		PrintTime("consumer-array", ns, HashSuffix(h).c_str());
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1)
+		LoadBaseline(argv[1]);
+
+	printf("-- Parse per device and config\n");
+	DeviceReports(TEST_DEVICES[0], 0);
+	DeviceReports(TEST_DEVICES[1], 0);
+	DeviceReports(TEST_DEVICES[2], 1);
+	DeviceReports(TEST_DEVICES[3], 2);
+	DeviceReports(TEST_DEVICES[4], 2);
+
+	printf("-- Change tracking, dedup and interest\n");
+	DS4Reports(false);
+	DS4Reports(true);
+
+	printf("-- Array fields\n");
+	ArrayReports();
+	return 0;
+}
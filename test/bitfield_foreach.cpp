@@ -0,0 +1,34 @@
+// BitField::ForEachSet must visit exactly the set bits, in order, for sizes that are and aren't multiples of 8 or 32
+#include <vector>
+#include "test_util.h"
+
+using namespace hid;
+
+template <size_t N>
+static long Check(TestRng& rng, long& checked) {
+	long failures = 0;
+	for (int it=0; it<20000; ++it) {
+		BitField<N> b;
+		memset(b.bytes, 0, sizeof b.bytes);
+		for (int k=rng.Below(8); k>0; --k) {
+			size_t i = rng.Below(N);
+			b.bytes[i >> 3] |= 1 << (i & 7);
+		}
+		std::vector<size_t> expected, got;
+		for (size_t i=0; i<N; ++i)
+			if (b[i])
+				expected.push_back(i);
+		b.ForEachSet([&](size_t i) { got.push_back(i); });
+		++checked;
+		if (expected != got && failures++ < 5)
+			printf("BitField<%zu>: %zu bits visited, expected %zu\n", N, got.size(), expected.size());
+	}
+	return failures;
+}
+
+int main() {
+	TestRng rng(12345);
+	long checked = 0;
+	long failures = Check<13>(rng, checked) + Check<32>(rng, checked) + Check<70>(rng, checked) + Check<256>(rng, checked);
+	return TestResult("bitfield_foreach", checked, failures);
+}
@@ -0,0 +1,102 @@
+// Report descriptors shared by the tests and benchmarks. They are modelled on real devices but written by hand,
+// so each one covers a particular set of parser features (noted above it)
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Xbox Series (BLE) style: report id 1, 16-bit sticks, 10-bit triggers, hat 1..8 null, 15 buttons, consumer
+// bits in reports 1 and 2, output report 3 (rumble)
+static const uint8_t XBOX[] = {
+0x05,0x01,0x09,0x05,0xA1,0x01,0x85,0x01,0x09,0x01,0xA1,0x00,0x09,0x30,0x09,0x31,0x15,0x00,0x27,0xFF,0xFF,0x00,0x00,0x95,0x02,0x75,0x10,0x81,0x02,0xC0,
+0x09,0x01,0xA1,0x00,0x09,0x32,0x09,0x35,0x15,0x00,0x27,0xFF,0xFF,0x00,0x00,0x95,0x02,0x75,0x10,0x81,0x02,0xC0,
+0x05,0x02,0x09,0xC5,0x15,0x00,0x26,0xFF,0x03,0x95,0x01,0x75,0x0A,0x81,0x02,0x15,0x00,0x25,0x00,0x75,0x06,0x95,0x01,0x81,0x03,
+0x05,0x02,0x09,0xC4,0x15,0x00,0x26,0xFF,0x03,0x95,0x01,0x75,0x0A,0x81,0x02,0x15,0x00,0x25,0x00,0x75,0x06,0x95,0x01,0x81,0x03,
+0x05,0x01,0x09,0x39,0x15,0x01,0x25,0x08,0x35,0x00,0x46,0x3B,0x01,0x66,0x14,0x00,0x75,0x04,0x95,0x01,0x81,0x42,
+0x75,0x04,0x95,0x01,0x15,0x00,0x25,0x00,0x35,0x00,0x45,0x00,0x65,0x00,0x81,0x03,
+0x05,0x09,0x19,0x01,0x29,0x0F,0x15,0x00,0x25,0x01,0x75,0x01,0x95,0x0F,0x81,0x02,0x15,0x00,0x25,0x00,0x75,0x01,0x95,0x01,0x81,0x03,
+0x05,0x0C,0x0A,0xB2,0x00,0x15,0x00,0x25,0x01,0x95,0x01,0x75,0x01,0x81,0x02,0x15,0x00,0x25,0x00,0x75,0x07,0x95,0x01,0x81,0x03,
+0x05,0x0C,0x09,0x01,0x85,0x02,0xA1,0x01,0x05,0x0C,0x0A,0x23,0x02,0x15,0x00,0x25,0x01,0x95,0x01,0x75,0x01,0x81,0x02,0x15,0x00,0x25,0x00,0x75,0x07,0x95,0x01,0x81,0x03,0xC0,
+0x05,0x0F,0x09,0x21,0x85,0x03,0xA1,0x02,0x09,0x97,0x15,0x00,0x25,0x01,0x75,0x04,0x95,0x01,0x91,0x02,0x15,0x00,0x25,0x00,0x75,0x04,0x95,0x01,0x91,0x03,
+0x09,0x70,0x15,0x00,0x25,0x64,0x75,0x08,0x95,0x04,0x91,0x02,0x09,0x50,0x66,0x01,0x10,0x55,0x0E,0x15,0x00,0x26,0xFF,0x00,0x75,0x08,0x95,0x01,0x91,0x02,
+0x09,0xA7,0x15,0x00,0x26,0xFF,0x00,0x75,0x08,0x95,0x01,0x91,0x02,0x65,0x00,0x55,0x00,0x09,0x7C,0x15,0x00,0x26,0xFF,0x00,0x75,0x08,0x95,0x01,0x91,0x02,0xC0,
+0xC0 };
+
+// 8BitDo Ultimate 2 style: report id 3, 8-bit axes, hat 0..7 null, 16 buttons + vendor
+static const uint8_t EIGHTBITDO[] = {
+0x05,0x01,0x09,0x05,0xA1,0x01,0x85,0x03,
+0x05,0x09,0x19,0x01,0x29,0x10,0x15,0x00,0x25,0x01,0x75,0x01,0x95,0x10,0x81,0x02,
+0x05,0x01,0x09,0x39,0x15,0x00,0x25,0x07,0x35,0x00,0x46,0x3B,0x01,0x65,0x14,0x75,0x04,0x95,0x01,0x81,0x42,0x75,0x04,0x95,0x01,0x81,0x03,0x65,0x00,
+0x09,0x30,0x09,0x31,0x09,0x32,0x09,0x35,0x15,0x00,0x26,0xFF,0x00,0x75,0x08,0x95,0x04,0x81,0x02,
+0x05,0x02,0x09,0xC4,0x09,0xC5,0x15,0x00,0x26,0xFF,0x00,0x75,0x08,0x95,0x02,0x81,0x02,
+0x06,0x00,0xFF,0x09,0x20,0x75,0x08,0x95,0x07,0x81,0x02,
+0x85,0x04,0x09,0x21,0x75,0x08,0x95,0x07,0x81,0x02,
+0xC0 };
+
+// Composite mouse: report 1 mouse (5 buttons, 12-bit X/Y, wheel, pan), report 2 keyboard, report 3 consumer array
+static const uint8_t MOUSE[] = {
+0x05,0x01,0x09,0x02,0xA1,0x01,0x85,0x01,0x09,0x01,0xA1,0x00,
+0x05,0x09,0x19,0x01,0x29,0x05,0x15,0x00,0x25,0x01,0x95,0x05,0x75,0x01,0x81,0x02,0x95,0x01,0x75,0x03,0x81,0x01,
+0x05,0x01,0x09,0x30,0x09,0x31,0x16,0x01,0xF8,0x26,0xFF,0x07,0x75,0x0C,0x95,0x02,0x81,0x06,
+0x09,0x38,0x15,0x81,0x25,0x7F,0x75,0x08,0x95,0x01,0x81,0x06,
+0x05,0x0C,0x0A,0x38,0x02,0x15,0x81,0x25,0x7F,0x75,0x08,0x95,0x01,0x81,0x06,0xC0,0xC0,
+0x05,0x01,0x09,0x06,0xA1,0x01,0x85,0x02,0x05,0x07,0x19,0xE0,0x29,0xE7,0x15,0x00,0x25,0x01,0x75,0x01,0x95,0x08,0x81,0x02,
+0x95,0x01,0x75,0x08,0x81,0x01,0x95,0x06,0x75,0x08,0x15,0x00,0x26,0xFF,0x00,0x05,0x07,0x19,0x00,0x2A,0xFF,0x00,0x81,0x00,0xC0,
+0x05,0x0C,0x09,0x01,0xA1,0x01,0x85,0x03,0x15,0x00,0x26,0xFF,0x03,0x19,0x00,0x2A,0xFF,0x03,0x75,0x10,0x95,0x02,0x81,0x00,0xC0,
+0x06,0x00,0xFF,0x09,0x01,0xA1,0x01,0x85,0x10,0x09,0x01,0x75,0x08,0x95,0x05,0x81,0x02,0xC0 };
+
+// 6KRO boot keyboard without report ids (an array field)
+static const uint8_t KEYBOARD[] = {
+0x05,0x01,0x09,0x06,0xA1,0x01,0x05,0x07,0x19,0xE0,0x29,0xE7,0x15,0x00,0x25,0x01,0x75,0x01,0x95,0x08,0x81,0x02,
+0x95,0x01,0x75,0x08,0x81,0x01,0x95,0x05,0x75,0x01,0x05,0x08,0x19,0x01,0x29,0x05,0x91,0x02,0x95,0x01,0x75,0x03,0x91,0x01,
+0x95,0x06,0x75,0x08,0x15,0x00,0x26,0xFF,0x00,0x05,0x07,0x19,0x00,0x2A,0xFF,0x00,0x81,0x00,0xC0 };
+
+// NKRO keyboard: bitfield of 0xE8 keys, report id 1
+static const uint8_t NKRO[] = {
+0x05,0x01,0x09,0x06,0xA1,0x01,0x85,0x01,0x05,0x07,0x19,0xE0,0x29,0xE7,0x15,0x00,0x25,0x01,0x75,0x01,0x95,0x08,0x81,0x02,
+0x19,0x00,0x29,0xE7,0x95,0xE8,0x81,0x02,0xC0 };
+
+// DualShock 4 style: report id 1, 8-bit sticks, hat 0..7 null, 14 buttons, triggers, 16-bit gyro, 48 vendor bytes.
+// A 65 byte report of which the gamepad config maps about a quarter
+static const uint8_t DS4[] = {
+0x05,0x01,0x09,0x05,0xA1,0x01,0x85,0x01,0x09,0x30,0x09,0x31,0x09,0x32,0x09,0x35,0x15,0x00,0x26,0xFF,0x00,0x75,0x08,0x95,0x04,0x81,0x02,
+0x09,0x39,0x15,0x00,0x25,0x07,0x35,0x00,0x46,0x3B,0x01,0x65,0x14,0x75,0x04,0x95,0x01,0x81,0x42,0x65,0x00,
+0x05,0x09,0x19,0x01,0x29,0x0E,0x15,0x00,0x25,0x01,0x75,0x01,0x95,0x0E,0x81,0x02,
+0x06,0x00,0xFF,0x09,0x20,0x75,0x06,0x95,0x01,0x15,0x00,0x25,0x7F,0x81,0x02,
+0x05,0x01,0x09,0x33,0x09,0x34,0x15,0x00,0x26,0xFF,0x00,0x75,0x08,0x95,0x02,0x81,0x02,
+0x05,0x02,0x09,0xC4,0x09,0xC5,0x75,0x08,0x95,0x02,0x81,0x02,
+0x05,0x01,0x09,0x36,0x09,0x37,0x09,0x38,0x16,0x00,0x80,0x26,0xFF,0x7F,0x75,0x10,0x95,0x03,0x81,0x02,
+0x06,0x00,0xFF,0x09,0x21,0x95,0x30,0x75,0x08,0x81,0x02,0xC0 };
+
+// Pen: in range, tip, barrel, X/Y 0..20000 (16 bit), report id 2
+static const uint8_t PEN[] = {
+ 0x05,0x0D, 0x09,0x02, 0xA1,0x01, 0x85,0x02, 0x09,0x20, 0xA1,0x00,
+  0x09,0x42, 0x09,0x44, 0x09,0x32, 0x15,0x00, 0x25,0x01, 0x75,0x01, 0x95,0x03, 0x81,0x02,
+  0x95,0x05, 0x81,0x03,
+  0x05,0x01, 0x09,0x30, 0x09,0x31, 0x15,0x00, 0x26,0x20,0x4E, 0x75,0x10, 0x95,0x02, 0x81,0x02,
+ 0xC0, 0xC0 };
+
+// Touchpad: 2 fingers (tip, contact id 0..7, X 0..1200, Y 0..800), contact count, button 1; report id 3
+static const uint8_t PAD[] = {
+ 0x05,0x0D, 0x09,0x05, 0xA1,0x01, 0x85,0x03,
+  0x09,0x22, 0xA1,0x02, 0x09,0x42, 0x15,0x00, 0x25,0x01, 0x75,0x01, 0x95,0x01, 0x81,0x02,
+   0x09,0x51, 0x25,0x07, 0x75,0x07, 0x95,0x01, 0x81,0x02,
+   0x05,0x01, 0x09,0x30, 0x26,0xB0,0x04, 0x75,0x10, 0x95,0x01, 0x81,0x02,
+   0x09,0x31, 0x26,0x20,0x03, 0x81,0x02, 0x05,0x0D, 0xC0,
+  0x09,0x22, 0xA1,0x02, 0x09,0x42, 0x15,0x00, 0x25,0x01, 0x75,0x01, 0x95,0x01, 0x81,0x02,
+   0x09,0x51, 0x25,0x07, 0x75,0x07, 0x95,0x01, 0x81,0x02,
+   0x05,0x01, 0x09,0x30, 0x26,0xB0,0x04, 0x75,0x10, 0x95,0x01, 0x81,0x02,
+   0x09,0x31, 0x26,0x20,0x03, 0x81,0x02, 0x05,0x0D, 0xC0,
+  0x09,0x54, 0x25,0x05, 0x75,0x08, 0x95,0x01, 0x81,0x02,
+  0x05,0x09, 0x19,0x01, 0x29,0x01, 0x25,0x01, 0x75,0x01, 0x95,0x01, 0x81,0x02, 0x95,0x07, 0x81,0x03,
+ 0xC0 };
+
+struct TestDevice { const char* name; const uint8_t* desc; size_t size; };
+
+// The descriptors most tests run through every config
+static const TestDevice TEST_DEVICES[] = {
+	{ "xbox",   XBOX,       sizeof(XBOX) },
+	{ "8bitdo", EIGHTBITDO, sizeof(EIGHTBITDO) },
+	{ "mouse",  MOUSE,      sizeof(MOUSE) },
+	{ "kbd",    KEYBOARD,   sizeof(KEYBOARD) },
+	{ "nkro",   NKRO,       sizeof(NKRO) },
+};
@@ -0,0 +1,94 @@
+// A pen and a touchpad through the DigitizerConfig and HIDPointerTracker: sweeping across the whole logical range
+// and back must end where it started, and lifting the pen/finger or switching fingers must not make the pointer jump
+#include "descriptors.h"
+#include "test_util.h"
+#include "HIDPointerTracker.h"
+
+using namespace hid;
+
+int main() {
+	long checked = 0, failures = 0;
+	const TestDevice devices[] = { { "pen", PEN, sizeof PEN }, { "pad", PAD, sizeof PAD } };
+
+	for (const TestDevice& dev : devices) {
+		bool pen = dev.desc == PEN;
+		DigitizerConfig dc;
+		BitField<DigitizerConfig::NUM_BUTTONS> b; Int32Array<DigitizerConfig::NUM_AXES> a;
+		memset(&b, 0, sizeof b); memset(&a, 0, sizeof a);
+		auto br = b.Ref(); auto ar = a.Ref();
+		SelectiveInputReportParser p;
+		uint8_t types = 0;
+		InitMultipleStream stream;
+		stream.Begin(dev.size);
+		stream.Feed(dev.desc, dev.size);
+		SelectiveInputReportParser::InitRequest rq[1] = { { &p, dc.Init(&br, &ar), FLAG_DIGITIZER, 0 } };
+		int r = stream.Finish(rq, 1, &types);
+		++checked;
+		if (r || rq[0].result || !(types & FLAG_DIGITIZER)) {
+			printf("%s: init %d/%d types %02x\n", dev.name, r, rq[0].result, types);
+			++failures;
+			continue;
+		}
+
+		HIDPointerTracker tracker;
+		tracker.Init(&dc.axes.properties[0], &dc.axes.properties[1], 2048);
+		long sx = 0, sy = 0;
+		auto Feed = [&](bool touch, int contact_id, int x, int y) {
+			uint8_t report[16] = {};
+			size_t size;
+			if (pen) {
+				report[0] = touch ? 0x05 : 0x00;  // in range and tip
+				report[1] = x; report[2] = x >> 8; report[3] = y; report[4] = y >> 8;
+				size = 5;
+			} else {
+				report[0] = (touch ? 1 : 0) | (contact_id << 1);
+				report[1] = x; report[2] = x >> 8; report[3] = y; report[4] = y >> 8;
+				report[10] = touch;  // contact count
+				size = 12;
+			}
+			int res = p.Parse(report, size, pen ? 2 : 3);
+			++checked;
+			if (res && res != ERR_REPORT_UNCHANGED) {
+				printf("%s: parse %d\n", dev.name, res);
+				++failures;
+			}
+			bool contact = b[pen ? DigitizerConfig::IN_RANGE : DigitizerConfig::TIP_SWITCH];
+			int dx, dy;
+			tracker.Update(contact, a[DigitizerConfig::CONTACT_ID], a[0], a[1], dx, dy);
+			sx += dx;
+			sy += dy;
+		};
+
+		// In 1-unit steps, so that the motion is all in the remainders
+		int max_x = dc.axes.properties[0].logical_max;
+		for (int x=0; x<=max_x; ++x)
+			Feed(true, 1, x, x / 2);
+		long forward_x = sx, forward_y = sy;
+		for (int x=max_x; x>=0; --x)
+			Feed(true, 1, x, x / 2);
+		printf("%s: sweep moved %ld,%ld and back to %ld,%ld\n", dev.name, forward_x, forward_y, sx, sy);
+		if (sx < -1 || sx > 1 || forward_x < 2000)
+			++failures;
+
+		sx = sy = 0;
+		Feed(false, 1, 0, 0);
+		Feed(true, 1, max_x, max_x / 2);
+		Feed(true, 1, max_x, max_x / 2);
+		if (sx || sy) {
+			printf("%s: touching elsewhere moved %ld,%ld\n", dev.name, sx, sy);
+			++failures;
+		}
+
+		if (!pen) {
+			Feed(true, 1, 100, 100);
+			sx = 0;
+			Feed(true, 2, 900, 100);
+			if (sx) {
+				printf("%s: another finger moved %ld\n", dev.name, sx);
+				++failures;
+			}
+		}
+	}
+
+	return TestResult("digitizer", checked, failures);
+}
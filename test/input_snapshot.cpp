@@ -0,0 +1,69 @@
+// publishSnapshot must copy exactly what the scalers and the buttons give, centred with nothing pressed until the
+// state is valid, with a sequence number that goes up by one per publish, and the gamepad accessors must return the
+// snapshot's values
+#define private public
+#include <BTHIDConn.h>
+#undef private
+#include "test_util.h"
+
+static BTHIDConn s_conn;
+
+int main()
+{
+	TestRng rng( 2468 );
+	long checked = 0, failures = 0;
+
+	hid::Int32Fields::FieldProperties props[hid::GamepadConfig::NUM_AXES] = {};
+	for ( auto& p : props )
+	{
+		p.logical_min = 0;
+		p.logical_max = 255;
+	}
+	props[hid::GamepadConfig::HAT_SWITCH].logical_max = 8;
+	s_conn.m_deviceTypes = hid::FLAG_GAMEPAD;
+	s_conn.initGamepadScalers( props );
+
+	uint32_t sequence = s_conn.getInputSnapshot().sequence;
+	for ( int it=0; it<20000; it++ )
+	{
+		// Not valid for the first few, as before the first report
+		s_conn.m_stateValid = it>=100;
+		for ( int a=0; a<hid::GamepadConfig::NUM_AXES; a++ )
+			s_conn.m_gamepadAxes.items[a] = a==hid::GamepadConfig::HAT_SWITCH && rng.Below( 4 )==0 ? hid::HAT_SWITCH_NULL : (int32_t)rng.Below( 256 );
+		uint32_t buttons = rng.Next();
+		memcpy( s_conn.m_gamepadButtons.bytes, &buttons, sizeof s_conn.m_gamepadButtons.bytes );
+		s_conn.publishSnapshot();
+
+		InputSnapshot s = s_conn.getInputSnapshot();
+		InputSnapshot e = {};
+		e.sequence = sequence + 1;
+		if ( s_conn.m_stateValid )
+		{
+			const int32_t* axes = s_conn.m_gamepadAxes.items;
+			e.leftX  = s_conn.m_axisScalerX0.ScaleValue( axes[hid::GamepadConfig::X] );
+			e.leftY  = s_conn.m_axisScalerY0.ScaleValue( axes[hid::GamepadConfig::Y] );
+			e.rightX = s_conn.m_axisScalerX1.ScaleValue( axes[hid::GamepadConfig::Z] );
+			e.rightY = s_conn.m_axisScalerY1.ScaleValue( axes[hid::GamepadConfig::RZ] );
+			e.hatDir = s_conn.m_axisScalerHat.HatDirection( axes[hid::GamepadConfig::HAT_SWITCH] );
+			for ( int i=0; i<hid::GamepadConfig::NUM_BUTTONS; i++ )
+				e.buttons |= (uint32_t)s_conn.m_gamepadButtons[i] << i;
+		}
+		sequence = s.sequence;
+
+		++checked;
+		if ( s.sequence!=e.sequence || s.leftX!=e.leftX || s.leftY!=e.leftY || s.rightX!=e.rightX || s.rightY!=e.rightY ||
+			 s.hatDir!=e.hatDir || s.buttons!=e.buttons || s.mouseButtons ||
+			 s_conn.getGamepadLeftStickXAxis()!=s.leftX || s_conn.getGamepadLeftStickYAxis()!=s.leftY ||
+			 s_conn.getGamepadRightStickXAxis()!=s.rightX || s_conn.getGamepadRightStickYAxis()!=s.rightY ||
+			 s_conn.getGamepadHatSwitchDir()!=s.hatDir || s_conn.getGamepadDigitalXAxis()!=s.digitalX ||
+			 s_conn.getGamepadDigitalYAxis()!=s.digitalY )
+		{
+			if ( failures++<5 )
+				printf( "publish %d: sequence %u sticks %d %d %d %d hat %d buttons %08x, expected %u %d %d %d %d %d %08x\n", it,
+					s.sequence, s.leftX, s.leftY, s.rightX, s.rightY, s.hatDir, s.buttons,
+					e.sequence, e.leftX, e.leftY, e.rightX, e.rightY, e.hatDir, e.buttons );
+		}
+	}
+
+	return TestResult( "input_snapshot", checked, failures );
+}
@@ -0,0 +1,126 @@
+// A parser Init-ed into an Arena must behave exactly like one Init-ed on the heap, without a single heap allocation
+// (once the config's own vectors have grown), and an arena that is too small must fail cleanly with
+// ERR_ARENA_EXHAUSTED. InitMultiple and LoadBlob must not allocate from the heap either
+#include <new>
+#include <stdlib.h>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+static long s_heapAllocs = 0;
+void* operator new(size_t n) {
+	s_heapAllocs++;
+	void* p = malloc(n ? n : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+alignas(8) static uint8_t s_arenaBuf[32768];
+
+int main() {
+	long checked = 0, failures = 0;
+
+	for (const TestDevice& dev : TEST_DEVICES) {
+		for (int config=0; config<2; ++config) {
+			ConfigTargets t1, t2;
+			Collection* r1 = t1.Init(config);
+			Collection* r2 = t2.Init(config);
+
+			// Declared before the parsers, which mustn't outlive it
+			Arena arena(s_arenaBuf, sizeof s_arenaBuf);
+			SelectiveInputReportParser heap, ar;
+			int rh = heap.Init(r1, dev.desc, dev.size);
+			// The first Init grows the config's vectors
+			ar.Init(r2, dev.desc, dev.size, &arena);
+			ar.Reset();
+			arena.Clear();
+			long before = s_heapAllocs;
+			int ra = ar.Init(r2, dev.desc, dev.size, &arena);
+			long allocs = s_heapAllocs - before;
+			size_t hwm = arena.HighWaterMark();
+			printf("%s %s: init %d/%d, %zu bytes of the arena (high water mark %zu), %ld heap allocations\n", dev.name,
+				ConfigTargets::Name(config), rh, ra, arena.Used(), hwm, allocs);
+			++checked;
+			if (rh != ra || allocs) {
+				++failures;
+				continue;
+			}
+
+			TestRng rng(7);
+			uint8_t report[64];
+			for (int it=0; it<3000 && rh == 0; ++it) {
+				uint8_t id = (uint8_t)rng.Below(4);
+				size_t size = 1 + rng.Below(20);
+				for (size_t i=0; i<size; ++i)
+					report[i] = (uint8_t)rng.Next();
+				SelectiveInputReportParser::ChangeMask m1, m2;
+				int x = heap.Parse(report, size, id, &m1), y = ar.Parse(report, size, id, &m2);
+				++checked;
+				if (x != y || !t1.SameValues(t2) || m1.int32s != m2.int32s || m1.bools != m2.bools) {
+					if (failures++ < 5)
+						printf("%s id%d size %zu: heap %d, arena %d\n", dev.name, id, size, x, y);
+				}
+			}
+
+			// Every size below the high water mark must fail cleanly. Any size from there up must succeed if it ends
+			// the arena at the same alignment (the high water mark includes the padding of the aligned allocations)
+			size_t hwm8 = (hwm + 7) & ~(size_t)7;
+			ar.Reset();
+			for (size_t size=0; size<=hwm+16; ) {
+				Arena small(s_arenaBuf, size);
+				int r = ar.Init(r2, dev.desc, dev.size, &small);
+				++checked;
+				if ((r == 0 && ar.NumMappings() == 0) || (size >= hwm && size % 8 == 0 && r != ra) ||
+					(r != 0 && r != ERR_ARENA_EXHAUSTED && r != ra)) {
+					printf("%s %s: %zu byte arena: %d\n", dev.name, ConfigTargets::Name(config), size, r);
+					++failures;
+				}
+				// before the arena goes out of scope
+				ar.Reset();
+				size_t next = size + (size < 64 ? 1 : 7);
+				size = size < hwm8 && next > hwm8 ? hwm8 : next;
+			}
+		}
+	}
+
+	ConfigTargets gt, mt;
+	for (const TestDevice& dev : TEST_DEVICES) {
+		Arena arena(s_arenaBuf, sizeof s_arenaBuf / 2);
+		SelectiveInputReportParser p1, p2;
+		uint8_t types;
+		SelectiveInputReportParser::InitRequest rq[2] = { { &p1, gt.Init(0), 0, 0 }, { &p2, mt.Init(1), 0, 0 } };
+		SelectiveInputReportParser::InitMultiple(rq, 2, dev.desc, dev.size, &types, &arena);
+		p1.Reset(); p2.Reset();
+		arena.Clear();
+		long before = s_heapAllocs;
+		SelectiveInputReportParser::InitMultiple(rq, 2, dev.desc, dev.size, &types, &arena);
+		long allocs = s_heapAllocs - before;
+
+		int loaded = 0;
+		long load_allocs = 0;
+		if (rq[0].result == 0) {
+			SelectiveInputReportParser::BlobTarget t[ConfigTargets::NUM_BLOB_TARGETS];
+			gt.BlobTargets(t);
+			static uint8_t blob[4096];
+			int n = p1.SaveBlob(blob, sizeof blob, t, ConfigTargets::NUM_BLOB_TARGETS);
+			SelectiveInputReportParser q;
+			Arena blob_arena(s_arenaBuf + sizeof s_arenaBuf / 2, sizeof s_arenaBuf / 2);
+			before = s_heapAllocs;
+			loaded = q.LoadBlob(blob, n, t, ConfigTargets::NUM_BLOB_TARGETS, &blob_arena);
+			load_allocs = s_heapAllocs - before;
+			q.Reset();
+		}
+		p1.Reset(); p2.Reset();
+		printf("%s InitMultiple: types %02x results %d,%d, high water mark %zu, %ld heap allocations; LoadBlob %d, %ld heap allocations\n",
+			dev.name, types, rq[0].result, rq[1].result, arena.HighWaterMark(), allocs, loaded, load_allocs);
+		++checked;
+		if (allocs || loaded || load_allocs)
+			++failures;
+	}
+
+	return TestResult("parser_arena", checked, failures);
+}
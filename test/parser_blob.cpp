@@ -0,0 +1,76 @@
+// A parser loaded from a SaveBlob blob must parse every report exactly like the parser that was Init-ed from the
+// descriptor. Blobs with the wrong targets, truncated blobs and randomly corrupted ones must be rejected (or at
+// least must never write outside the targets)
+#include <vector>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+int main() {
+	TestRng rng(4242);
+	long checked = 0, failures = 0;
+
+	for (const TestDevice& dev : TEST_DEVICES) {
+		for (int config=0; config<ConfigTargets::NUM_CONFIGS; ++config) {
+			ConfigTargets a, b;
+			SelectiveInputReportParser init_parser, blob_parser;
+			if (init_parser.Init(a.Init(config), dev.desc, dev.size))
+				continue;
+
+			SelectiveInputReportParser::BlobTarget ta[ConfigTargets::NUM_BLOB_TARGETS], tb[ConfigTargets::NUM_BLOB_TARGETS];
+			a.BlobTargets(ta);
+			b.BlobTargets(tb);
+
+			int size = init_parser.SaveBlob(nullptr, 0, ta, ConfigTargets::NUM_BLOB_TARGETS);
+			std::vector<uint8_t> blob(size > 0 ? size : 0);
+			int saved = init_parser.SaveBlob(blob.data(), blob.size(), ta, ConfigTargets::NUM_BLOB_TARGETS);
+			int too_small = init_parser.SaveBlob(blob.data(), blob.size() - 1, ta, ConfigTargets::NUM_BLOB_TARGETS);
+			int few_targets = blob_parser.LoadBlob(blob.data(), blob.size(), tb, 0);
+			int truncated = blob_parser.LoadBlob(blob.data(), blob.size() - 1, tb, ConfigTargets::NUM_BLOB_TARGETS);
+			int loaded = blob_parser.LoadBlob(blob.data(), blob.size(), tb, ConfigTargets::NUM_BLOB_TARGETS);
+			++checked;
+			if (size <= 0 || saved != size || too_small >= 0 || few_targets != ERR_INVALID_MAPPING_BLOB ||
+				truncated != ERR_INVALID_MAPPING_BLOB || loaded != 0) {
+				printf("%s %s: size %d saved %d too_small %d few_targets %d truncated %d loaded %d\n", dev.name,
+					ConfigTargets::Name(config), size, saved, too_small, few_targets, truncated, loaded);
+				++failures;
+				continue;
+			}
+
+			uint8_t max_id = MaxInputReportID(dev.desc, dev.size);
+			uint8_t report[512];
+			for (int it=0; it<2000; ++it) {
+				uint8_t id = max_id ? (uint8_t)rng.Below(max_id + 1) : 0;
+				size_t report_size = InputReportSize(dev.desc, dev.size, id);
+				if (!report_size)
+					continue;
+				for (size_t i=0; i<report_size; ++i)
+					report[i] = (it & 3) ? (uint8_t)rng.Next() : 0;
+				int ra = init_parser.Parse(report, report_size, id);
+				int rb = blob_parser.Parse(report, report_size, id);
+				++checked;
+				if (ra != rb || !a.SameValues(b)) {
+					if (failures++ < 5)
+						printf("%s %s id%d: Init parser %d, blob parser %d\n", dev.name, ConfigTargets::Name(config), id, ra, rb);
+				}
+			}
+
+			// Flip random bits. Whatever gets accepted must still write only into the targets, which the address
+			// sanitizer build (make asan) checks
+			for (int it=0; it<2000; ++it) {
+				std::vector<uint8_t> corrupt = blob;
+				corrupt[rng.Below(corrupt.size())] ^= 1 << rng.Below(8);
+				SelectiveInputReportParser fuzzed;
+				if (fuzzed.LoadBlob(corrupt.data(), corrupt.size(), tb, ConfigTargets::NUM_BLOB_TARGETS) == 0) {
+					for (size_t i=0; i<sizeof report; ++i)
+						report[i] = (uint8_t)rng.Next();
+					for (int id=0; id<=max_id; ++id)
+						fuzzed.Parse(report, InputReportSize(dev.desc, dev.size, id), id);
+				}
+			}
+		}
+	}
+
+	return TestResult("parser_blob", checked, failures);
+}
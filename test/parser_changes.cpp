@@ -0,0 +1,61 @@
+// The ChangeMask filled by Parse must match a before/after comparison of the mapped variables, including the
+// relative fields that another report ID resets and the ranges too wide for the mask (reported in the last bit)
+#include <string.h>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+int main() {
+	TestRng rng(777);
+	long checked = 0, nonzero = 0, failures = 0;
+
+	for (const TestDevice& dev : TEST_DEVICES) {
+		for (int config=0; config<3; ++config) {
+			ConfigTargets t;
+			SelectiveInputReportParser p;
+			if (p.Init(t.Init(config), dev.desc, dev.size))
+				continue;
+
+			uint8_t max_id = MaxInputReportID(dev.desc, dev.size);
+			uint8_t report[512];
+			for (int it=0; it<3000; ++it) {
+				uint8_t id = max_id ? (uint8_t)rng.Below(max_id + 1) : 0;
+				size_t size = InputReportSize(dev.desc, dev.size, id);
+				if (!size)
+					continue;
+				// Zeros, a slowly toggling bit (mostly identical reports) or random bytes
+				int mode = rng.Below(4);
+				for (size_t i=0; i<size; ++i)
+					report[i] = mode == 0 ? 0 : mode == 1 ? (it & 1 ? 0x01 : 0) : (uint8_t)rng.Next();
+
+				Int32Array<32> old_axes = t.axes;
+				BitField<256> old_keys = t.keys;
+				BitField<64> old_buttons = t.buttons;
+				SelectiveInputReportParser::ChangeMask changed;
+				int res = p.Parse(report, size, id, &changed);
+
+				// Only one of keys and buttons is mapped, the other never changes
+				SelectiveInputReportParser::ChangeMask expected = {};
+				for (int i=0; i<32; ++i)
+					if (old_axes.items[i] != t.axes.items[i])
+						expected.int32s |= 1u << i;
+				for (int i=0; i<256; ++i)
+					if (old_keys[i] != t.keys[i] || (i < 64 && old_buttons[i] != t.buttons[i]))
+						expected.bools |= 1ull << (i < 63 ? i : 63);
+
+				++checked;
+				if (changed.Any())
+					++nonzero;
+				if (expected.int32s != changed.int32s || expected.bools != changed.bools) {
+					if (failures++ < 5)
+						printf("%s %s id%d res%d: got %x/%llx expected %x/%llx\n", dev.name, ConfigTargets::Name(config), id, res,
+							changed.int32s, (unsigned long long)changed.bools, expected.int32s, (unsigned long long)expected.bools);
+				}
+			}
+		}
+	}
+
+	printf("%ld of the reports changed something\n", nonzero);
+	return TestResult("parser_changes", checked, failures);
+}
@@ -0,0 +1,84 @@
+// Parses random reports of every test descriptor through every config and prints the parsed values. The Makefile
+// compares the output with parser_dump.expected, so any change to what the parser extracts shows up as a diff.
+// Regenerate the expected output (make update-expected) only for an intended change.
+//
+// It is also built against the baseline parser, whose output must match the same file. The intended differences
+// from the baseline are printed the same way for both:
+// - an unknown report ID is ERR_UNKNOWN_REPORT_ID now, ERR_INVALID_REPORT_SIZE before (the dump's reports always
+//   have the right size, so that can only mean the ID);
+// - a centred hat is HAT_SWITCH_NULL now, -1 before;
+// - a report identical to the previous one is skipped with ERR_REPORT_UNCHANGED now, and parsed again before. The
+//   values it leaves behind are printed like a parsed report's, so they must still be the same
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+#ifdef BASELINE_PARSER
+static const int     UNKNOWN_REPORT_ID = ERR_INVALID_REPORT_SIZE;
+static const int     REPORT_UNCHANGED  = ERR_SUCCESS;
+static const int32_t HAT_NULL          = -1;
+#else
+static const int     UNKNOWN_REPORT_ID = ERR_UNKNOWN_REPORT_ID;
+static const int     REPORT_UNCHANGED  = ERR_REPORT_UNCHANGED;
+static const int32_t HAT_NULL          = HAT_SWITCH_NULL;
+#endif
+
+static void Run(const TestDevice& dev, int config, TestRng& rng) {
+	ConfigTargets t;
+	Collection* root = t.Init(config);
+	// The gamepad configs' hat switch axes
+	bool gamepad = config == 0 || config == 4;
+
+	SelectiveInputReportParser p;
+	int r = p.Init(root, dev.desc, dev.size);
+	printf("== %s cfg%d init=%d\n", dev.name, config, r);
+	if (r)
+		return;
+
+	uint8_t max_id = MaxInputReportID(dev.desc, dev.size);
+	uint8_t report[512];
+	for (int it=0; it<400; ++it) {
+		uint8_t id = max_id ? (uint8_t)rng.Below(max_id + 1) : 0;
+		size_t size = InputReportSize(dev.desc, dev.size, id);
+		if (!size)
+			continue;
+		// All zeros, all ones or random bytes
+		int mode = rng.Below(8);
+		for (size_t i=0; i<size; ++i) {
+			uint32_t x = rng.Next();
+			report[i] = mode == 0 ? 0 : mode == 1 ? 0xFF : (uint8_t)x;
+		}
+		int res = p.Parse(report, size, id);
+		if (res == UNKNOWN_REPORT_ID) {
+			printf("id%d unknown\n", id);
+			continue;
+		}
+		if (res != 0 && res != REPORT_UNCHANGED) {
+			printf("id%d res%d\n", id, res);
+			continue;
+		}
+		printf("id%d:", id);
+		for (int i=0; i<32; ++i) {
+			if (gamepad && (i == GamepadConfig::HAT_SWITCH || i == BigGamepadConfig::HAT_SWITCH_2) && t.axes.items[i] == HAT_NULL)
+				printf(" null");
+			else
+				printf(" %d", t.axes.items[i]);
+		}
+		printf(" |");
+		for (size_t i=0; i<sizeof t.keys.bytes; ++i)
+			printf("%02x", t.keys.bytes[i]);
+		printf(" |");
+		for (size_t i=0; i<sizeof t.buttons.bytes; ++i)
+			printf("%02x", t.buttons.bytes[i]);
+		printf("\n");
+	}
+}
+
+int main() {
+	TestRng rng(12345);
+	for (const TestDevice& dev : TEST_DEVICES)
+		for (int config=0; config<ConfigTargets::NUM_CONFIGS; ++config)
+			Run(dev, config, rng);
+	return 0;
+}
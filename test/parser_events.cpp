@@ -0,0 +1,79 @@
+// The InputEventQueue must receive exactly one event per button transition and per axis threshold crossing, compared
+// with a before/after diff of the variables
+#include <algorithm>
+#include <vector>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+typedef InputEventQueue::Event Event;
+
+static bool EventLess(const Event& a, const Event& b) {
+	if (a.index != b.index)
+		return a.index < b.index;
+	if (a.type != b.type)
+		return a.type < b.type;
+	return a.threshold < b.threshold;
+}
+
+int main() {
+	TestRng rng(99);
+	long checked = 0, failures = 0, events = 0;
+
+	ConfigTargets t;
+	SelectiveInputReportParser p;
+	if (p.Init(t.Init(0), XBOX, sizeof XBOX))
+		return TestResult("parser_events", 0, 1);
+
+	static Event buf[1024];
+	InputEventQueue queue(buf, 1024);
+	const uint16_t threshold_axis[3] = { GamepadConfig::X, GamepadConfig::X, GamepadConfig::HAT_SWITCH };
+	const int32_t threshold_value[3] = { 0x4000, 0xC000, 1 };
+	for (int k=0; k<3; ++k)
+		queue.AddAxisThreshold(threshold_axis[k], threshold_value[k]);
+	p.SetEventQueue(&queue);
+
+	size_t size = p.MinReportSize(1);
+	std::vector<uint8_t> report(size);
+	for (int it=0; it<20000; ++it) {
+		// Mostly zeros, so that the buttons and axes keep going back and forth
+		for (uint8_t& x : report)
+			x = rng.Below(4) ? 0 : (uint8_t)rng.Next();
+
+		BitField<64> old_buttons = t.buttons;
+		Int32Array<32> old_axes = t.axes;
+		p.Parse(report.data(), size, 1);
+
+		std::vector<Event> expected, got;
+		for (int i=0; i<64; ++i)
+			if (old_buttons[i] != t.buttons[i])
+				expected.push_back({ (uint16_t)i, t.buttons[i] ? InputEventQueue::EVENT_BUTTON_DOWN : InputEventQueue::EVENT_BUTTON_UP, 0 });
+		for (int k=0; k<3; ++k) {
+			bool was = old_axes[threshold_axis[k]] >= threshold_value[k], now = t.axes[threshold_axis[k]] >= threshold_value[k];
+			if (was != now)
+				expected.push_back({ threshold_axis[k], now ? InputEventQueue::EVENT_AXIS_ABOVE : InputEventQueue::EVENT_AXIS_BELOW, (uint8_t)k });
+		}
+		Event e;
+		while (queue.Pop(e))
+			got.push_back(e);
+
+		std::sort(expected.begin(), expected.end(), EventLess);
+		std::sort(got.begin(), got.end(), EventLess);
+		++checked;
+		events += got.size();
+		bool same = expected.size() == got.size();
+		for (size_t i=0; same && i<got.size(); ++i)
+			same = !EventLess(expected[i], got[i]) && !EventLess(got[i], expected[i]);
+		if (!same) {
+			if (failures++ < 5)
+				printf("report %d: %zu events, expected %zu\n", it, got.size(), expected.size());
+		}
+	}
+
+	if (queue.Dropped()) {
+		printf("%u events dropped\n", queue.Dropped());
+		++failures;
+	}
+	printf("%ld events\n", events);
+	return TestResult("parser_events", checked, failures);
+}
@@ -0,0 +1,67 @@
+// Reports longer than MinReportSize must parse like full-size reports (the extra bytes are ignored), reports of
+// exactly MinReportSize too (no mapped field lies past it), and shorter ones must be rejected and counted
+#include <vector>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+int main() {
+	TestRng rng(777);
+	long checked = 0, failures = 0;
+
+	for (const TestDevice& dev : TEST_DEVICES) {
+		for (int config=0; config<3; ++config) {
+			// p gets the short and long reports, q the full ones
+			ConfigTargets t1, t2;
+			SelectiveInputReportParser p, q;
+			if (p.Init(t1.Init(config), dev.desc, dev.size))
+				continue;
+			q.Init(t2.Init(config), dev.desc, dev.size);
+
+			for (int id=0; id<256; ++id) {
+				size_t min_size = p.MinReportSize(id);
+				size_t full_size = InputReportSize(dev.desc, dev.size, id);
+				if (!min_size)
+					continue;
+				if (min_size > full_size) {
+					printf("%s %s id%d: min size %zu > report size %zu\n", dev.name, ConfigTargets::Name(config), id, min_size, full_size);
+					++failures;
+				}
+				uint32_t short_before = p.ShortReports(id);
+				for (int it=0; it<2000; ++it) {
+					std::vector<uint8_t> full(full_size);
+					for (uint8_t& x : full)
+						x = (uint8_t)rng.Next();
+					// Exactly the minimum or longer than the full report
+					size_t len = it % 2 == 0 ? min_size : full_size + 1 + rng.Below(8);
+					std::vector<uint8_t> report(len);
+					for (size_t i=0; i<len; ++i)
+						report[i] = i < full_size ? full[i] : (uint8_t)rng.Next();
+
+					int e1 = p.Parse(report.data(), len, id), e2 = q.Parse(full.data(), full_size, id);
+					bool ok1 = e1 == 0 || e1 == ERR_REPORT_UNCHANGED, ok2 = e2 == 0 || e2 == ERR_REPORT_UNCHANGED;
+					++checked;
+					if (ok1 != ok2 || !t1.SameValues(t2)) {
+						if (failures++ < 5)
+							printf("%s %s id%d len %zu: %d, full report %d\n", dev.name, ConfigTargets::Name(config), id, len, e1, e2);
+					}
+					if (min_size > 1) {
+						++checked;
+						if (p.Parse(full.data(), min_size - 1, id) != ERR_INVALID_REPORT_SIZE)
+							++failures;
+					}
+				}
+				if (min_size > 1 && p.ShortReports(id) - short_before != 2000) {
+					printf("%s %s id%d: %u short reports counted\n", dev.name, ConfigTargets::Name(config), id, (unsigned)(p.ShortReports(id) - short_before));
+					++failures;
+				}
+				printf("%s %s id%d: min size %zu of %zu\n", dev.name, ConfigTargets::Name(config), id, min_size, full_size);
+				if (id == 0)
+					break;
+			}
+		}
+	}
+
+	return TestResult("parser_min_size", checked, failures);
+}
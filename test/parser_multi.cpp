@@ -0,0 +1,70 @@
+// InitMultiple (one pass over the descriptor for the type detection and every config) must detect the same device
+// types and produce parsers that behave exactly like detect_common_input_device_type followed by a separate Init
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+// ConfigTargets configs 0 and 1
+struct Targets {
+	ConfigTargets gamepad, mouse;
+	bool SameValues(const Targets& o) const { return gamepad.SameValues(o.gamepad) && mouse.SameValues(o.mouse); }
+};
+
+// The connect path before InitMultiple: detect the type, then Init the config for it
+static int DetectThenInit(const TestDevice& dev, Targets& t, SelectiveInputReportParser& p, uint8_t& types) {
+	types = detect_common_input_device_type(dev.desc, dev.size);
+	if (types & FLAG_GAMEPAD)
+		return p.Init(t.gamepad.Init(0), dev.desc, dev.size);
+	if (types & FLAG_MOUSE)
+		return p.Init(t.mouse.Init(1), dev.desc, dev.size);
+	return ERR_UNSPECIFIED;
+}
+
+static int InitBoth(const TestDevice& dev, Targets& t, SelectiveInputReportParser& gamepad, SelectiveInputReportParser& mouse, uint8_t& types) {
+	SelectiveInputReportParser::InitRequest r[2] = {
+		{ &gamepad, t.gamepad.Init(0), FLAG_GAMEPAD, 0 },
+		{ &mouse, t.mouse.Init(1), FLAG_MOUSE, 0 } };
+	int res = SelectiveInputReportParser::InitMultiple(r, 2, dev.desc, dev.size, &types);
+	if (res)
+		return res;
+	return (types & FLAG_GAMEPAD) ? r[0].result : (types & FLAG_MOUSE) ? r[1].result : ERR_UNSPECIFIED;
+}
+
+int main() {
+	TestRng rng(99);
+	long checked = 0, failures = 0;
+
+	for (const TestDevice& dev : TEST_DEVICES) {
+		Targets t1, t2;
+		SelectiveInputReportParser single, gamepad, mouse;
+		uint8_t types1, types2;
+		int r1 = DetectThenInit(dev, t1, single, types1);
+		int r2 = InitBoth(dev, t2, gamepad, mouse, types2);
+		SelectiveInputReportParser& multi = (types2 & FLAG_GAMEPAD) ? gamepad : mouse;
+
+		++checked;
+		if (types1 != types2 || r1 != r2) {
+			printf("%s: types %02x/%02x init %d/%d\n", dev.name, types1, types2, r1, r2);
+			++failures;
+			continue;
+		}
+
+		// Any report ID and length, valid or not
+		uint8_t report[64];
+		for (int it=0; it<2000 && r1 == 0; ++it) {
+			uint8_t id = (uint8_t)rng.Below(4);
+			size_t size = 1 + rng.Below(20);
+			for (size_t i=0; i<size; ++i)
+				report[i] = (uint8_t)rng.Next();
+			int x = single.Parse(report, size, id), y = multi.Parse(report, size, id);
+			++checked;
+			if (x != y || !t1.SameValues(t2)) {
+				if (failures++ < 5)
+					printf("%s id%d size %zu: %d/%d\n", dev.name, id, size, x, y);
+			}
+		}
+	}
+
+	return TestResult("parser_multi", checked, failures);
+}
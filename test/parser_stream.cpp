@@ -0,0 +1,126 @@
+// Feeding a descriptor to DescriptorParser in chunks must produce the same events and result as Parse, for every
+// prefix of every descriptor and every chunk size (long items included). InitMultipleStream must produce the same
+// mappings as InitMultiple and use exactly as much of the arena
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+// Records every event as a line of text
+struct EventLog : DescriptorParser::EventHandler {
+	std::string s;
+	void Add(const char* fmt, ...) {
+		char buf[256];
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(buf, sizeof buf, fmt, args);
+		va_end(args);
+		s += buf;
+	}
+	int Field(const DescriptorParser::FieldParams& fp) override {
+		Add("F%d %x %u id%u lmin%d lmax%d rs%u rc%u:", fp.report_type, fp.flags, fp.bit_size, fp.globals->report_id,
+			fp.globals->logical_min, fp.globals->logical_max, fp.globals->report_size, fp.globals->report_count);
+		for (int i=0; i<fp.num_usage_ranges; ++i)
+			Add(" %x:%x-%x", fp.usage_ranges[i].usage_page, fp.usage_ranges[i].usage_min, fp.usage_ranges[i].usage_max);
+		Add("\n");
+		return 0;
+	}
+	int Padding(ReportType report_type, uint8_t report_id, uint32_t bit_size) override {
+		Add("P%d %u %u\n", report_type, report_id, bit_size);
+		return 0;
+	}
+	int BeginCollection(uint8_t type, uint16_t usage_page, uint16_t usage, uint32_t depth) override {
+		Add("B%u %x %x %u\n", type, usage_page, usage, depth);
+		return 0;
+	}
+	int EndCollection(uint32_t depth) override {
+		Add("E%u\n", depth);
+		return 0;
+	}
+};
+
+int main() {
+	long checked = 0, failures = 0;
+
+	std::vector<std::vector<uint8_t>> descs;
+	for (const TestDevice& dev : TEST_DEVICES)
+		descs.emplace_back(dev.desc, dev.desc + dev.size);
+	// One with long items: a tiny one and one longer than most of the chunks
+	std::vector<uint8_t> with_long_items = descs[1];
+	std::vector<uint8_t> long1 = { 0xFE, 0x00, 0x12 }, long2 = { 0xFE, 0x20, 0x34 };
+	long2.resize(3 + 0x20, 0xAB);
+	with_long_items.insert(with_long_items.begin() + 8, long2.begin(), long2.end());
+	with_long_items.insert(with_long_items.begin() + 4, long1.begin(), long1.end());
+	descs.push_back(with_long_items);
+
+	for (const std::vector<uint8_t>& d : descs) {
+		for (size_t len=0; len<=d.size(); ++len) {
+			EventLog expected;
+			arena_vector<UsageRange> usage_ranges;
+			DescriptorParser p(&usage_ranges);
+			int expected_result = p.Parse(d.data(), len, &expected);
+			for (size_t chunk=1; chunk<=23; ++chunk) {
+				EventLog got;
+				DescriptorParser q(&usage_ranges);
+				q.Begin(&got);
+				int r = 0;
+				for (size_t offset=0; offset<len && !r; offset+=chunk)
+					r = q.Feed(d.data() + offset, _hrp_min(chunk, len - offset));
+				if (!r)
+					r = q.End();
+				++checked;
+				if (r != expected_result || got.s != expected.s) {
+					if (failures++ < 5)
+						printf("Feed len %zu chunk %zu: %d, Parse %d\n", len, chunk, r, expected_result);
+				}
+			}
+		}
+	}
+
+	for (const std::vector<uint8_t>& d : descs) {
+		for (size_t chunk : { 1, 3, 7, 22, 512 }) {
+			// ConfigTargets configs 0 and 1 for each side
+			ConfigTargets gt1, gt2, mt1, mt2;
+			SelectiveInputReportParser g1, m1, g2, m2;
+			SelectiveInputReportParser::InitRequest r1[2] = {
+				{ &g1, gt1.Init(0), FLAG_GAMEPAD, 0 }, { &m1, mt1.Init(1), FLAG_MOUSE, 0 } };
+			SelectiveInputReportParser::InitRequest r2[2] = {
+				{ &g2, gt2.Init(0), FLAG_GAMEPAD, 0 }, { &m2, mt2.Init(1), FLAG_MOUSE, 0 } };
+			alignas(8) static uint8_t buf1[16384], buf2[16384];
+			Arena a1(buf1, sizeof buf1), a2(buf2, sizeof buf2);
+
+			uint8_t t1, t2;
+			int e1 = SelectiveInputReportParser::InitMultiple(r1, 2, d.data(), d.size(), &t1, &a1);
+			int e2;
+			{
+				InitMultipleStream s(&a2);
+				s.Begin();
+				for (size_t offset=0; offset<d.size(); offset+=chunk)
+					s.Feed(d.data() + offset, _hrp_min(chunk, d.size() - offset));
+				e2 = s.Finish(r2, 2, &t2);
+			}
+
+			std::vector<uint8_t> b1(4096), b2(4096);
+			SelectiveInputReportParser::BlobTarget tg1[ConfigTargets::NUM_BLOB_TARGETS], tg2[ConfigTargets::NUM_BLOB_TARGETS];
+			gt1.BlobTargets(tg1);
+			gt2.BlobTargets(tg2);
+			int s1 = g1.SaveBlob(b1.data(), b1.size(), tg1, ConfigTargets::NUM_BLOB_TARGETS);
+			int s2 = g2.SaveBlob(b2.data(), b2.size(), tg2, ConfigTargets::NUM_BLOB_TARGETS);
+
+			++checked;
+			if (e1 != e2 || t1 != t2 || r1[0].result != r2[0].result || r1[1].result != r2[1].result || s1 != s2 ||
+				(s1 > 0 && memcmp(b1.data(), b2.data(), s1)) || a1.Used() != a2.Used()) {
+				printf("InitMultipleStream chunk %zu: %d/%d types %x/%x results %d,%d/%d,%d blob %d/%d used %zu/%zu\n", chunk,
+					e1, e2, t1, t2, r1[0].result, r1[1].result, r2[0].result, r2[1].result, s1, s2, a1.Used(), a2.Used());
+				++failures;
+			}
+			// The parsers must let go of the arenas before they go out of scope
+			g1.Reset(); m1.Reset(); g2.Reset(); m2.Reset();
+		}
+	}
+
+	return TestResult("parser_stream", checked, failures);
+}
@@ -0,0 +1,121 @@
+// TruncateReport(id, k) must make the parser accept k-byte reports and map exactly the variables that don't depend
+// on the bytes past k (which must keep their value), without growing the arena. The truncated mapping must survive
+// a blob round trip
+#include <vector>
+#include "descriptors.h"
+#include "test_util.h"
+
+using namespace hid;
+
+static void Clear(ConfigTargets& t) {
+	memset(t.keys.bytes, 0, sizeof t.keys.bytes);
+	memset(t.buttons.bytes, 0, sizeof t.buttons.bytes);
+	memset(t.axes.items, 0, sizeof t.axes.items);
+}
+
+int main() {
+	TestRng rng(4242);
+	long checked = 0, failures = 0;
+	alignas(8) static uint8_t arena_buf[16384];
+
+	for (const TestDevice& dev : TEST_DEVICES) {
+		for (int config=0; config<3; ++config) {
+			for (int use_arena=0; use_arena<2; ++use_arena) {
+				ConfigTargets vp, v1, v2;
+				Arena arena(arena_buf, sizeof arena_buf);
+				SelectiveInputReportParser probe;
+				if (probe.Init(vp.Init(config), dev.desc, dev.size))
+					continue;
+
+				for (int id=0; id<256; ++id) {
+					size_t min_size = probe.MinReportSize(id);
+					if (!min_size)
+						continue;
+					for (size_t k=1; k<=min_size; ++k) {
+						// p gets the truncated k-byte reports. q1 gets the full reports, q2 the same reports with every
+						// byte past k changed: the variables that q1 and q2 agree on don't depend on the bytes past k
+						SelectiveInputReportParser p, q1, q2;
+						Clear(vp); Clear(v1); Clear(v2);
+						arena.Clear();
+						if (p.Init(vp.Init(config), dev.desc, dev.size, use_arena ? &arena : nullptr))
+							continue;
+						size_t used = arena.Used();
+						q1.Init(v1.Init(config), dev.desc, dev.size);
+						q2.Init(v2.Init(config), dev.desc, dev.size);
+
+						++checked;
+						int r = p.TruncateReport(id, k);
+						if (r || p.MinReportSize(id) > k || (k == min_size && p.MinReportSize(id) != min_size) ||
+							(use_arena && arena.Used() > used + 4)) {
+							printf("%s %s arena%d id%d k %zu: result %d min size %zu arena %zu->%zu\n", dev.name, ConfigTargets::Name(config),
+								use_arena, id, k, r, p.MinReportSize(id), used, arena.Used());
+							++failures;
+							continue;
+						}
+
+						SelectiveInputReportParser::BlobTarget targets[ConfigTargets::NUM_BLOB_TARGETS];
+						vp.BlobTargets(targets);
+						const int num_targets = ConfigTargets::NUM_BLOB_TARGETS;
+						int blob_size = p.SaveBlob(nullptr, 0, targets, num_targets);
+						std::vector<uint8_t> blob(blob_size > 0 ? blob_size : 0);
+						SelectiveInputReportParser pb;
+						if (blob_size <= 0 || p.SaveBlob(blob.data(), blob_size, targets, num_targets) != blob_size ||
+							pb.LoadBlob(blob.data(), blob_size, targets, num_targets) || pb.MinReportSize(id) != p.MinReportSize(id)) {
+							printf("%s %s id%d k %zu: blob round trip failed\n", dev.name, ConfigTargets::Name(config), id, k);
+							++failures;
+							continue;
+						}
+
+						SelectiveInputReportParser* parsers[2] = { &p, &pb };
+						for (SelectiveInputReportParser* tp : parsers) {
+							// 1 while q1 and q2 have agreed on the byte so far
+							uint8_t stable[sizeof vp.keys.bytes + sizeof vp.buttons.bytes + sizeof vp.axes.items];
+							memset(stable, 1, sizeof stable);
+							bool reported = false;
+							for (int it=0; it<300; ++it) {
+								std::vector<uint8_t> r1(min_size + 8), r2;
+								for (uint8_t& x : r1)
+									x = (uint8_t)rng.Next();
+								r2 = r1;
+								for (size_t i=k; i<r2.size(); ++i)
+									r2[i] ^= 1 + rng.Below(255);
+
+								int e = tp->Parse(r1.data(), k, id);
+								if (e && e != ERR_REPORT_UNCHANGED) {
+									printf("%s %s id%d k %zu: parse %d\n", dev.name, ConfigTargets::Name(config), id, k, e);
+									++failures;
+									break;
+								}
+								q1.Parse(r1.data(), r1.size(), id);
+								q2.Parse(r2.data(), r2.size(), id);
+
+								const uint8_t* pv[3] = { vp.keys.bytes, vp.buttons.bytes, (const uint8_t*)vp.axes.items };
+								const uint8_t* q1v[3] = { v1.keys.bytes, v1.buttons.bytes, (const uint8_t*)v1.axes.items };
+								const uint8_t* q2v[3] = { v2.keys.bytes, v2.buttons.bytes, (const uint8_t*)v2.axes.items };
+								const size_t sizes[3] = { sizeof vp.keys.bytes, sizeof vp.buttons.bytes, sizeof vp.axes.items };
+								size_t o = 0;
+								for (int s=0; s<3; ++s) {
+									for (size_t i=0; i<sizes[s]; ++i, ++o) {
+										// the int32s are compared whole
+										bool same = s == 2 ? !memcmp(q1v[s] + (i & ~3), q2v[s] + (i & ~3), 4) : q1v[s][i] == q2v[s][i];
+										if (!same)
+											stable[o] = 0;
+										if (stable[o] && pv[s][i] != q1v[s][i] && it > 20 && !reported) {
+											printf("%s %s id%d k %zu: byte %zu differs\n", dev.name, ConfigTargets::Name(config), id, k, o);
+											reported = true;
+											++failures;
+										}
+									}
+								}
+							}
+						}
+					}
+					if (id == 0)
+						break;
+				}
+			}
+		}
+	}
+
+	return TestResult("parser_truncate", checked, failures);
+}
@@ -0,0 +1,75 @@
+// HIDReportQueue between a producer thread (the notify callback) and a consumer polling like the loop task: the
+// reports must come out intact and in order, and every report must be either consumed or counted as dropped. Also
+// run with the consumer stalling and with a producer faster than the queue can absorb
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "HIDReportQueue.h"
+#include "test_util.h"
+
+static HIDReportQueue::Report s_buffer[32];
+
+static uint32_t nowUs()
+{
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// Report i is i followed by a pattern, 4 to 19 bytes long
+static long run( const char* name, int periodUs, int numReports, int stallEvery, long& checked )
+{
+	HIDReportQueue    q( s_buffer, 32 );
+	std::atomic<bool> done { false };
+	std::thread       producer( [&] {
+		auto t = std::chrono::steady_clock::now();
+		for ( uint32_t i=0; i<(uint32_t)numReports; i++ )
+		{
+			uint8_t r[20];
+			for ( int k=0; k<20; k++ )
+				r[k] = (uint8_t)( i*7 + k );
+			memcpy( r, &i, 4 );
+			q.Push( nowUs(), 1, r, 4 + i%16 );
+			t += std::chrono::microseconds( periodUs );
+			std::this_thread::sleep_until( t );
+		}
+		done = true;
+	} );
+
+	uint32_t consumed = 0, last = 0, maxLatency = 0;
+	long     failures = 0;
+	for ( int iteration=1; !done || q.Peek(); iteration++ )
+	{
+		while ( const HIDReportQueue::Report* r = q.Peek() )
+		{
+			uint32_t i;
+			memcpy( &i, r->data, 4 );
+			bool ok = ( !consumed || i>last ) && r->length==4 + i%16;
+			for ( int k=4; k<r->length; k++ )
+				ok = ok && r->data[k]==(uint8_t)( i*7 + k );
+			checked++;
+			failures += !ok;
+			maxLatency = std::max( maxLatency, nowUs() - r->timeUs );
+			last = i;
+			consumed++;
+			q.Release();
+		}
+		bool stall = stallEvery && iteration%stallEvery==0;
+		std::this_thread::sleep_for( std::chrono::microseconds( stall ? 20000 : 3000 ) );
+	}
+	producer.join();
+
+	printf( "%s: received %u consumed %u dropped %u, max depth %u/%u, max latency %u us\n", name, q.Received(), consumed,
+			q.Dropped(), q.MaxDepth(), q.Capacity(), maxLatency );
+	checked++;
+	if ( q.Received()!=consumed + q.Dropped() || q.Received()!=(uint32_t)numReports )
+		failures++;
+	return failures;
+}
+
+int main()
+{
+	long checked = 0, failures = 0;
+	failures += run( "1 kHz", 1000, 2000, 0, checked );
+	failures += run( "1 kHz with 20 ms stalls", 1000, 2000, 50, checked );
+	failures += run( "10 kHz", 100, 10000, 0, checked );
+	return TestResult( "report_queue", checked, failures );
+}
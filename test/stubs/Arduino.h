@@ -0,0 +1,54 @@
+// Host stand-ins for the Arduino core, just enough to compile the sketch's .cpp files for the tests in test/.
+// Nothing here does anything. The functions without a body are defined in stubs.cpp
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#define IRAM_ATTR
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define HEX 16
+struct HardwareSerial {
+	template<class... A> int printf(const char*, A...) { return 0; }
+	template<class... A> void print(A...) {}
+	template<class... A> void println(A...) {}
+	void begin(int) {}
+	int available() { return 0; }
+	int read() { return -1; }
+};
+extern HardwareSerial Serial;
+uint32_t millis(); uint32_t micros();
+void delay(uint32_t);
+void digitalWrite(int, int); int digitalRead(int); void pinMode(int, int);
+void noInterrupts(); void interrupts();
+typedef struct { int x; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(x) (void)(x)
+#define portEXIT_CRITICAL(x) (void)(x)
+#define portENTER_CRITICAL_ISR(x) (void)(x)
+#define portEXIT_CRITICAL_ISR(x) (void)(x)
+struct hw_timer_t;
+hw_timer_t* timerBegin(uint32_t); void timerAttachInterrupt(hw_timer_t*, void(*)()); void timerAlarm(hw_timer_t*, uint64_t, bool, uint64_t);
+void timerStart(hw_timer_t*); void timerStop(hw_timer_t*);
+typedef int gpio_num_t;
+struct gpio_config_t { uint64_t pin_bit_mask; int mode; int pull_up_en; int pull_down_en; int intr_type; };
+#define GPIO_INTR_NEGEDGE 2
+#define GPIO_INTR_ANYEDGE 3
+#define GPIO_MODE_INPUT 1
+#define GPIO_PULLUP_ENABLE 1
+#define GPIO_PULLDOWN_DISABLE 0
+#define GPIO_PULLUP_DISABLE 0
+int gpio_config(const gpio_config_t*); int gpio_install_isr_service(int); int gpio_isr_handler_add(gpio_num_t, void(*)(void*), void*);
+#define ESP_INTR_FLAG_IRAM 0
+#define ESP_INTR_FLAG_LEVEL3 0
+typedef void* TaskHandle_t;
+
+TaskHandle_t xTaskGetCurrentTaskHandle(); void xTaskNotifyGive(TaskHandle_t); uint32_t ulTaskNotifyTake(int, uint32_t);
@@ -0,0 +1,6 @@
+// Host stand-in for FastLED (LEDs.cpp)
+#pragma once
+#include <Arduino.h>
+struct CRGB { uint8_t r,g,b; CRGB(uint8_t a=0,uint8_t b_=0,uint8_t c=0):r(a),g(b_),b(c){} enum { Black, White, Red, Green, Blue }; };
+struct CFastLED { void delay(int) {} void show() {} };
+extern CFastLED FastLED;
@@ -0,0 +1,54 @@
+// Host stand-in for NimBLE-Arduino and the bits of the NimBLE host and FreeRTOS that BTHIDConn.cpp uses.
+// Nothing is ever found or connected. The functions without a body are defined in stubs.cpp
+#pragma once
+#include <Arduino.h>
+struct NimBLEAddress { NimBLEAddress() {} NimBLEAddress(const std::string&, int=0) {} const uint8_t* getVal() const { static uint8_t a[6]; return a; } std::string toString() const { return ""; } bool operator==(const NimBLEAddress&) const { return true; } bool operator!=(const NimBLEAddress&) const { return false; } uint8_t getType() const { return 0; } };
+struct NimBLEUUID { NimBLEUUID() {} NimBLEUUID(const char*) {} NimBLEUUID(uint16_t) {} std::string toString() const { return ""; } bool operator==(const NimBLEUUID&) const { return true; } bool operator!=(const NimBLEUUID&) const { return false; } };
+struct NimBLEAttValue { const uint8_t* data() const { return nullptr; } size_t length() const { return 0; } size_t size() const { return 0; } operator std::string() const { return ""; } };
+struct NimBLERemoteDescriptor { NimBLEAttValue readValue() { return {}; } NimBLEAttValue getValue() { return {}; } bool writeValue(const uint8_t*, size_t, bool=false) { return true; } };
+struct NimBLERemoteCharacteristic;
+typedef std::function<void(NimBLERemoteCharacteristic*, uint8_t*, size_t, bool)> notify_callback;
+struct NimBLERemoteCharacteristic { NimBLEUUID getUUID() const { return {}; } uint16_t getHandle() const { return 0; } bool canRead() const { return true; } bool canNotify() const { return true; } bool canIndicate() const { return true; }
+	NimBLEAttValue readValue(time_t* =nullptr) { return {}; } NimBLERemoteDescriptor* getDescriptor(const NimBLEUUID&) { return nullptr; } bool subscribe(bool, notify_callback, bool=true) { return true; } bool unsubscribe() { return true; } std::string toString() const { return ""; } };
+struct NimBLERemoteService { NimBLERemoteCharacteristic* getCharacteristic(const NimBLEUUID&) { return nullptr; } const std::vector<NimBLERemoteCharacteristic*>& getCharacteristics(bool=false) { static std::vector<NimBLERemoteCharacteristic*> v; return v; } };
+struct NimBLEConnInfo { uint16_t getConnHandle() const { return 0; } NimBLEAddress getAddress() const { return {}; } bool isBonded() const { return true; } bool isEncrypted() const { return true; } };
+struct NimBLEClient;
+struct NimBLEClientCallbacks { virtual ~NimBLEClientCallbacks() {} virtual void onConnect(NimBLEClient*) {} virtual void onDisconnect(NimBLEClient*, int) {} virtual bool onConnParamsUpdateRequest(NimBLEClient*, const void*) { return true; } virtual void onAuthenticationComplete(NimBLEConnInfo&) {} virtual void onPassKeyEntry(NimBLEConnInfo&) {} virtual void onConfirmPasskey(NimBLEConnInfo&, uint32_t) {} virtual void onConnectFail(NimBLEClient*, int) {} };
+struct NimBLEClient { bool connect(const void* =nullptr, bool=true, bool=false, bool=true) { return true; } bool connect(const NimBLEAddress&, bool=true, bool=false, bool=true) { return true; } bool disconnect(uint8_t=0) { return true; } uint16_t getConnHandle() const { return 0; } NimBLEAddress getPeerAddress() const { return {}; } int getRssi() { return 0; }
+	NimBLERemoteService* getService(const NimBLEUUID&) { return nullptr; } bool isConnected() const { return true; } void setClientCallbacks(NimBLEClientCallbacks*, bool=true) {} void setConnectTimeout(uint32_t) {} void setConnectionParams(uint16_t, uint16_t, uint16_t, uint16_t, uint16_t=0, uint16_t=0) {} void updateConnParams(uint16_t, uint16_t, uint16_t, uint16_t) {} bool secureConnection(bool=false) { return true; } NimBLEConnInfo getConnInfo() { return {}; } };
+struct NimBLEAdvertisedDevice { NimBLEAddress getAddress() const { return {}; } uint8_t getAdvType() const { return 0; } bool haveServiceUUID() const { return true; } bool isAdvertisingService(const NimBLEUUID&) const { return true; } bool isConnectable() const { return true; } std::string toString() const { return ""; } std::string getName() const { return ""; } uint16_t getAppearance() const { return 0; } bool haveAppearance() const { return false; } bool haveName() const { return false; } };
+struct NimBLEScanResults { int getCount() const { return 0; } };
+struct NimBLEScan;
+struct NimBLEScanCallbacks { virtual ~NimBLEScanCallbacks() {} virtual void onResult(const NimBLEAdvertisedDevice*) {} virtual void onDiscovered(const NimBLEAdvertisedDevice*) {} virtual void onScanEnd(const NimBLEScanResults&, int) {} };
+struct NimBLEScan { void setScanCallbacks(NimBLEScanCallbacks*, bool=false) {} void setActiveScan(bool) {} void setInterval(uint16_t) {} void setWindow(uint16_t) {} void setMaxResults(uint8_t) {} void setDuplicateFilter(uint8_t) {} bool start(uint32_t, bool=false, bool=true) { return true; } bool stop() { return true; } bool isScanning() { return false; } void clearResults() {} void erase(const NimBLEAddress&) {} };
+struct NimBLEDevice {
+	static void init(const std::string&) {} static NimBLEScan* getScan() { static NimBLEScan s; return &s; } static int getNumBonds() { return 0; } static NimBLEAddress getBondedAddress(int) { return {}; } static bool deleteAllBonds() { return true; } static bool deleteBond(const NimBLEAddress&) { return true; }
+	static void setSecurityAuth(bool, bool, bool) {} static void setSecurityIOCap(uint8_t) {} static void setPower(int) {} static NimBLEClient* getDisconnectedClient() { return nullptr; } static size_t getCreatedClientCount() { return 0; } static std::vector<NimBLEClient*> getConnectedClients() { return {}; }
+	static NimBLEClient* getClientByPeerAddress(const NimBLEAddress&) { return nullptr; } static NimBLEClient* getClientByHandle(uint16_t) { return nullptr; } static bool deleteClient(NimBLEClient*) { return true; } static NimBLEClient* createClient(NimBLEAddress={}) { return nullptr; }
+	static bool isBonded(const NimBLEAddress&) { return false; }
+};
+#define BLE_HS_IO_NO_INPUT_OUTPUT 3
+#define ESP_PWR_LVL_P9 9
+
+struct ble_gap_upd_params { uint16_t itvl_min, itvl_max, latency, supervision_timeout; };
+struct ble_gap_conn_desc { struct { int encrypted, authenticated, bonded; } sec_state; uint16_t conn_handle; };
+#define NIMBLE_MAX_CONNECTIONS 3
+typedef NimBLEUUID BLEUUID;
+
+struct os_mbuf { int len; };
+#define OS_MBUF_PKTLEN(m) ((m)->len)
+int os_mbuf_copydata(const os_mbuf*, int, int, void*);
+struct ble_gatt_error { uint16_t status; uint16_t att_handle; };
+struct ble_gatt_attr { uint16_t handle; uint16_t offset; os_mbuf* om; };
+#define BLE_HS_ATT_ERR(x) (0x100 + (x))
+#define BLE_HS_EDONE 14
+#define BLE_ATT_ERR_ATTR_NOT_LONG 0x0b
+int ble_gattc_read_long(uint16_t, uint16_t, uint16_t, int(*)(uint16_t, const ble_gatt_error*, ble_gatt_attr*, void*), void*);
+typedef void* SemaphoreHandle_t;
+typedef struct { int x; } StaticSemaphore_t;
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t*);
+int xSemaphoreGive(SemaphoreHandle_t); int xSemaphoreTake(SemaphoreHandle_t, uint32_t); void vSemaphoreDelete(SemaphoreHandle_t);
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdMS_TO_TICKS(x) (x)
+#define portMAX_DELAY 0xffffffff
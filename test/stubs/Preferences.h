@@ -0,0 +1,8 @@
+// Host stand-in for the Preferences (NVS) library. Nothing is stored, every read misses
+#pragma once
+#include <Arduino.h>
+struct Preferences {
+	bool begin(const char*, bool=false) { return true; } void end() {} bool clear() { return true; } bool remove(const char*) { return true; }
+	size_t getBytesLength(const char*) { return 0; } size_t getBytes(const char*, void*, size_t) { return 0; } size_t putBytes(const char*, const void*, size_t) { return 0; }
+	uint32_t getUInt(const char*, uint32_t d=0) { return d; } size_t putUInt(const char*, uint32_t) { return 0; }
+};
@@ -0,0 +1,29 @@
+// Bodies for the functions and globals declared by the stub headers. BTHIDConn.cpp links against these
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+
+HardwareSerial Serial;
+
+// Every call moves the clock on a little, so the latency code always sees time passing
+static uint32_t s_fakeMicros = 0;
+uint32_t micros() { return s_fakeMicros += 7; }
+uint32_t millis() { return s_fakeMicros / 1000; }
+void     delay( uint32_t ms ) { s_fakeMicros += ms * 1000; }
+
+void digitalWrite( int, int ) {}
+int  digitalRead( int ) { return 1; }
+void pinMode( int, int ) {}
+void noInterrupts() {}
+void interrupts() {}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+void         xTaskNotifyGive( TaskHandle_t ) {}
+uint32_t     ulTaskNotifyTake( int, uint32_t ) { return 0; }
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic( StaticSemaphore_t* ) { return nullptr; }
+int  xSemaphoreGive( SemaphoreHandle_t ) { return pdTRUE; }
+int  xSemaphoreTake( SemaphoreHandle_t, uint32_t ) { return pdTRUE; }
+void vSemaphoreDelete( SemaphoreHandle_t ) {}
+
+int os_mbuf_copydata( const os_mbuf*, int, int, void* ) { return 0; }
+int ble_gattc_read_long( uint16_t, uint16_t, uint16_t, int (*)( uint16_t, const ble_gatt_error*, ble_gatt_attr*, void* ), void* ) { return 0; }
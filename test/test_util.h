@@ -0,0 +1,104 @@
+// Small helpers shared by the tests and benchmarks
+#pragma once
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "hid_report_parser.h"
+
+// xorshift32. Each test seeds its own so that its output doesn't depend on the others
+struct TestRng {
+	uint32_t state;
+	explicit TestRng(uint32_t seed) : state(seed) {}
+	uint32_t Next() { state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state; }
+	uint32_t Below(uint32_t n) { return Next() % n; }
+};
+
+// FNV-1a, for checking that two runs left the same values behind
+inline uint64_t Fnv(const void* p, size_t n, uint64_t h = 14695981039346656037ull) {
+	for (size_t i=0; i<n; ++i)
+		h = (h ^ ((const uint8_t*)p)[i]) * 1099511628211ull;
+	return h;
+}
+
+// One set of targets and the configs the tests run every descriptor through. Init(config) returns the config's
+// root, mapped onto keys (the keyboard configs) or buttons and axes (the others)
+struct ConfigTargets {
+	static constexpr int NUM_CONFIGS = 5;
+	static const char* Name(int config) {
+		static const char* names[NUM_CONFIGS] = { "gamepad", "mouse", "keyboard", "media", "biggamepad" };
+		return names[config];
+	}
+
+	hid::BitField<256> keys; hid::BitField<64> buttons; hid::Int32Array<32> axes;
+	hid::BitFieldRef<256> keys_ref; hid::BitFieldRef<64> buttons_ref; hid::Int32ArrayRef<32> axes_ref;
+	hid::GamepadConfig gc; hid::MouseConfig mc; hid::KeyboardConfig kc; hid::MediaKeyConfig mk; hid::BigGamepadConfig bg;
+
+	ConfigTargets() : keys(), buttons(), axes(), keys_ref(keys.Ref()), buttons_ref(buttons.Ref()), axes_ref(axes.Ref()) {}
+
+#ifndef BASELINE_PARSER
+	static constexpr int NUM_BLOB_TARGETS = 3;
+	// keys, buttons and axes, for SaveBlob and LoadBlob
+	void BlobTargets(hid::SelectiveInputReportParser::BlobTarget targets[NUM_BLOB_TARGETS]) {
+		targets[0] = { keys.bytes, sizeof keys.bytes };
+		targets[1] = { buttons.bytes, sizeof buttons.bytes };
+		targets[2] = { axes.items, sizeof axes.items };
+	}
+#endif
+
+	bool SameValues(const ConfigTargets& o) const {
+		return !memcmp(keys.bytes, o.keys.bytes, sizeof keys.bytes) && !memcmp(buttons.bytes, o.buttons.bytes, sizeof buttons.bytes) &&
+			!memcmp(axes.items, o.axes.items, sizeof axes.items);
+	}
+
+	hid::Collection* Init(int config) {
+		switch (config) {
+		case 0: return gc.Init(&buttons_ref, &axes_ref, true);
+		case 1: return mc.Init(&buttons_ref, &axes_ref, true);
+		case 2: return kc.Init(&keys_ref, true);
+		case 3: return mk.Init(&keys_ref, true);
+		default: return bg.Init(&buttons_ref, &axes_ref, true);
+		}
+	}
+};
+
+// Input report sizes by report ID, from a separate pass over the descriptor.
+// Returns the byte size of report_id (0 if the descriptor has no such input report).
+inline size_t InputReportSize(const uint8_t* desc, size_t size, uint8_t report_id) {
+	hid::ReportSizeScanner<> scanner;
+	hid::DescriptorParser parser;
+	parser.Parse(desc, size, &scanner);
+	return (scanner.ReportSize(hid::ReportType::input, report_id) + 7) / 8;
+}
+
+inline uint8_t MaxInputReportID(const uint8_t* desc, size_t size) {
+	hid::ReportSizeScanner<> scanner;
+	hid::DescriptorParser parser;
+	parser.Parse(desc, size, &scanner);
+	return scanner.MaxReportID(hid::ReportType::input);
+}
+
+// Nanoseconds per iteration of f(i) for i in 0..n, best of the given number of runs.
+template <typename F>
+double BestNsPerIteration(int runs, long n, F f) {
+	double best = 1e30;
+	for (int r=0; r<runs; ++r) {
+		auto t0 = std::chrono::steady_clock::now();
+		for (long i=0; i<n; ++i)
+			f(i);
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+		if (ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+// Keeps the compiler from optimizing away work whose result is only in memory.
+inline void ClobberMemory() { asm volatile("" ::: "memory"); }
+
+// Prints the last line of a test and returns its exit code.
+inline int TestResult(const char* name, long checked, long failures) {
+	printf("%s: %ld checked, %ld failed\n", name, checked, failures);
+	return failures ? 1 : 0;
+}